@@ -20,45 +20,90 @@ int main(int argc, char **argv)
 
     char *line;
     using_history();
+
+    // only the tail goes into readline, the rest stays in the mapped file
+    if (hist_open(NULL) == 0) {
+      char *histSize = getenv("LAB_HISTSIZE");
+      hist_load_readline(histSize ? strtoul(histSize, NULL, 10) : 1000);
+    }
+    rl_bind_keyseq("\\C-r", hist_reverse_search); // indexed search, not readline's linear one
+    if (sh.shell_is_interactive) {
+      // start queued jobs and pick up other shells' history while waiting
+      // at the prompt, readline never sees EOF on a pipe when the hook is
+      // set so only do it for a terminal
+      rl_event_hook = sh_event_hook;
+      frecency_install(); // grey inline suggestions from frecent commands
+      path_install_completion(); // Tab on the first word completes commands
+    }
   
     // get prompt, it will be what shows up before typing
     char *prompt = get_prompt("MY_PROMPT"); // check if env variable exists
 
-    while ((line=readline(prompt))) {
+    // a prompt with $(...) in it is run again for every line
+    char *shownPrompt = NULL;
+    char *pending = NULL; // lines of an if or a loop that is not closed yet
+    while ((line = readline(pending != NULL ? "> " : cmd_substitute(prompt, &shownPrompt) > 0 ? shownPrompt : prompt))) {
+      free(shownPrompt);
+      shownPrompt = NULL;
+
       checkForBackgroundJobs(); // while here, check real quick if any bg jobs are finished
+      hist_sync_readline(); // lines other shells added since the last prompt
 
-      if (line == NULL || *line == '\0' || strspn(line, " \t\n\r") == strlen(line)) {
+      if (pending == NULL && (*line == '\0' || strspn(line, " \t\n\r") == strlen(line))) {
           free(line);
           continue;
       }
 
+      char *expanded;
+      int expandResult = hist_expand(line, &expanded);
+      if (expandResult < 0) {
+        free(line);
+        continue;
+      }
+      if (expandResult > 0) {
+        printf("%s\n", expanded); // show what is going to run, like bash
+        free(line);
+        line = expanded;
+      }
       if (*line) {
-        add_history(line);
-
-        int putToBackground = 0;
-        char *command = strdup(line); // command that was typed
-
-        char *ampersand = strrchr(line, '&');
-        if (ampersand) {
-            putToBackground = 1;
-            *ampersand = '\0';  // get rif of &
-            trim_white(line);
-            
-        }
-
-        char **args = cmd_parse(line);
+        sh_add_history(line);
+      }
 
-        if (!do_builtin(&sh, args)) {
-          runCommand(&sh, args, putToBackground, command);
+      if (pending != NULL) {
+        size_t len = strlen(pending);
+        pending = realloc(pending, len + strlen(line) + 2);
+        if (pending == NULL) {
+          perror("Reallocating failed");
+          exit(EXIT_FAILURE);
         }
+        pending[len] = '\n';
+        strcpy(pending + len + 1, line);
+        free(line);
+        line = pending;
+        pending = NULL;
+      }
 
-        cmd_free(args);
-        free(command);
+      // compiled once, a loop runs without parsing its body again
+      bool incomplete;
+      struct script *script = script_compile(line, &incomplete);
+      if (script != NULL) {
+        script_run(&sh, script);
+        script_free(script);
+      } else if (incomplete) {
+        pending = line; // wait for the rest on the next line
+        continue;
       }
 
       free(line);
   }
 
+  if (pending != NULL) {
+    fprintf(stderr, "syntax error: unexpected end of file\n");
+    free(pending);
+  }
+
+  free(shownPrompt);
   free(prompt);
+  sh_destroy(&sh); // runs out the job queue before exiting
   return 0;
 }
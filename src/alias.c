@@ -0,0 +1,199 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+Aliases -----------------------------------------
+Aliases live in an open addressing hash table keyed by name, so checking the
+first word of a command is one hash and usually one probe. The value is split
+into words once when the alias is defined and those words are copied in when
+it is used. An alias that is being expanded is marked so an alias that uses
+itself, or two that use each other, stop instead of looping.
+*/
+
+typedef struct {
+    uint64_t hash; // 0 marks an empty slot
+    char *name;
+    char *value;
+    char **words; // value split by cmd_parse
+    bool trailingSpace; // the word after it is checked too
+    bool expanding;
+} Alias;
+
+typedef struct {
+    char **words;
+    size_t count;
+    size_t capacity;
+} Words;
+
+static Alias *aliases = NULL;
+static size_t aliasCapacity = 0; // power of two
+static size_t aliasUsed = 0;
+
+// FNV-1a
+static uint64_t hashName(const char *name) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char *p = name; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 0x100000001b3ull;
+    }
+    return h ? h : 1;
+}
+
+static Alias *findSlot(const char *name, uint64_t hash) {
+    size_t mask = aliasCapacity - 1;
+    size_t i = hash & mask;
+    while (aliases[i].hash != 0 && (aliases[i].hash != hash || strcmp(aliases[i].name, name) != 0)) {
+        i = (i + 1) & mask; // linear probing
+    }
+    return &aliases[i];
+}
+
+static Alias *findAlias(const char *name) {
+    if (aliasUsed == 0) {
+        return NULL;
+    }
+    Alias *a = findSlot(name, hashName(name));
+    return a->hash != 0 ? a : NULL;
+}
+
+static void growTable() {
+    size_t oldCapacity = aliasCapacity;
+    Alias *old = aliases;
+    aliasCapacity = oldCapacity ? oldCapacity * 2 : 64;
+    aliases = calloc(aliasCapacity, sizeof(Alias));
+    if (aliases == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].hash != 0) {
+            *findSlot(old[i].name, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+}
+
+static void freeAlias(Alias *a) {
+    free(a->name);
+    free(a->value);
+    cmd_free(a->words);
+    memset(a, 0, sizeof(*a));
+}
+
+void alias_set(const char *name, const char *value) {
+    if ((aliasUsed + 1) * 4 > aliasCapacity * 3) {
+        growTable();
+    }
+    uint64_t hash = hashName(name);
+    Alias *a = findSlot(name, hash);
+    if (a->hash != 0) {
+        freeAlias(a);
+    } else {
+        aliasUsed++;
+    }
+    size_t len = strlen(value);
+    a->hash = hash;
+    a->name = strdup(name);
+    a->value = strdup(value);
+    a->words = cmd_parse(value);
+    a->trailingSpace = len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t');
+}
+
+bool alias_unset(const char *name) {
+    Alias *a = findAlias(name);
+    if (a == NULL) {
+        return false;
+    }
+    freeAlias(a);
+    aliasUsed--;
+
+    // move back the entries after it that probed past it
+    size_t mask = aliasCapacity - 1;
+    size_t hole = a - aliases;
+    for (size_t i = (hole + 1) & mask; aliases[i].hash != 0; i = (i + 1) & mask) {
+        size_t home = aliases[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            aliases[hole] = aliases[i];
+            memset(&aliases[i], 0, sizeof(Alias));
+            hole = i;
+        }
+    }
+    return true;
+}
+
+const char *alias_get(const char *name) {
+    Alias *a = findAlias(name);
+    return a ? a->value : NULL;
+}
+
+void alias_list(void (*fn)(const char *name, const char *value, void *ctx), void *ctx) {
+    for (size_t i = 0; i < aliasCapacity; i++) {
+        if (aliases[i].hash != 0) {
+            fn(aliases[i].name, aliases[i].value, ctx);
+        }
+    }
+}
+
+void alias_free() {
+    for (size_t i = 0; i < aliasCapacity; i++) {
+        if (aliases[i].hash != 0) {
+            freeAlias(&aliases[i]);
+        }
+    }
+    free(aliases);
+    aliases = NULL;
+    aliasCapacity = 0;
+    aliasUsed = 0;
+}
+
+static void pushWord(Words *out, const char *word) {
+    if (out->count + 1 >= out->capacity) {
+        out->capacity = out->capacity ? out->capacity * 2 : 16;
+        out->words = realloc(out->words, out->capacity * sizeof(char *));
+        if (out->words == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    out->words[out->count++] = strdup(word);
+    out->words[out->count] = NULL;
+}
+
+// Function to copy words to out, expanding the first one and any after an
+// alias that ends in a space
+static void expandWords(Words *out, char **words) {
+    bool check = true;
+    for (int i = 0; words[i] != NULL; i++) {
+        Alias *a = check ? findAlias(words[i]) : NULL;
+        if (a == NULL || a->expanding) {
+            pushWord(out, words[i]);
+            check = false;
+            continue;
+        }
+        a->expanding = true;
+        expandWords(out, a->words);
+        a->expanding = false;
+        check = a->trailingSpace;
+    }
+}
+
+char **alias_expand(char **words) {
+    if (words[0] == NULL || findAlias(words[0]) == NULL) {
+        return NULL; // the usual case, one lookup
+    }
+    Words out = {malloc(16 * sizeof(char *)), 0, 16};
+    if (out.words == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    out.words[0] = NULL; // an alias to nothing is still a list
+    expandWords(&out, words);
+    return out.words;
+}
+
+/*
+Aliases end-----------------------------------------
+*/
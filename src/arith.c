@@ -0,0 +1,715 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+Arithmetic -----------------------------------------
+$(( )) expressions with 64 bit integers, wrapping on overflow like bash. An
+expression is compiled once into ops for a little stack machine and kept in
+a direct mapped cache keyed by its text, so a counter in a loop is compiled
+the first time and after that costs a hash, a string compare and a few ops.
+Variables are looked up by name when the ops run. A variable whose value is
+not a number is evaluated as an expression itself, the way bash does it.
+*/
+
+#define ARITH_CACHE_SIZE 256 // power of two
+#define ARITH_STACK 32 // values on the stack before it is malloced
+#define ARITH_MAX_NESTING 64 // variables whose values are expressions
+
+enum {
+    OP_PUSH, // constants[arg]
+    OP_LOAD, // names[arg]
+    OP_STORE, // names[arg] = top, top stays
+    OP_POP,
+    OP_PREINC, // ++names[arg] and -- with PREDEC
+    OP_PREDEC,
+    OP_POSTINC,
+    OP_POSTDEC,
+    OP_NEG,
+    OP_NOT,
+    OP_BITNOT,
+    OP_BOOL,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_POW,
+    OP_SHL,
+    OP_SHR,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_AND,
+    OP_XOR,
+    OP_OR,
+    OP_JUMP, // to op arg
+    OP_JUMPZ, // pops
+    OP_JUMPNZ
+};
+
+typedef struct {
+    uint8_t code;
+    uint32_t arg;
+} ArithOp;
+
+typedef struct {
+    uint64_t hash;
+    char *source;
+    ArithOp *ops;
+    size_t count;
+    size_t capacity;
+    int64_t *constants;
+    size_t constantCount;
+    char **names;
+    size_t nameCount;
+    int maxDepth;
+} Program;
+
+typedef struct {
+    Program *prog;
+    const char *p;
+    const char *error; // where it went wrong
+    int depth;
+} Compiler;
+
+typedef struct {
+    const char *op;
+    int precedence; // higher binds tighter
+    uint8_t code;
+} Binary;
+
+// longest first so << is not taken for <
+static const char *operators[] = {"<<=", ">>=", "**", "<<", ">>", "<=", ">=", "==", "!=", "&&",
+                                  "||", "++", "--", "+=", "-=", "*=", "/=", "%=", "&=", "^=",
+                                  "|=", "+", "-", "*", "/", "%", "<", ">", "&", "^", "|", "!",
+                                  "~", "=", "?", ":", ",", "(", ")"};
+
+static const Binary binaries[] = {
+    {"||", 1, OP_OR}, {"&&", 2, OP_AND}, {"|", 3, OP_OR}, {"^", 4, OP_XOR}, {"&", 5, OP_AND},
+    {"==", 6, OP_EQ}, {"!=", 6, OP_NE}, {"<", 7, OP_LT}, {"<=", 7, OP_LE}, {">", 7, OP_GT},
+    {">=", 7, OP_GE}, {"<<", 8, OP_SHL}, {">>", 8, OP_SHR}, {"+", 9, OP_ADD}, {"-", 9, OP_SUB},
+    {"*", 10, OP_MUL}, {"/", 10, OP_DIV}, {"%", 10, OP_MOD}, {"**", 11, OP_POW}};
+
+static const Binary assignments[] = {
+    {"=", 0, OP_POP}, {"+=", 0, OP_ADD}, {"-=", 0, OP_SUB}, {"*=", 0, OP_MUL},
+    {"/=", 0, OP_DIV}, {"%=", 0, OP_MOD}, {"<<=", 0, OP_SHL}, {">>=", 0, OP_SHR},
+    {"&=", 0, OP_AND}, {"^=", 0, OP_XOR}, {"|=", 0, OP_OR}};
+
+static Program *cache[ARITH_CACHE_SIZE];
+static int nesting = 0;
+
+// FNV-1a
+static uint64_t hashText(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void freeProgram(Program *prog) {
+    if (prog == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < prog->nameCount; i++) {
+        free(prog->names[i]);
+    }
+    free(prog->names);
+    free(prog->constants);
+    free(prog->ops);
+    free(prog->source);
+    free(prog);
+}
+
+void arith_cache_free() {
+    for (int i = 0; i < ARITH_CACHE_SIZE; i++) {
+        freeProgram(cache[i]);
+        cache[i] = NULL;
+    }
+}
+
+/*
+Compiler -----------------------------------------
+*/
+
+// stack effect of each op, jumps are fixed up by hand where branches join
+static int stackEffect(uint8_t code) {
+    switch (code) {
+    case OP_PUSH:
+    case OP_LOAD:
+    case OP_PREINC:
+    case OP_PREDEC:
+    case OP_POSTINC:
+    case OP_POSTDEC:
+        return 1;
+    case OP_STORE:
+    case OP_NEG:
+    case OP_NOT:
+    case OP_BITNOT:
+    case OP_BOOL:
+    case OP_JUMP:
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static size_t emit(Compiler *c, uint8_t code, uint32_t arg) {
+    Program *prog = c->prog;
+    if (prog->count == prog->capacity) {
+        prog->capacity = prog->capacity ? prog->capacity * 2 : 16;
+        prog->ops = realloc(prog->ops, prog->capacity * sizeof(ArithOp));
+    }
+    prog->ops[prog->count].code = code;
+    prog->ops[prog->count].arg = arg;
+    c->depth += stackEffect(code);
+    if (c->depth > prog->maxDepth) {
+        prog->maxDepth = c->depth;
+    }
+    return prog->count++;
+}
+
+static void emitConstant(Compiler *c, int64_t value) {
+    Program *prog = c->prog;
+    prog->constants = realloc(prog->constants, (prog->constantCount + 1) * sizeof(int64_t));
+    prog->constants[prog->constantCount] = value;
+    emit(c, OP_PUSH, (uint32_t)prog->constantCount++);
+}
+
+static uint32_t nameIndex(Compiler *c, const char *name, size_t len) {
+    Program *prog = c->prog;
+    for (size_t i = 0; i < prog->nameCount; i++) {
+        if (strncmp(prog->names[i], name, len) == 0 && prog->names[i][len] == '\0') {
+            return (uint32_t)i;
+        }
+    }
+    prog->names = realloc(prog->names, (prog->nameCount + 1) * sizeof(char *));
+    prog->names[prog->nameCount] = strndup(name, len);
+    return (uint32_t)prog->nameCount++;
+}
+
+static void skipSpace(Compiler *c) {
+    while (*c->p == ' ' || *c->p == '\t' || *c->p == '\n') {
+        c->p++;
+    }
+}
+
+// Function to get the operator at the cursor, NULL if there is none
+static const char *peekOperator(Compiler *c) {
+    skipSpace(c);
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (strncmp(c->p, operators[i], strlen(operators[i])) == 0) {
+            return operators[i];
+        }
+    }
+    return NULL;
+}
+
+static bool acceptOperator(Compiler *c, const char *op) {
+    const char *at = peekOperator(c);
+    if (at == NULL || strcmp(at, op) != 0) {
+        return false;
+    }
+    c->p += strlen(op);
+    return true;
+}
+
+static bool fail(Compiler *c) {
+    if (c->error == NULL) {
+        c->error = c->p;
+    }
+    return false;
+}
+
+// Function to read a variable name, plain or as $name or ${name}
+static bool readName(Compiler *c, const char **name, size_t *len) {
+    skipSpace(c);
+    const char *p = c->p;
+    bool braced = p[0] == '$' && p[1] == '{';
+    bool dollar = p[0] == '$';
+    p += braced ? 2 : dollar ? 1 : 0;
+    if (!dollar) {
+        *len = var_name_length(p);
+    } else if (!braced && p[0] >= '0' && p[0] <= '9') {
+        *len = 1; // $10 is $1 and then 0
+    } else {
+        *len = var_param_length(p); // $1, ${10} and $#
+    }
+    if (*len == 0 || (braced && p[*len] != '}')) {
+        return false;
+    }
+    *name = p;
+    c->p = p + *len + (braced ? 1 : 0);
+    return true;
+}
+
+static int digitValue(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'z') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'Z') {
+        return ch - 'A' + 36;
+    }
+    return ch == '@' ? 62 : ch == '_' ? 63 : 99;
+}
+
+// Function to read 42, 0x2a, 052 or 16#2a, false if it is not a number
+static bool readNumber(const char **at, int64_t *value) {
+    const char *p = *at;
+    if (*p < '0' || *p > '9') {
+        return false;
+    }
+    int base = 10;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (p[0] == '0') {
+        base = 8;
+    } else {
+        const char *hash = p + strspn(p, "0123456789");
+        if (*hash == '#') {
+            base = atoi(p);
+            p = hash + 1;
+            if (base < 2 || base > 64) {
+                return false;
+            }
+        }
+    }
+
+    uint64_t n = 0;
+    const char *digits = p;
+    for (; digitValue(*p) != 99; p++) {
+        int d = digitValue(*p);
+        if (base <= 36 && d >= 36) {
+            d -= 26; // upper case is the same as lower case up to base 36
+        }
+        if (d >= base) {
+            return false;
+        }
+        n = n * base + d; // wraps like bash
+    }
+    if (p == digits && base != 8) {
+        return false;
+    }
+    *value = (int64_t)n;
+    *at = p;
+    return true;
+}
+
+static bool parseComma(Compiler *c);
+static bool parseAssign(Compiler *c);
+
+static bool parsePrimary(Compiler *c) {
+    skipSpace(c);
+    if (acceptOperator(c, "(")) {
+        if (!parseComma(c) || !acceptOperator(c, ")")) {
+            return fail(c);
+        }
+        return true;
+    }
+    int64_t value;
+    if (readNumber(&c->p, &value)) {
+        emitConstant(c, value);
+        return true;
+    }
+    const char *name;
+    size_t len;
+    if (!readName(c, &name, &len)) {
+        return fail(c);
+    }
+    uint32_t var = nameIndex(c, name, len);
+    if (acceptOperator(c, "++")) {
+        emit(c, OP_POSTINC, var);
+    } else if (acceptOperator(c, "--")) {
+        emit(c, OP_POSTDEC, var);
+    } else {
+        emit(c, OP_LOAD, var);
+    }
+    return true;
+}
+
+static bool parseUnary(Compiler *c) {
+    const char *op = peekOperator(c);
+    if (op == NULL) {
+        return parsePrimary(c);
+    }
+    if (strcmp(op, "++") == 0 || strcmp(op, "--") == 0) {
+        c->p += 2;
+        const char *name;
+        size_t len;
+        if (!readName(c, &name, &len)) {
+            return fail(c);
+        }
+        emit(c, op[0] == '+' ? OP_PREINC : OP_PREDEC, nameIndex(c, name, len));
+        return true;
+    }
+    uint8_t code;
+    if (strcmp(op, "-") == 0) {
+        code = OP_NEG;
+    } else if (strcmp(op, "!") == 0) {
+        code = OP_NOT;
+    } else if (strcmp(op, "~") == 0) {
+        code = OP_BITNOT;
+    } else if (strcmp(op, "+") == 0) {
+        c->p++;
+        return parseUnary(c);
+    } else {
+        return parsePrimary(c);
+    }
+    c->p++;
+    if (!parseUnary(c)) {
+        return false;
+    }
+    emit(c, code, 0);
+    return true;
+}
+
+static const Binary *binaryOperator(const char *op) {
+    for (size_t i = 0; op != NULL && i < sizeof(binaries) / sizeof(binaries[0]); i++) {
+        if (strcmp(binaries[i].op, op) == 0) {
+            return &binaries[i];
+        }
+    }
+    return NULL;
+}
+
+static bool parseBinary(Compiler *c, int minPrecedence) {
+    if (!parseUnary(c)) {
+        return false;
+    }
+    while (true) {
+        const Binary *b = binaryOperator(peekOperator(c));
+        if (b == NULL || b->precedence < minPrecedence) {
+            return true;
+        }
+        c->p += strlen(b->op);
+
+        if (strcmp(b->op, "&&") == 0 || strcmp(b->op, "||") == 0) {
+            // the right side only runs if the left does not decide it
+            bool isAnd = b->op[0] == '&';
+            size_t skip = emit(c, isAnd ? OP_JUMPZ : OP_JUMPNZ, 0);
+            if (!parseBinary(c, b->precedence + 1)) {
+                return false;
+            }
+            emit(c, OP_BOOL, 0);
+            size_t done = emit(c, OP_JUMP, 0);
+            c->prog->ops[skip].arg = (uint32_t)c->prog->count;
+            emitConstant(c, isAnd ? 0 : 1);
+            c->depth--; // the two branches leave one value
+            c->prog->ops[done].arg = (uint32_t)c->prog->count;
+            continue;
+        }
+
+        bool right = b->code == OP_POW;
+        if (!parseBinary(c, right ? b->precedence : b->precedence + 1)) {
+            return false;
+        }
+        emit(c, b->code, 0);
+    }
+}
+
+static bool parseTernary(Compiler *c) {
+    if (!parseBinary(c, 1)) {
+        return false;
+    }
+    if (!acceptOperator(c, "?")) {
+        return true;
+    }
+    size_t otherwise = emit(c, OP_JUMPZ, 0);
+    if (!parseAssign(c) || !acceptOperator(c, ":")) {
+        return fail(c);
+    }
+    size_t done = emit(c, OP_JUMP, 0);
+    c->depth--; // only one of the branches runs
+    c->prog->ops[otherwise].arg = (uint32_t)c->prog->count;
+    if (!parseAssign(c)) {
+        return false;
+    }
+    c->prog->ops[done].arg = (uint32_t)c->prog->count;
+    return true;
+}
+
+static bool parseAssign(Compiler *c) {
+    const char *start = c->p;
+    const char *name;
+    size_t len;
+    if (readName(c, &name, &len)) {
+        const char *op = peekOperator(c);
+        for (size_t i = 0; op != NULL && i < sizeof(assignments) / sizeof(assignments[0]); i++) {
+            if (strcmp(assignments[i].op, op) != 0) {
+                continue;
+            }
+            c->p += strlen(op);
+            uint32_t var = nameIndex(c, name, len);
+            if (assignments[i].code != OP_POP) {
+                emit(c, OP_LOAD, var);
+            }
+            if (!parseAssign(c)) {
+                return false;
+            }
+            if (assignments[i].code != OP_POP) {
+                emit(c, assignments[i].code, 0);
+            }
+            emit(c, OP_STORE, var);
+            return true;
+        }
+    }
+    c->p = start; // not an assignment
+    return parseTernary(c);
+}
+
+static bool parseComma(Compiler *c) {
+    if (!parseAssign(c)) {
+        return false;
+    }
+    while (acceptOperator(c, ",")) {
+        emit(c, OP_POP, 0);
+        if (!parseAssign(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Program *compile(const char *expr, uint64_t hash) {
+    Program *prog = calloc(1, sizeof(Program));
+    prog->hash = hash;
+    prog->source = strdup(expr);
+    Compiler c = {prog, expr, NULL, 0};
+    skipSpace(&c);
+    if (*c.p == '\0') {
+        emitConstant(&c, 0); // $(( )) is 0
+    } else if (parseComma(&c)) {
+        skipSpace(&c);
+        if (*c.p != '\0') {
+            fail(&c);
+        }
+    }
+    if (c.error != NULL) {
+        fprintf(stderr, "%s: syntax error in expression (error token is \"%s\")\n", expr,
+                *c.error ? c.error : "end of expression");
+        freeProgram(prog);
+        return NULL;
+    }
+    return prog;
+}
+
+/*
+Interpreter -----------------------------------------
+*/
+
+static int variableValue(const char *name, int64_t *value) {
+    const char *text = var_get(name);
+    if (text == NULL || *text == '\0') {
+        *value = 0;
+        return 0;
+    }
+    const char *p = text;
+    bool negative = *p == '-';
+    p += *p == '-' || *p == '+';
+    int64_t n;
+    if (readNumber(&p, &n) && *p == '\0') {
+        *value = negative ? (int64_t)(0 - (uint64_t)n) : n;
+        return 0;
+    }
+    if (nesting >= ARITH_MAX_NESTING) {
+        fprintf(stderr, "%s: expression recursion level exceeded\n", name);
+        return -1;
+    }
+    nesting++;
+    int result = arith_eval(text, value);
+    nesting--;
+    return result;
+}
+
+static void storeValue(const char *name, int64_t value) {
+    char text[24];
+    snprintf(text, sizeof(text), "%lld", (long long)value);
+    var_set(name, text);
+}
+
+static int64_t power(int64_t base, int64_t exponent) {
+    uint64_t result = 1;
+    uint64_t b = (uint64_t)base;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result *= b;
+        }
+        b *= b;
+        exponent >>= 1;
+    }
+    return (int64_t)result;
+}
+
+static int run(const Program *prog, int64_t *stack, int64_t *value) {
+    int sp = 0;
+    for (size_t pc = 0; pc < prog->count; pc++) {
+        const ArithOp *op = &prog->ops[pc];
+        int64_t a, b;
+        switch (op->code) {
+        case OP_PUSH:
+            stack[sp++] = prog->constants[op->arg];
+            continue;
+        case OP_LOAD:
+            if (variableValue(prog->names[op->arg], &stack[sp++]) < 0) {
+                return -1;
+            }
+            continue;
+        case OP_STORE:
+            storeValue(prog->names[op->arg], stack[sp - 1]);
+            continue;
+        case OP_POP:
+            sp--;
+            continue;
+        case OP_PREINC:
+        case OP_PREDEC:
+        case OP_POSTINC:
+        case OP_POSTDEC:
+            if (variableValue(prog->names[op->arg], &a) < 0) {
+                return -1;
+            }
+            b = (int64_t)((uint64_t)a + (op->code == OP_PREINC || op->code == OP_POSTINC ? 1 : -1));
+            storeValue(prog->names[op->arg], b);
+            stack[sp++] = op->code == OP_PREINC || op->code == OP_PREDEC ? b : a;
+            continue;
+        case OP_NEG:
+            stack[sp - 1] = (int64_t)(0 - (uint64_t)stack[sp - 1]);
+            continue;
+        case OP_NOT:
+            stack[sp - 1] = !stack[sp - 1];
+            continue;
+        case OP_BITNOT:
+            stack[sp - 1] = ~stack[sp - 1];
+            continue;
+        case OP_BOOL:
+            stack[sp - 1] = stack[sp - 1] != 0;
+            continue;
+        case OP_JUMP:
+            pc = op->arg - 1;
+            continue;
+        case OP_JUMPZ:
+            if (stack[--sp] == 0) {
+                pc = op->arg - 1;
+            }
+            continue;
+        case OP_JUMPNZ:
+            if (stack[--sp] != 0) {
+                pc = op->arg - 1;
+            }
+            continue;
+        }
+
+        b = stack[--sp];
+        a = stack[sp - 1];
+        int64_t *out = &stack[sp - 1];
+        switch (op->code) {
+        case OP_ADD:
+            *out = (int64_t)((uint64_t)a + (uint64_t)b);
+            break;
+        case OP_SUB:
+            *out = (int64_t)((uint64_t)a - (uint64_t)b);
+            break;
+        case OP_MUL:
+            *out = (int64_t)((uint64_t)a * (uint64_t)b);
+            break;
+        case OP_DIV:
+        case OP_MOD:
+            if (b == 0) {
+                fprintf(stderr, "%s: division by 0\n", prog->source);
+                return -1;
+            }
+            if (b == -1) {
+                *out = op->code == OP_DIV ? (int64_t)(0 - (uint64_t)a) : 0; // INT64_MIN / -1 wraps
+            } else {
+                *out = op->code == OP_DIV ? a / b : a % b;
+            }
+            break;
+        case OP_POW:
+            if (b < 0) {
+                fprintf(stderr, "%s: exponent less than 0\n", prog->source);
+                return -1;
+            }
+            *out = power(a, b);
+            break;
+        case OP_SHL:
+            *out = (int64_t)((uint64_t)a << (b & 63));
+            break;
+        case OP_SHR:
+            *out = a >> (b & 63);
+            break;
+        case OP_LT:
+            *out = a < b;
+            break;
+        case OP_LE:
+            *out = a <= b;
+            break;
+        case OP_GT:
+            *out = a > b;
+            break;
+        case OP_GE:
+            *out = a >= b;
+            break;
+        case OP_EQ:
+            *out = a == b;
+            break;
+        case OP_NE:
+            *out = a != b;
+            break;
+        case OP_AND:
+            *out = a & b;
+            break;
+        case OP_XOR:
+            *out = a ^ b;
+            break;
+        case OP_OR:
+            *out = a | b;
+            break;
+        }
+    }
+    *value = stack[0];
+    return 0;
+}
+
+int arith_eval(const char *expr, int64_t *value) {
+    uint64_t hash = hashText(expr);
+    Program **slot = &cache[hash & (ARITH_CACHE_SIZE - 1)];
+    Program *prog = *slot;
+    if (prog == NULL || prog->hash != hash || strcmp(prog->source, expr) != 0) {
+        prog = compile(expr, hash);
+        if (prog == NULL) {
+            return -1;
+        }
+        freeProgram(*slot);
+        *slot = prog;
+    }
+
+    // a variable's value can be an expression that lands in the same slot,
+    // so the program is taken out of the cache while it runs
+    *slot = NULL;
+    int64_t small[ARITH_STACK];
+    int64_t *stack = prog->maxDepth <= ARITH_STACK ? small : malloc(prog->maxDepth * sizeof(int64_t));
+    int result = run(prog, stack, value);
+    if (stack != small) {
+        free(stack);
+    }
+    if (*slot == NULL) {
+        *slot = prog;
+    } else {
+        freeProgram(prog);
+    }
+    return result;
+}
+
+/*
+Arithmetic end-----------------------------------------
+*/
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+BK-tree -----------------------------------------
+A tree over words by edit distance. Every child hangs off its parent by its
+distance to the parent, and by the triangle inequality a search for words
+within tolerance of a query only has to go into children whose distance is
+within tolerance of the query's distance to the parent. The words belong to
+the caller, the tree only points at them.
+*/
+
+#define BK_MAX_WORD 256
+
+void bk_init(struct bk_tree *t) {
+    t->nodes = NULL;
+    t->count = 0;
+    t->capacity = 0;
+}
+
+void bk_free(struct bk_tree *t) {
+    free(t->nodes);
+    bk_init(t);
+}
+
+int bk_distance(const char *a, const char *b) {
+    size_t n = strlen(a);
+    size_t m = strlen(b);
+    if (n >= BK_MAX_WORD || m >= BK_MAX_WORD) {
+        return (int)(n > m ? n : m); // too long to be a typo of anything
+    }
+
+    int prev[BK_MAX_WORD], cur[BK_MAX_WORD];
+    for (size_t j = 0; j <= m; j++) {
+        prev[j] = (int)j;
+    }
+    for (size_t i = 1; i <= n; i++) {
+        cur[0] = (int)i;
+        for (size_t j = 1; j <= m; j++) {
+            int best = prev[j - 1] + (a[i - 1] != b[j - 1]);
+            if (prev[j] + 1 < best) {
+                best = prev[j] + 1;
+            }
+            if (cur[j - 1] + 1 < best) {
+                best = cur[j - 1] + 1;
+            }
+            cur[j] = best;
+        }
+        memcpy(prev, cur, (m + 1) * sizeof(int));
+    }
+    return prev[m];
+}
+
+void bk_insert(struct bk_tree *t, const char *word) {
+    if (t->count == t->capacity) {
+        t->capacity = t->capacity ? t->capacity * 2 : 1024;
+        t->nodes = realloc(t->nodes, t->capacity * sizeof(struct bk_node));
+        if (t->nodes == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int added = (int)t->count++;
+    t->nodes[added].word = word;
+    t->nodes[added].child = -1;
+    t->nodes[added].sibling = -1;
+    t->nodes[added].distance = 0;
+    if (added == 0) {
+        return; // root
+    }
+
+    int node = 0;
+    while (true) {
+        int d = bk_distance(word, t->nodes[node].word);
+        if (d == 0) {
+            t->count--; // already there
+            return;
+        }
+        int c = t->nodes[node].child;
+        while (c >= 0 && t->nodes[c].distance != d) {
+            c = t->nodes[c].sibling;
+        }
+        if (c < 0) {
+            t->nodes[added].distance = d;
+            t->nodes[added].sibling = t->nodes[node].child;
+            t->nodes[node].child = added;
+            return;
+        }
+        node = c;
+    }
+}
+
+size_t bk_search(const struct bk_tree *t, const char *word, int tolerance,
+                 const char **results, int *distances, size_t max) {
+    if (t->count == 0 || max == 0) {
+        return 0;
+    }
+    size_t depth = 0;
+    size_t found = 0;
+    size_t worst = 0; // index of the farthest result once results is full
+    int limit = tolerance; // shrinks to keep only the closest max words
+    size_t stackCapacity = 64;
+    int *stack = malloc(stackCapacity * sizeof(int));
+    stack[depth++] = 0;
+    while (depth > 0) {
+        int node = stack[--depth];
+        int d = bk_distance(word, t->nodes[node].word);
+        if (d <= limit) {
+            size_t at = found < max ? found++ : worst;
+            results[at] = t->nodes[node].word;
+            distances[at] = d;
+            if (found == max) {
+                // full, from now on only something closer than the worst
+                // found so far can get in
+                worst = 0;
+                for (size_t i = 1; i < found; i++) {
+                    if (distances[i] > distances[worst]) {
+                        worst = i;
+                    }
+                }
+                limit = distances[worst] - 1;
+            }
+        }
+        for (int c = t->nodes[node].child; c >= 0; c = t->nodes[c].sibling) {
+            int cd = t->nodes[c].distance;
+            if (cd < d - limit || cd > d + limit) {
+                continue;
+            }
+            if (depth == stackCapacity) {
+                stackCapacity *= 2;
+                stack = realloc(stack, stackCapacity * sizeof(int));
+            }
+            stack[depth++] = c;
+        }
+    }
+    free(stack);
+    return found;
+}
+
+/*
+BK-tree end-----------------------------------------
+*/
@@ -0,0 +1,354 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+Brace expansion -----------------------------------------
+A word is parsed once into a tree of literal runs, sequences, {a,b} lists and
+{x..y[..step]} ranges. The tree is then run like an odometer: every list
+remembers which of its sequences it is on and every range its current value,
+and the next word comes from stepping the rightmost one that has not run out.
+A word is built into one buffer that is reused, so a range of a million
+numbers costs nothing until the numbers are asked for, and no list of the
+words is ever built.
+*/
+
+#define BRACE_LITERAL 0
+#define BRACE_SEQUENCE 1
+#define BRACE_LIST 2
+#define BRACE_RANGE 3
+
+static int addNode(struct brace_gen *g, uint8_t type) {
+    if (g->count == g->capacity) {
+        g->capacity = g->capacity ? g->capacity * 2 : 16;
+        g->nodes = realloc(g->nodes, g->capacity * sizeof(struct brace_node));
+        if (g->nodes == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct brace_node *n = &g->nodes[g->count];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->child = -1;
+    n->next = -1;
+    n->cur = -1;
+    return (int)g->count++;
+}
+
+// Function to append node to the list whose last node is *last
+static void linkNode(struct brace_gen *g, int *first, int *last, int node) {
+    if (*last < 0) {
+        *first = node;
+    } else {
+        g->nodes[*last].next = node;
+    }
+    *last = node;
+}
+
+// Function to get the index of the quote that closes the one at i, or i if
+// w[i] is not a quote
+static size_t skipQuote(const char *w, size_t i, size_t end) {
+    if (w[i] != '\'' && w[i] != '"') {
+        return i;
+    }
+    const char *close = memchr(w + i + 1, w[i], end - i - 1);
+    return close != NULL ? (size_t)(close - w) : i;
+}
+
+// Function to find the } that closes the { at open, or 0 if there is none
+static size_t closingBrace(const char *w, size_t open, size_t end) {
+    int depth = 0;
+    for (size_t i = open; i < end; i++) {
+        i = skipQuote(w, i, end);
+        if (w[i] == '\\' && i + 1 < end) {
+            i++;
+        } else if (w[i] == '{') {
+            depth++;
+        } else if (w[i] == '}' && --depth == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Function to parse one end of a range, a number or a single letter
+static bool rangeEnd(const char *s, size_t len, int64_t *value, bool *letter, int *width) {
+    if (len == 1 && isalpha((unsigned char)s[0])) {
+        *value = (unsigned char)s[0];
+        *letter = true;
+        *width = 0;
+        return true;
+    }
+    char text[32];
+    if (len == 0 || len >= sizeof(text)) {
+        return false;
+    }
+    memcpy(text, s, len);
+    text[len] = '\0';
+    char *stop;
+    errno = 0;
+    *value = strtoll(text, &stop, 10);
+    if (errno != 0 || *stop != '\0' || !isdigit((unsigned char)text[len - 1])) {
+        return false;
+    }
+    *letter = false;
+    const char *digits = text[0] == '-' || text[0] == '+' ? text + 1 : text;
+    *width = digits[0] == '0' && digits[1] != '\0' ? (int)len : 0; // {01..10} pads
+    return true;
+}
+
+// Function to parse {x..y} or {x..y..step}, -1 if it is not a range
+static int parseRange(struct brace_gen *g, size_t at, size_t end) {
+    const char *w = g->word;
+    const char *dots = strstr(w + at, "..");
+    if (dots == NULL || (size_t)(dots - w) >= end) {
+        return -1;
+    }
+    size_t toAt = dots - w + 2;
+    size_t toEnd = end;
+    const char *more = strstr(w + toAt, "..");
+    int64_t step = 1;
+    if (more != NULL && (size_t)(more - w) < end) {
+        toEnd = more - w;
+        int64_t value;
+        bool letter;
+        int width;
+        if (!rangeEnd(more + 2, end - (more - w) - 2, &value, &letter, &width) || letter) {
+            return -1;
+        }
+        step = value == INT64_MIN ? INT64_MAX : llabs(value);
+        step = step ? step : 1;
+    }
+
+    int64_t from, to;
+    bool fromLetter, toLetter;
+    int fromWidth, toWidth;
+    if (!rangeEnd(w + at, dots - w - at, &from, &fromLetter, &fromWidth) ||
+        !rangeEnd(w + toAt, toEnd - toAt, &to, &toLetter, &toWidth) || fromLetter != toLetter) {
+        return -1;
+    }
+    int node = addNode(g, BRACE_RANGE);
+    struct brace_node *n = &g->nodes[node];
+    n->from = from;
+    n->to = to;
+    n->step = from <= to ? step : -step;
+    n->at = from;
+    n->width = fromWidth > toWidth ? fromWidth : toWidth;
+    n->letters = fromLetter;
+    return node;
+}
+
+// Function to parse word[at, end) into a sequence node
+static int parseSequence(struct brace_gen *g, size_t at, size_t end, bool *expands) {
+    const char *w = g->word;
+    int seq = addNode(g, BRACE_SEQUENCE);
+    int first = -1, last = -1;
+    size_t literal = at;
+    size_t i = at;
+    while (i < end) {
+        if (w[i] == '\\' && i + 1 < end) {
+            i += 2;
+            continue;
+        }
+        if (skipQuote(w, i, end) != i) {
+            i = skipQuote(w, i, end) + 1; // no braces inside quotes
+            continue;
+        }
+        size_t close = 0;
+        if (w[i] != '{' || (i > at && w[i - 1] == '$') || (close = closingBrace(w, i, end)) == 0) {
+            i++; // ${name} is for the parameter expansion
+            continue;
+        }
+
+        // a list needs a comma outside of any inner braces
+        int depth = 0;
+        bool comma = false;
+        for (size_t j = i + 1; j < close && !comma; j++) {
+            j = skipQuote(w, j, close);
+            if (w[j] == '\\' && j + 1 < close) {
+                j++;
+            } else if (w[j] == '{') {
+                depth++;
+            } else if (w[j] == '}') {
+                depth--;
+            } else if (w[j] == ',' && depth == 0) {
+                comma = true;
+            }
+        }
+        int node = -1;
+        if (comma) {
+            node = addNode(g, BRACE_LIST);
+            int alternative = -1, lastAlternative = -1;
+            size_t from = i + 1;
+            depth = 0;
+            for (size_t j = i + 1; j <= close; j++) {
+                j = j < close ? skipQuote(w, j, close) : j;
+                if (w[j] == '\\' && j + 1 < close) {
+                    j++;
+                } else if (w[j] == '{') {
+                    depth++;
+                } else if (w[j] == '}' && j < close) {
+                    depth--;
+                } else if ((w[j] == ',' && depth == 0) || j == close) {
+                    alternative = parseSequence(g, from, j, expands);
+                    int firstAlternative = g->nodes[node].child;
+                    linkNode(g, &firstAlternative, &lastAlternative, alternative);
+                    g->nodes[node].child = firstAlternative;
+                    from = j + 1;
+                }
+            }
+        } else {
+            node = parseRange(g, i + 1, close);
+        }
+        if (node < 0) {
+            i++; // not a brace expression, the braces are plain characters
+            continue;
+        }
+
+        *expands = true;
+        if (i > literal) {
+            int text = addNode(g, BRACE_LITERAL);
+            g->nodes[text].start = literal;
+            g->nodes[text].len = i - literal;
+            linkNode(g, &first, &last, text);
+        }
+        linkNode(g, &first, &last, node);
+        i = literal = close + 1;
+    }
+    if (end > literal) {
+        int text = addNode(g, BRACE_LITERAL);
+        g->nodes[text].start = literal;
+        g->nodes[text].len = end - literal;
+        linkNode(g, &first, &last, text);
+    }
+    g->nodes[seq].child = first;
+    return seq;
+}
+
+bool brace_init(struct brace_gen *g, const char *word) {
+    memset(g, 0, sizeof(*g));
+    g->word = strdup(word);
+    bool expands = false;
+    parseSequence(g, 0, strlen(word), &expands); // node 0 is the whole word
+    return expands;
+}
+
+void brace_free(struct brace_gen *g) {
+    free(g->word);
+    free(g->nodes);
+    free(g->buf);
+    memset(g, 0, sizeof(*g));
+}
+
+static void resetNode(struct brace_gen *g, int node) {
+    struct brace_node *n = &g->nodes[node];
+    if (n->type == BRACE_SEQUENCE) {
+        for (int c = n->child; c >= 0; c = g->nodes[c].next) {
+            resetNode(g, c);
+        }
+    } else if (n->type == BRACE_LIST) {
+        n->cur = n->child;
+        resetNode(g, n->cur);
+    } else if (n->type == BRACE_RANGE) {
+        n->at = n->from;
+    }
+}
+
+static bool stepNode(struct brace_gen *g, int node);
+
+// Function to step the rightmost node of a sequence from node on that has not run out
+static bool stepFrom(struct brace_gen *g, int node) {
+    if (node < 0) {
+        return false;
+    }
+    return stepFrom(g, g->nodes[node].next) || stepNode(g, node);
+}
+
+// Function to step a node, false if it ran out and went back to its first value
+static bool stepNode(struct brace_gen *g, int node) {
+    struct brace_node *n = &g->nodes[node];
+    if (n->type == BRACE_SEQUENCE) {
+        return stepFrom(g, n->child);
+    }
+    if (n->type == BRACE_LIST) {
+        if (stepNode(g, n->cur)) {
+            return true;
+        }
+        int next = g->nodes[n->cur].next;
+        n->cur = next >= 0 ? next : n->child;
+        resetNode(g, n->cur);
+        return next >= 0;
+    }
+    if (n->type == BRACE_RANGE) {
+        int64_t next;
+        if (!__builtin_add_overflow(n->at, n->step, &next) &&
+            (n->step > 0 ? next <= n->to : next >= n->to)) {
+            n->at = next;
+            return true;
+        }
+        n->at = n->from;
+    }
+    return false;
+}
+
+static void append(struct brace_gen *g, const char *s, size_t len) {
+    if (g->bufLen + len + 1 > g->bufCapacity) {
+        g->bufCapacity = (g->bufLen + len + 1) * 2;
+        g->buf = realloc(g->buf, g->bufCapacity);
+        if (g->buf == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(g->buf + g->bufLen, s, len);
+    g->bufLen += len;
+    g->buf[g->bufLen] = '\0';
+}
+
+static void emitNode(struct brace_gen *g, int node) {
+    struct brace_node *n = &g->nodes[node];
+    if (n->type == BRACE_LITERAL) {
+        append(g, g->word + n->start, n->len);
+    } else if (n->type == BRACE_SEQUENCE) {
+        for (int c = n->child; c >= 0; c = g->nodes[c].next) {
+            emitNode(g, c);
+        }
+    } else if (n->type == BRACE_LIST) {
+        emitNode(g, n->cur);
+    } else if (n->letters) {
+        char c = (char)n->at;
+        append(g, &c, 1);
+    } else {
+        char number[32];
+        int len = snprintf(number, sizeof(number), "%0*lld", n->width, (long long)n->at);
+        append(g, number, (size_t)len);
+    }
+}
+
+const char *brace_next(struct brace_gen *g, size_t *len) {
+    while (!g->done) {
+        if (!g->started) {
+            resetNode(g, 0);
+            g->started = true;
+        } else if (!stepNode(g, 0)) {
+            g->done = true;
+            break;
+        }
+        g->bufLen = 0;
+        append(g, "", 0);
+        emitNode(g, 0);
+        if (g->bufLen > 0) {
+            *len = g->bufLen;
+            return g->buf;
+        }
+    }
+    return NULL;
+}
+
+/*
+Brace expansion end-----------------------------------------
+*/
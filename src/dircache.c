@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/readline.h>
+#include "lab.h"
+
+/*
+Directory cache -----------------------------------------
+The last few directories listed, read with getdents64 into one buffer and
+sorted by name so a prefix is a binary search. A listing is used again as
+long as the directory has the same device, inode and mtime, otherwise it is
+read again. Names are kept in one arena with the d_type byte in front of
+each name.
+*/
+
+#define DIR_CACHE_SIZE 8
+#define DIR_READ_BUFFER (256 * 1024)
+
+static struct dir_listing dirCache[DIR_CACHE_SIZE];
+static unsigned long dirStamp = 0;
+
+// filename completion state, between calls of the readline generator
+static const struct dir_listing *completionDir = NULL;
+static char *completionPath = NULL; // directory being completed, as typed
+static char *completionOpen = NULL; // the same with ~ expanded
+static size_t completionAt = 0;
+static size_t completionEnd = 0;
+static bool completionHidden = false;
+
+static void freeListing(struct dir_listing *d) {
+    free(d->path);
+    free(d->names);
+    free(d->order);
+    memset(d, 0, sizeof(*d));
+}
+
+void dir_cache_free() {
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        freeListing(&dirCache[i]);
+    }
+    free(completionPath);
+    free(completionOpen);
+    completionPath = NULL;
+    completionOpen = NULL;
+    completionDir = NULL;
+}
+
+static int compareNames(const void *a, const void *b, void *names) {
+    return strcmp((char *)names + *(const uint32_t *)a, (char *)names + *(const uint32_t *)b);
+}
+
+static void addName(struct dir_listing *d, size_t *capacity, size_t *orderCapacity,
+                    const char *name, unsigned char type) {
+    size_t len = strlen(name);
+    if (d->namesSize + len + 2 > *capacity) {
+        *capacity = (d->namesSize + len + 2) * 2;
+        d->names = realloc(d->names, *capacity);
+    }
+    if (d->count == *orderCapacity) {
+        *orderCapacity = *orderCapacity ? *orderCapacity * 2 : 256;
+        d->order = realloc(d->order, *orderCapacity * sizeof(uint32_t));
+    }
+    d->names[d->namesSize++] = (char)type;
+    d->order[d->count++] = (uint32_t)d->namesSize;
+    memcpy(d->names + d->namesSize, name, len + 1);
+    d->namesSize += len + 1;
+}
+
+// Function to read a whole directory into d, false if it cannot be opened
+static bool readListing(struct dir_listing *d, const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char *buf = malloc(DIR_READ_BUFFER);
+    size_t capacity = 0;
+    size_t orderCapacity = 0;
+    ssize_t n;
+    while ((n = getdents64(fd, buf, DIR_READ_BUFFER)) > 0) {
+        for (ssize_t at = 0; at < n;) {
+            struct dirent64 *entry = (struct dirent64 *)(buf + at);
+            at += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            addName(d, &capacity, &orderCapacity, name, entry->d_type);
+        }
+    }
+    free(buf);
+    close(fd);
+    qsort_r(d->order, d->count, sizeof(uint32_t), compareNames, d->names);
+    return true;
+}
+
+const struct dir_listing *dir_list(const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    struct dir_listing *slot = &dirCache[0];
+    for (int i = 0; i < DIR_CACHE_SIZE; i++) {
+        struct dir_listing *d = &dirCache[i];
+        if (d->path != NULL && strcmp(d->path, path) == 0) {
+            slot = d;
+            break;
+        }
+        if (d->used < slot->used) {
+            slot = d; // least recently used
+        }
+    }
+
+    if (slot->path != NULL && strcmp(slot->path, path) == 0 && slot->dev == st.st_dev &&
+        slot->ino == st.st_ino && slot->mtime.tv_sec == st.st_mtim.tv_sec &&
+        slot->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        slot->used = ++dirStamp;
+        return slot;
+    }
+
+    freeListing(slot);
+    if (!readListing(slot, path)) {
+        freeListing(slot);
+        return NULL;
+    }
+    slot->path = strdup(path);
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->mtime = st.st_mtim; // from before the read, a change during it reads again next time
+    slot->used = ++dirStamp;
+    return slot;
+}
+
+size_t dir_prefix(const struct dir_listing *d, const char *prefix, size_t len, size_t *first) {
+    // first name >= prefix
+    size_t lo = 0, hi = d->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(dir_name(d, mid), prefix, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+    // first name past the ones starting with prefix
+    hi = d->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(dir_name(d, mid), prefix, len) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - *first;
+}
+
+const char *dir_name(const struct dir_listing *d, size_t i) {
+    return d->names + d->order[i];
+}
+
+unsigned char dir_type(const struct dir_listing *d, size_t i) {
+    return (unsigned char)d->names[d->order[i] - 1];
+}
+
+/*
+Filename completion -----------------------------------------
+*/
+
+static bool isDirectory(size_t i) {
+    unsigned char type = dir_type(completionDir, i);
+    if (type != DT_LNK && type != DT_UNKNOWN) {
+        return type == DT_DIR;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", completionOpen, dir_name(completionDir, i));
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static char *completeName(const char *text, int state, bool dirsOnly) {
+    if (state == 0) {
+        free(completionPath);
+        free(completionOpen);
+        const char *slash = strrchr(text, '/');
+        const char *base = slash ? slash + 1 : text;
+        completionPath = strndup(text, base - text);
+
+        const char *home = getenv("HOME");
+        if (text[0] == '~' && text[1] == '/' && home != NULL) {
+            completionOpen = malloc(strlen(home) + strlen(completionPath));
+            sprintf(completionOpen, "%s%s", home, completionPath + 1);
+        } else {
+            completionOpen = strdup(completionPath);
+        }
+
+        completionDir = dir_list(completionOpen[0] ? completionOpen : ".");
+        completionAt = completionEnd = 0;
+        if (completionDir != NULL) {
+            completionEnd = dir_prefix(completionDir, base, strlen(base), &completionAt);
+            completionEnd += completionAt;
+        }
+        completionHidden = base[0] == '.';
+    }
+
+    while (completionAt < completionEnd) {
+        size_t i = completionAt++;
+        const char *name = dir_name(completionDir, i);
+        if ((name[0] == '.' && !completionHidden) || (dirsOnly && !isDirectory(i))) {
+            continue;
+        }
+        char *match = malloc(strlen(completionPath) + strlen(name) + 1);
+        sprintf(match, "%s%s", completionPath, name);
+        return match;
+    }
+    return NULL;
+}
+
+char *dir_file_generator(const char *text, int state) {
+    return completeName(text, state, false);
+}
+
+char *dir_dir_generator(const char *text, int state) {
+    return completeName(text, state, true);
+}
+
+/*
+Directory cache end-----------------------------------------
+*/
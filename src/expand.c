@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+Word expansion -----------------------------------------
+Each word of a command is expanded on its own: braces first, then $name,
+${...}, $(cmd), $((expr)) and backquotes, then what was not quoted is split
+on IFS and globbed, and the quotes are removed. Every finished word goes
+straight into the arena of a glob result that becomes argv. "${name[@]}"
+adds one word for each element of the array as it is walked, so an element
+with a blank in it stays one word and the elements are never joined into a
+string and split again.
+*/
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Out;
+
+typedef struct {
+    struct glob_result *r;
+    Out word; // the word with the quotes removed
+    Out pattern; // the same with the quoted glob characters escaped
+    bool magic; // an unquoted glob character, it is globbed
+    bool quoted; // kept even if it comes out empty
+    bool split; // false for the value of an assignment
+    const char *ifs;
+} Fields;
+
+typedef struct {
+    Fields *f;
+    bool quoted;
+    bool first;
+    const char *sep; // put between elements when they are joined
+    size_t sepLen;
+} Elements;
+
+static void outAppend(Out *o, const char *s, size_t n) {
+    if (o->len + n + 1 > o->cap) {
+        o->cap = (o->len + n + 1) * 2;
+        o->buf = realloc(o->buf, o->cap);
+        if (o->buf == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+    o->buf[o->len] = '\0';
+}
+
+static void addLiteral(Fields *f, const char *s, size_t n, bool quoted) {
+    outAppend(&f->word, s, n);
+    for (size_t i = 0; i < n; i++) {
+        bool special = strchr("*?[]\\", s[i]) != NULL;
+        if (quoted && special) {
+            outAppend(&f->pattern, "\\", 1);
+        } else if (special && s[i] != ']' && s[i] != '\\') {
+            f->magic = true;
+        }
+        outAppend(&f->pattern, s + i, 1);
+    }
+}
+
+// Function to finish the current word and start the next one
+static void endField(Fields *f) {
+    if (f->word.len > 0 || f->quoted) {
+        // a lone [ like the test command is not a pattern
+        bool pattern = f->magic && f->split && glob_has_magic(f->pattern.buf);
+        if (!pattern || glob_run(f->pattern.buf, f->r) == 0) {
+            glob_result_add(f->r, f->word.buf ? f->word.buf : "", f->word.len, "", 0, false);
+        }
+    }
+    f->word.len = 0;
+    f->pattern.len = 0;
+    f->magic = false;
+    f->quoted = false;
+}
+
+// Function to add the result of an expansion, split on IFS if it was not quoted
+static void addExpansion(Fields *f, const char *value, bool quoted) {
+    if (quoted || !f->split) {
+        addLiteral(f, value, strlen(value), true);
+        return;
+    }
+    for (const char *p = value; *p != '\0';) {
+        size_t n = strcspn(p, f->ifs);
+        addLiteral(f, p, n, false);
+        p += n;
+        if (*p != '\0') {
+            endField(f);
+            p++;
+        }
+    }
+}
+
+static void addElement(const char *value, void *ctx) {
+    Elements *e = ctx;
+    if (!e->first) {
+        if (!e->f->split) {
+            addLiteral(e->f, e->sep, e->sepLen, true); // an assignment gets them joined
+        } else {
+            e->f->quoted = e->f->quoted || e->quoted;
+            endField(e->f);
+        }
+    }
+    e->first = false;
+    addExpansion(e->f, value, e->quoted);
+    e->f->quoted = e->f->quoted || e->quoted;
+}
+
+// Function to check for $@, $*, ${@} or ${*} from p to end, the @ or * or 0
+static char argsAll(const char *p, const char *end) {
+    bool braced = p[1] == '{';
+    const char *c = p + 1 + braced;
+    if ((*c != '@' && *c != '*') || c + 1 + braced != end || (braced && c[1] != '}')) {
+        return 0;
+    }
+    return *c;
+}
+
+// Function to check for ${name[@]} or ${name[*]} from p to end, the @ or *
+// or 0 if it is not one of them
+static char arrayAll(const char *p, const char *end) {
+    if (argsAll(p, end) != 0) {
+        return argsAll(p, end);
+    }
+    size_t nameLen = p[1] == '{' ? var_name_length(p + 2) : 0;
+    const char *sub = p + 2 + nameLen;
+    if (nameLen == 0 || sub[0] != '[' || (sub[1] != '@' && sub[1] != '*') || sub[2] != ']' ||
+        sub + 4 != end) {
+        return 0;
+    }
+    return sub[1];
+}
+
+// Function to call fn with each element of the array name, or each
+// positional parameter when name is NULL
+static void eachValue(const char *name, void (*fn)(const char *value, void *ctx), void *ctx) {
+    if (name == NULL) {
+        script_each_arg(fn, ctx);
+    } else {
+        var_each(name, fn, ctx);
+    }
+}
+
+// Function for ${name[@]}, ${name[*]}, $@ and $* at p, 0 if p is not one of them
+static int expandArray(Fields *f, const char *p, const char *end, bool quoted) {
+    char all = arrayAll(p, end);
+    if (all == 0) {
+        return 0;
+    }
+    char *name = argsAll(p, end) != 0 ? NULL : strndup(p + 2, var_name_length(p + 2));
+    if (all == '@' || !quoted) {
+        Elements e = {f, quoted, true, " ", 1};
+        eachValue(name, addElement, &e);
+    } else {
+        // "${name[*]}" is one word, joined with the first character of IFS
+        // or with nothing when IFS is empty
+        Fields joined = {NULL, {NULL, 0, 0}, {NULL, 0, 0}, false, false, false, f->ifs};
+        Elements e = {&joined, true, true, f->ifs, f->ifs[0] != '\0'};
+        eachValue(name, addElement, &e);
+        addLiteral(f, joined.word.buf ? joined.word.buf : "", joined.word.len, true);
+        free(joined.word.buf);
+        free(joined.pattern.buf);
+    }
+    free(name);
+    return 1;
+}
+
+// Function to find the end of the $ or ` expansion at p, p itself for a $
+// on its own
+static const char *dollarEnd(const char *p) {
+    if (p[0] == '`' || p[1] == '(' || p[1] == '{') {
+        return cmd_skip(p);
+    }
+    if (p[1] != '\0' && strchr("?#@*0123456789", p[1]) != NULL) {
+        return p + 2; // $? $# $@ $* and $1, $10 is $1 and then 0
+    }
+    return p + 1 + var_name_length(p + 1);
+}
+
+// Function to expand the $ or ` at p, setting next past it
+static int expandDollar(Fields *f, const char *p, bool quoted, const char **next) {
+    const char *end = dollarEnd(p);
+    if (end == p + 1) {
+        addLiteral(f, p, 1, quoted); // a $ on its own
+        *next = p + 1;
+        return 0;
+    }
+    *next = end;
+    if (expandArray(f, p, end, quoted)) {
+        return 0;
+    }
+    char *text = strndup(p, end - p);
+    char *value;
+    int result = cmd_substitute(text, &value);
+    if (result > 0) {
+        addExpansion(f, value, quoted);
+        free(value);
+    } else if (result == 0) {
+        addLiteral(f, text, strlen(text), quoted);
+    }
+    free(text);
+    return result < 0 ? -1 : 0;
+}
+
+// Function to expand the inside of a double quoted string, p is past the "
+static int expandQuoted(Fields *f, const char *p, const char **next) {
+    bool onlyArrays = true; // "${a[@]}" of an empty array is no word at all
+    while (*p != '\0' && *p != '"') {
+        if (*p == '\\' && p[1] != '\0') {
+            if (strchr("$`\"\\", p[1]) != NULL) {
+                addLiteral(f, p + 1, 1, true);
+            } else if (p[1] != '\n') {
+                addLiteral(f, p, 2, true);
+            }
+            p += 2;
+            onlyArrays = false;
+        } else if (*p == '$' || *p == '`') {
+            if (arrayAll(p, dollarEnd(p)) != '@') {
+                onlyArrays = false;
+            }
+            if (expandDollar(f, p, true, &p) < 0) {
+                return -1;
+            }
+        } else {
+            addLiteral(f, p, 1, true);
+            p++;
+            onlyArrays = false;
+        }
+    }
+    if (!onlyArrays) {
+        f->quoted = true;
+    }
+    *next = *p == '"' ? p + 1 : p;
+    return 0;
+}
+
+// Function to expand one word into f, without ending the last field
+static int expandText(Fields *f, const char *p) {
+    while (*p != '\0') {
+        if (*p == '\\') {
+            if (p[1] != '\0') {
+                addLiteral(f, p + 1, 1, true);
+            }
+            p += p[1] != '\0' ? 2 : 1;
+        } else if (*p == '\'') {
+            const char *end = cmd_skip(p);
+            size_t n = end - p - 1 - (end[-1] == '\'' && end - p > 1);
+            addLiteral(f, p + 1, n, true);
+            f->quoted = true;
+            p = end;
+        } else if (*p == '"') {
+            if (expandQuoted(f, p + 1, &p) < 0) {
+                return -1;
+            }
+        } else if (*p == '$' || *p == '`') {
+            if (expandDollar(f, p, false, &p) < 0) {
+                return -1;
+            }
+        } else {
+            addLiteral(f, p, 1, false);
+            p++;
+        }
+    }
+    return 0;
+}
+
+static void initFields(Fields *f, struct glob_result *r, bool split) {
+    memset(f, 0, sizeof(*f));
+    f->r = r;
+    f->split = split;
+    f->ifs = var_get("IFS");
+    if (f->ifs == NULL) {
+        f->ifs = " \t\n";
+    }
+    outAppend(&f->word, "", 0);
+    outAppend(&f->pattern, "", 0);
+}
+
+char **sh_expand(char **words) {
+    struct glob_result r = {0};
+    Fields f;
+    initFields(&f, &r, true);
+    size_t argMax = (size_t)sysconf(_SC_ARG_MAX);
+    bool failed = false;
+    bool tooLong = false; // kept apart from failed so the message is always printed
+    for (int i = 0; words[i] != NULL && !failed; i++) {
+        struct brace_gen braces = {0};
+        if (strchr(words[i], '{') == NULL || !brace_init(&braces, words[i])) { // most words have no braces
+            failed = expandText(&f, words[i]) < 0;
+            endField(&f);
+        } else {
+            const char *word;
+            size_t len;
+            while (!failed && !tooLong && (word = brace_next(&braces, &len)) != NULL) {
+                char *copy = strndup(word, len); // the next word reuses the buffer
+                failed = expandText(&f, copy) < 0;
+                free(copy);
+                endField(&f);
+                tooLong = r.size + (r.count + 1) * sizeof(char *) > argMax; // a huge range stops here
+            }
+        }
+        brace_free(&braces);
+        tooLong = tooLong || (!failed && r.size + (r.count + 1) * sizeof(char *) > argMax);
+        if (tooLong) {
+            fprintf(stderr, "%s: argument list too long\n", words[0]);
+            failed = true;
+        }
+    }
+    free(f.word.buf);
+    free(f.pattern.buf);
+    if (failed) {
+        glob_result_free(&r);
+        return NULL;
+    }
+    return glob_result_pack(&r);
+}
+
+// Function to expand a word to one string, or to a glob pattern in which
+// the quoted characters are escaped
+static char *expandValue(const char *text, size_t len, bool pattern) {
+    Fields f;
+    initFields(&f, NULL, false);
+    char *copy = strndup(text, len);
+    int result = expandText(&f, copy);
+    free(copy);
+    char *keep = pattern ? f.pattern.buf : f.word.buf;
+    free(pattern ? f.word.buf : f.pattern.buf);
+    if (result < 0) {
+        free(keep);
+        return NULL;
+    }
+    return keep;
+}
+
+char *sh_expand_word(const char *word, bool pattern) {
+    return expandValue(word, strlen(word), pattern);
+}
+
+// Function for name=(a b [key]=c), the elements are words like a command's
+static bool assignList(const char *name, const char *list, size_t len, bool append) {
+    char *text = strndup(list, len);
+    char **items = cmd_parse(text);
+    free(text);
+    if (!append) {
+        var_clear_array(name);
+    }
+    bool ok = true;
+    for (int i = 0; items[i] != NULL && ok; i++) {
+        const char *close = items[i][0] == '[' ? strchr(items[i], ']') : NULL;
+        if (close != NULL && close[1] == '=') {
+            char *key = expandValue(items[i] + 1, close - items[i] - 1, false);
+            char *value = expandValue(close + 2, strlen(close + 2), false);
+            ok = key != NULL && value != NULL && var_set_element(name, key, value);
+            free(key);
+            free(value);
+            continue;
+        }
+        if (var_is_assoc(name)) {
+            fprintf(stderr, "%s: %s: must use subscript when assigning associative array\n", name, items[i]);
+            continue;
+        }
+        char *one[] = {items[i], NULL};
+        char **fields = sh_expand(one);
+        ok = fields != NULL;
+        for (int j = 0; ok && fields[j] != NULL; j++) {
+            var_append(name, fields[j]);
+        }
+        free(fields);
+    }
+    cmd_free(items);
+    return ok;
+}
+
+// Function for one name=value, name+=value, name[sub]=value or name=(...)
+static bool assignWord(const char *word) {
+    size_t nameLen = var_name_length(word);
+    char *name = strndup(word, nameLen);
+    const char *p = word + nameLen;
+    char *key = NULL;
+    bool ok = true;
+    if (*p == '[') {
+        const char *close = strchr(p, ']');
+        key = expandValue(p + 1, close - p - 1, false);
+        ok = key != NULL;
+        p = close + 1;
+    }
+    bool append = *p == '+';
+    p += append ? 2 : 1;
+    size_t len = strlen(p);
+    if (ok && key == NULL && p[0] == '(' && len > 1 && p[len - 1] == ')') {
+        ok = assignList(name, p + 1, len - 2, append);
+    } else if (ok) {
+        char *value = expandValue(p, len, false);
+        const char *old = !append ? NULL : key != NULL ? var_get_element(name, key) : var_get(name);
+        if (value != NULL && old != NULL) {
+            char *joined = malloc(strlen(old) + strlen(value) + 1);
+            strcpy(joined, old);
+            strcat(joined, value);
+            free(value);
+            value = joined;
+        }
+        if (value == NULL) {
+            ok = false;
+        } else if (key != NULL) {
+            ok = var_set_element(name, key, value);
+        } else {
+            var_set(name, value);
+        }
+        free(value);
+    }
+    free(key);
+    free(name);
+    return ok;
+}
+
+int sh_assign(char **words) {
+    if (words[0] == NULL) {
+        return -1;
+    }
+    for (int i = 0; words[i] != NULL; i++) {
+        if (!var_assignment(words[i])) {
+            return -1;
+        }
+    }
+    for (int i = 0; words[i] != NULL; i++) {
+        if (!assignWord(words[i])) {
+            return 1; // like bash, the ones after a bad one are not done
+        }
+    }
+    return 0;
+}
+
+/*
+Word expansion end-----------------------------------------
+*/
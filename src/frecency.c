@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <readline/readline.h>
+#include "lab.h"
+
+/*
+Frecency -----------------------------------------
+Every distinct command gets a frequency x recency score. A use at time t is
+worth exp(t / tau) and the score is the log of the sum over all uses, so an
+old score never has to be decayed: a newer use is simply worth more. Scores
+only go up, which lets the trie keep the best command of every subtree in
+the node itself, and the suggestion for a prefix is one walk down the trie.
+
+The history file is indexed in chunks from the prompt's idle hook, so a big
+history does not hold up startup, and new lines are added as they are run.
+*/
+
+#define FRECENCY_TAU (3.0 * 24 * 3600 / M_LN2) // a use loses half its weight in 3 days
+#define FRECENCY_EPOCH 1600000000.0 // keeps exponents small
+
+typedef struct {
+    char *text;
+    double score; // log of the sum of exp(t / tau)
+} Command;
+
+static struct trie commandTrie;
+static bool trieReady = false;
+static Command *commands = NULL;
+static int commandCount = 0;
+static int commandCapacity = 0;
+static size_t historyIndexed = 0; // history entries already scored
+
+static bool higherScore(int a, int b, void *ctx) {
+    UNUSED(ctx);
+    return commands[a].score > commands[b].score;
+}
+
+// log(exp(a) + exp(b)) without overflowing
+static double logAdd(double a, double b) {
+    if (a < b) {
+        double t = a;
+        a = b;
+        b = t;
+    }
+    return a + log1p(exp(b - a));
+}
+
+void frecency_add(const char *line, size_t len, int64_t when) {
+    if (!trieReady) {
+        trie_init(&commandTrie);
+        trieReady = true;
+    }
+
+    double weight = ((double)when - FRECENCY_EPOCH) / FRECENCY_TAU;
+    int node = trie_find(&commandTrie, line, len);
+    int id = node >= 0 ? commandTrie.nodes[node].value : -1;
+
+    if (id < 0) {
+        if (commandCount == commandCapacity) {
+            commandCapacity = commandCapacity ? commandCapacity * 2 : 1024;
+            commands = realloc(commands, commandCapacity * sizeof(Command));
+        }
+        id = commandCount++;
+        commands[id].text = strndup(line, len);
+        commands[id].score = weight;
+    } else {
+        commands[id].score = logAdd(commands[id].score, weight);
+    }
+    trie_insert(&commandTrie, line, len, id, higherScore, NULL);
+}
+
+size_t frecency_update(size_t max) {
+    size_t count = hist_count();
+    size_t done = 0;
+    while (historyIndexed < count && done < max) {
+        size_t len;
+        const char *line = hist_get(historyIndexed, &len);
+        if (line != NULL) {
+            frecency_add(line, len, hist_time(historyIndexed));
+        }
+        historyIndexed++;
+        done++;
+    }
+    return done;
+}
+
+const char *frecency_suggest(const char *prefix, size_t len) {
+    if (!trieReady || len == 0) {
+        return NULL;
+    }
+    int node = trie_find(&commandTrie, prefix, len);
+    if (node < 0 || commandTrie.nodes[node].best < 0) {
+        return NULL;
+    }
+    const char *best = commands[commandTrie.nodes[node].best].text;
+    return strlen(best) > len ? best : NULL;
+}
+
+void frecency_free() {
+    for (int i = 0; i < commandCount; i++) {
+        free(commands[i].text);
+    }
+    free(commands);
+    if (trieReady) {
+        trie_free(&commandTrie);
+    }
+    commands = NULL;
+    commandCount = 0;
+    commandCapacity = 0;
+    historyIndexed = 0;
+    trieReady = false;
+}
+
+/*
+Inline suggestions -----------------------------------------
+After readline draws the line the rest of the best command is drawn in grey
+after the cursor and the cursor is moved back. Right arrow, End or Ctrl-F at
+the end of the line accept it.
+*/
+
+static const char *shownSuggestion = NULL;
+
+static const char *currentSuggestion() {
+    if (rl_point != rl_end || rl_end == 0) {
+        return NULL;
+    }
+    return frecency_suggest(rl_line_buffer, rl_end);
+}
+
+static void suggestRedisplay() {
+    rl_redisplay();
+
+    const char *best = currentSuggestion();
+    if (best != NULL) {
+        const char *rest = best + rl_end;
+        fprintf(rl_outstream, "\033[90m%s\033[0m\033[K\033[%zuD", rest, strlen(rest));
+    } else if (shownSuggestion != NULL) {
+        fprintf(rl_outstream, "\033[K"); // wipe the old suggestion
+    }
+    shownSuggestion = best;
+    fflush(rl_outstream);
+}
+
+static int acceptSuggestion(int count, int key) {
+    const char *best = currentSuggestion();
+    if (best == NULL) {
+        return key == 'F' - '@' || key == 'C' ? rl_forward_char(count, key) : rl_end_of_line(count, key);
+    }
+    rl_insert_text(best + rl_end);
+    return 0;
+}
+
+static int acceptLine(int count, int key) {
+    if (shownSuggestion != NULL) {
+        // the suggestion is not part of the line, do not leave it on screen
+        fprintf(rl_outstream, "\033[K");
+        fflush(rl_outstream);
+        shownSuggestion = NULL;
+    }
+    return rl_newline(count, key);
+}
+
+void frecency_install() {
+    rl_redisplay_function = suggestRedisplay;
+    rl_bind_keyseq("\\e[C", acceptSuggestion); // right arrow
+    rl_bind_keyseq("\\eOC", acceptSuggestion);
+    rl_bind_keyseq("\\e[F", acceptSuggestion); // end
+    rl_bind_keyseq("\\eOF", acceptSuggestion);
+    rl_bind_keyseq("\\C-f", acceptSuggestion);
+    rl_bind_keyseq("\\C-m", acceptLine);
+    rl_bind_keyseq("\\C-j", acceptLine);
+}
+
+/*
+Frecency end-----------------------------------------
+*/
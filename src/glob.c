@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+Glob matcher -----------------------------------------
+A pattern is compiled once into a list of ops: a run of literal bytes, ?,
+a [...] class as a 256 bit set, or *. Matching walks the ops and on a
+mismatch only goes back to the last * (every other op has a fixed width, so
+that is enough), which keeps it linear for the usual patterns. Before that
+the length, the literal prefix and the literal suffix are checked, which is
+all it takes to reject most names for *.log or core.*.
+*/
+
+enum { GLOB_LITERAL, GLOB_ANY, GLOB_CLASS, GLOB_STAR };
+
+static void addOp(struct glob_matcher *m, uint8_t type, uint32_t arg, uint32_t len) {
+    if (m->opCount == m->opCapacity) {
+        m->opCapacity = m->opCapacity ? m->opCapacity * 2 : 8;
+        m->ops = realloc(m->ops, m->opCapacity * sizeof(struct glob_op));
+    }
+    m->ops[m->opCount].type = type;
+    m->ops[m->opCount].arg = arg;
+    m->ops[m->opCount].len = len;
+    m->opCount++;
+}
+
+static void addLiteral(struct glob_matcher *m, char c) {
+    struct glob_op *last = m->opCount ? &m->ops[m->opCount - 1] : NULL;
+    if (last == NULL || last->type != GLOB_LITERAL || last->arg + last->len != m->literalSize) {
+        addOp(m, GLOB_LITERAL, (uint32_t)m->literalSize, 0);
+        last = &m->ops[m->opCount - 1];
+    }
+    m->literals[m->literalSize++] = c;
+    last->len++;
+}
+
+static bool namedClass(const char *name, size_t len, int c) {
+    static const struct {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+        {"lower", islower}, {"space", isspace}, {"punct", ispunct}, {"xdigit", isxdigit},
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0) {
+            return classes[i].test(c) != 0;
+        }
+    }
+    return false;
+}
+
+// Function to compile [...] starting at pat[i] == '[', returns the index
+// after the ], or 0 if the class is not closed and [ is a plain character
+static size_t compileClass(struct glob_matcher *m, const char *pat, size_t len, size_t i) {
+    uint8_t set[32] = {0};
+    size_t j = i + 1;
+    bool negate = j < len && (pat[j] == '!' || pat[j] == '^');
+    if (negate) {
+        j++;
+    }
+    bool first = true;
+    while (j < len && (pat[j] != ']' || first)) {
+        first = false;
+        if (pat[j] == '[' && j + 1 < len && pat[j + 1] == ':') {
+            const char *end = memmem(pat + j + 2, len - j - 2, ":]", 2);
+            if (end != NULL) {
+                for (int c = 0; c < 256; c++) {
+                    if (namedClass(pat + j + 2, end - (pat + j + 2), c)) {
+                        set[c >> 3] |= 1 << (c & 7);
+                    }
+                }
+                j = end + 2 - pat;
+                continue;
+            }
+        }
+        unsigned char lo = (unsigned char)pat[j];
+        if (lo == '\\' && j + 1 < len) {
+            lo = (unsigned char)pat[++j];
+        }
+        unsigned char hi = lo;
+        if (j + 2 < len && pat[j + 1] == '-' && pat[j + 2] != ']') {
+            hi = (unsigned char)pat[j + 2];
+            j += 2;
+        }
+        for (int c = lo; c <= hi; c++) {
+            set[c >> 3] |= 1 << (c & 7);
+        }
+        j++;
+    }
+    if (j >= len) {
+        return 0;
+    }
+    if (negate) {
+        for (int k = 0; k < 32; k++) {
+            set[k] = ~set[k];
+        }
+    }
+    m->classes = realloc(m->classes, (m->classCount + 1) * sizeof(m->classes[0]));
+    memcpy(m->classes[m->classCount], set, sizeof(set));
+    addOp(m, GLOB_CLASS, (uint32_t)m->classCount++, 1);
+    return j + 1;
+}
+
+void glob_compile(struct glob_matcher *m, const char *pat, size_t len) {
+    memset(m, 0, sizeof(*m));
+    m->literals = malloc(len + 1);
+
+    size_t next;
+    for (size_t i = 0; i < len;) {
+        char c = pat[i];
+        if (c == '*') {
+            if (m->opCount == 0 || m->ops[m->opCount - 1].type != GLOB_STAR) {
+                addOp(m, GLOB_STAR, 0, 0); // ** inside a word is just *
+            }
+            i++;
+        } else if (c == '?') {
+            addOp(m, GLOB_ANY, 0, 1);
+            i++;
+        } else if (c == '[' && (next = compileClass(m, pat, len, i)) != 0) {
+            i = next;
+        } else {
+            if (c == '\\' && i + 1 < len) {
+                c = pat[++i];
+            }
+            addLiteral(m, c);
+            i++;
+        }
+    }
+
+    // the fast path checks
+    bool star = false;
+    for (size_t k = 0; k < m->opCount; k++) {
+        star |= m->ops[k].type == GLOB_STAR;
+        m->minLength += m->ops[k].len;
+    }
+    m->hasStar = star;
+    if (m->opCount > 0 && m->ops[0].type == GLOB_LITERAL) {
+        m->prefixLength = m->ops[0].len;
+    }
+    if (star && m->ops[m->opCount - 1].type == GLOB_LITERAL) {
+        m->suffixOp = (int)m->opCount - 1;
+    } else {
+        m->suffixOp = -1;
+    }
+}
+
+void glob_matcher_free(struct glob_matcher *m) {
+    free(m->ops);
+    free(m->literals);
+    free(m->classes);
+    memset(m, 0, sizeof(*m));
+}
+
+bool glob_match(const struct glob_matcher *m, const char *s, size_t len) {
+    if (len < m->minLength || (!m->hasStar && len != m->minLength)) {
+        return false;
+    }
+    if (m->prefixLength > 0 && memcmp(s, m->literals + m->ops[0].arg, m->prefixLength) != 0) {
+        return false;
+    }
+    if (m->suffixOp >= 0) {
+        const struct glob_op *op = &m->ops[m->suffixOp];
+        if (memcmp(s + len - op->len, m->literals + op->arg, op->len) != 0) {
+            return false;
+        }
+    }
+
+    size_t oi = 0, si = 0;
+    size_t starOp = SIZE_MAX, starSi = 0;
+    while (oi < m->opCount || si < len) {
+        if (oi < m->opCount) {
+            const struct glob_op *op = &m->ops[oi];
+            bool ok = false;
+            switch (op->type) {
+            case GLOB_STAR:
+                starOp = oi++;
+                starSi = si;
+                continue;
+            case GLOB_LITERAL:
+                ok = len - si >= op->len && memcmp(s + si, m->literals + op->arg, op->len) == 0;
+                break;
+            case GLOB_ANY:
+                ok = si < len;
+                break;
+            case GLOB_CLASS:
+                if (si < len) {
+                    unsigned char c = (unsigned char)s[si];
+                    ok = m->classes[op->arg][c >> 3] & (1 << (c & 7));
+                }
+                break;
+            }
+            if (ok) {
+                si += op->len;
+                oi++;
+                continue;
+            }
+        }
+        // mismatch, let the last * take one more character
+        if (starOp == SIZE_MAX || starSi >= len) {
+            return false;
+        }
+        si = ++starSi;
+        oi = starOp + 1;
+    }
+    return true;
+}
+
+bool glob_has_magic(const char *word) {
+    for (const char *p = word; *p; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '*' || *p == '?') {
+            return true;
+        } else if (*p == '[' && strchr(p + 1, ']') != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Glob expansion -----------------------------------------
+The pattern is split at / into segments: a plain name, a pattern, or **.
+The walk keeps the set of segments that can apply to the directory it is
+in, like the states of an NFA over path components, so one read of a
+directory serves ** and the segment after it at the same time. The
+directory walker sorts each directory's matches and subdirectories together,
+which leaves the whole result sorted without sorting it at the end.
+
+A pattern with ** runs on the walker's thread pool, reads directories with
+getdents64 and does not follow symlinks under **. Any other pattern is
+walked on this thread through the directory cache, whose listings are
+already sorted and which a plain name prefix can binary search.
+*/
+
+#define GLOB_MAX_SEGMENTS 64
+
+enum { SEG_NAME, SEG_PATTERN, SEG_GLOBSTAR };
+
+typedef struct {
+    int kind;
+    char *name; // SEG_NAME without the backslashes
+    struct glob_matcher m;
+    bool dotOk; // pattern starts with . so it may match hidden names
+} Segment;
+
+typedef struct {
+    Segment segs[GLOB_MAX_SEGMENTS];
+    int segCount;
+    bool dirsOnly; // pattern ended in /
+    bool absolute;
+    bool globstar; // has a ** segment, walked in parallel
+} Glob;
+
+// one directory being read
+typedef struct {
+    Glob *g;
+    struct walk_dir *dir;
+    int fd;
+    uint64_t states;
+} Visit;
+
+void glob_result_add(struct glob_result *r, const char *a, size_t alen, const char *b, size_t blen,
+                     bool slash) {
+    if (r->size + alen + blen + 2 > r->capacity) {
+        r->capacity = (r->size + alen + blen + 2) * 2;
+        r->arena = realloc(r->arena, r->capacity);
+    }
+    if (r->count == r->offsetCapacity) {
+        r->offsetCapacity = r->offsetCapacity ? r->offsetCapacity * 2 : 64;
+        r->offsets = realloc(r->offsets, r->offsetCapacity * sizeof(size_t));
+    }
+    r->offsets[r->count++] = r->size;
+    memcpy(r->arena + r->size, a, alen);
+    memcpy(r->arena + r->size + alen, b, blen);
+    r->size += alen + blen;
+    if (slash) {
+        r->arena[r->size++] = '/';
+    }
+    r->arena[r->size++] = '\0';
+}
+
+void glob_result_free(struct glob_result *r) {
+    free(r->arena);
+    free(r->offsets);
+    memset(r, 0, sizeof(*r));
+}
+
+// Function to add the segments reachable without reading a directory, a **
+// can match no directories at all
+static uint64_t closure(const Glob *g, uint64_t states) {
+    for (int i = 0; i < g->segCount; i++) {
+        if ((states >> i & 1) && g->segs[i].kind == SEG_GLOBSTAR && i + 1 < g->segCount) {
+            states |= 1ull << (i + 1);
+        }
+    }
+    return states;
+}
+
+// Function to decide what one directory entry does for the active segments
+static void planEntry(const char *name, unsigned char type, void *arg) {
+    Visit *v = arg;
+    Glob *g = v->g;
+    size_t len = strlen(name);
+    bool emit = false;
+    uint64_t next = 0;
+    bool follow = false; // only ** refuses to follow symlinks
+    for (int i = 0; i < g->segCount; i++) {
+        if (!(v->states >> i & 1)) {
+            continue;
+        }
+        Segment *s = &g->segs[i];
+        bool last = i == g->segCount - 1;
+        if (s->kind == SEG_GLOBSTAR) {
+            if (name[0] == '.') {
+                continue;
+            }
+            next |= 1ull << i;
+            emit |= last;
+        } else if ((name[0] != '.' || s->dotOk) &&
+                   (s->kind == SEG_NAME ? strcmp(name, s->name) == 0 : glob_match(&s->m, name, len))) {
+            if (last) {
+                emit = true;
+            } else {
+                next |= 1ull << (i + 1);
+                follow = true;
+            }
+        }
+    }
+    if (!emit && next == 0) {
+        return;
+    }
+
+    bool isDir = false;
+    if (next != 0 || g->dirsOnly) {
+        isDir = walk_type(v->fd, name, type, follow || g->dirsOnly) == DT_DIR;
+    }
+    if (emit && (!g->dirsOnly || isDir)) {
+        walk_emit(v->dir, name, len, g->dirsOnly);
+    }
+    if (next != 0 && isDir) {
+        walk_descend(v->dir, name, len, next, follow);
+    }
+}
+
+// Function to read a directory through the directory cache
+static void listEntries(Visit *v) {
+    const char *path = walk_path(v->dir);
+    const struct dir_listing *d = dir_list(path[0] ? path : ".");
+    if (d == NULL) {
+        return;
+    }
+    size_t first = 0, count = d->count;
+    int only = __builtin_ctzll(v->states);
+    const Segment *s = &v->g->segs[only];
+    if ((v->states & (v->states - 1)) == 0 && s->kind == SEG_PATTERN && s->m.prefixLength > 0) {
+        count = dir_prefix(d, s->m.literals + s->m.ops[0].arg, s->m.prefixLength, &first);
+    }
+    for (size_t i = first; i < first + count; i++) {
+        planEntry(dir_name(d, i), dir_type(d, i), v);
+    }
+}
+
+static void globVisit(struct walk_dir *dir, int fd, uint64_t states, void *ctx) {
+    Visit v = {ctx, dir, fd, closure(ctx, states)};
+    int only = __builtin_ctzll(v.states);
+    if ((v.states & (v.states - 1)) == 0 && v.g->segs[only].kind == SEG_NAME) {
+        // a plain name, no need to read the directory
+        struct stat st;
+        const char *name = v.g->segs[only].name;
+        if (fstatat(fd, name, &st, 0) == 0 || fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            planEntry(name, S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN, &v);
+        }
+    } else if (v.g->globstar) {
+        walk_read(fd, planEntry, &v); // the cache is not shared between threads
+    } else {
+        listEntries(&v);
+    }
+}
+
+// Function to split a pattern into segments, false if it has too many
+static bool compileGlob(Glob *g, const char *pattern) {
+    memset(g, 0, sizeof(*g));
+    g->absolute = pattern[0] == '/';
+    size_t plen = strlen(pattern);
+    g->dirsOnly = plen > 1 && pattern[plen - 1] == '/';
+
+    const char *p = pattern;
+    while (*p) {
+        while (*p == '/') {
+            p++;
+        }
+        size_t len = strcspn(p, "/");
+        if (len == 0) {
+            break;
+        }
+        if (g->segCount == GLOB_MAX_SEGMENTS - 1) {
+            return false;
+        }
+        Segment *s = &g->segs[g->segCount];
+        char *word = strndup(p, len);
+        if (strcmp(word, "**") == 0) {
+            if (g->segCount > 0 && g->segs[g->segCount - 1].kind == SEG_GLOBSTAR) {
+                free(word); // **/** is the same as **
+                p += len;
+                continue;
+            }
+            s->kind = SEG_GLOBSTAR;
+            g->globstar = true;
+            free(word);
+        } else if (glob_has_magic(word)) {
+            s->kind = SEG_PATTERN;
+            glob_compile(&s->m, word, len);
+            s->dotOk = word[0] == '.';
+            free(word);
+        } else {
+            // drop the backslashes, the name is looked up as is
+            char *w = word;
+            for (char *r = word; *r; r++) {
+                if (*r == '\\' && r[1] != '\0') {
+                    r++;
+                }
+                *w++ = *r;
+            }
+            *w = '\0';
+            s->kind = SEG_NAME;
+            s->name = word;
+            s->dotOk = true;
+        }
+        g->segCount++;
+        p += len;
+    }
+    return g->segCount > 0;
+}
+
+static void freeGlob(Glob *g) {
+    for (int i = 0; i < g->segCount; i++) {
+        free(g->segs[i].name);
+        glob_matcher_free(&g->segs[i].m);
+    }
+}
+
+size_t glob_run(const char *pattern, struct glob_result *out) {
+    Glob g;
+    size_t found = 0;
+    if (compileGlob(&g, pattern)) {
+        found = walk_run(g.absolute ? "/" : "", 1, g.globstar ? walk_threads() : 1, globVisit, &g, out);
+    }
+    freeGlob(&g);
+    return found;
+}
+
+char **glob_result_pack(struct glob_result *r) {
+    // one block, the pointers and then the strings
+    size_t pointers = (r->count + 1) * sizeof(char *);
+    char **argv = malloc(pointers + r->size);
+    if (argv == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    char *strings = (char *)argv + pointers;
+    memcpy(strings, r->arena, r->size);
+    for (size_t i = 0; i < r->count; i++) {
+        argv[i] = strings + r->offsets[i];
+    }
+    argv[r->count] = NULL;
+    glob_result_free(r);
+    return argv;
+}
+
+/*
+Glob end-----------------------------------------
+*/
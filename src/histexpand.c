@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <readline/history.h>
+#include "lab.h"
+
+/*
+History expansion -----------------------------------------
+Bash style !!, !n, !-n, !prefix, !$ and ^old^new. Numbered events go
+straight to the history file's offset index. !prefix uses a trie of the
+first HIST_PREFIX_KEY bytes of every entry where each node keeps the newest
+entry below it, so the lookup is one walk down the prefix no matter how big
+the history is. Entries are added to the trie as the history file grows.
+*/
+
+#define HIST_PREFIX_KEY 24 // longer prefixes are checked against the entry
+
+static struct trie prefixTrie;
+static bool prefixReady = false;
+static size_t prefixIndexed = 0;
+
+static bool newerEntry(int a, int b, void *ctx) {
+    UNUSED(ctx);
+    return a > b;
+}
+
+size_t hist_expand_update(size_t max) {
+    if (!prefixReady) {
+        trie_init(&prefixTrie);
+        prefixReady = true;
+    }
+
+    size_t count = hist_count();
+    size_t done = 0;
+    while (prefixIndexed < count && done < max) {
+        size_t len;
+        const char *line = hist_get(prefixIndexed, &len);
+        if (line != NULL) {
+            trie_insert(&prefixTrie, line, len < HIST_PREFIX_KEY ? len : HIST_PREFIX_KEY,
+                        (int)prefixIndexed, newerEntry, NULL);
+        }
+        prefixIndexed++;
+        done++;
+    }
+    return done;
+}
+
+void hist_expand_free() {
+    if (prefixReady) {
+        trie_free(&prefixTrie);
+    }
+    prefixReady = false;
+    prefixIndexed = 0;
+}
+
+// Function to get history entry n (0 is the oldest) as a new string, from the
+// history file or from readline when there is no file
+static char *eventText(long n) {
+    size_t count = hist_count();
+    if (count > 0) {
+        size_t len;
+        const char *text = n >= 0 && (size_t)n < count ? hist_get(n, &len) : NULL;
+        return text ? strndup(text, len) : NULL;
+    }
+    HIST_ENTRY *entry = history_get(history_base + n);
+    return entry ? strdup(entry->line) : NULL;
+}
+
+static long eventCount() {
+    size_t count = hist_count();
+    return count > 0 ? (long)count : history_length;
+}
+
+static char *prefixEvent(const char *prefix, size_t len) {
+    if (hist_count() == 0) {
+        // no history file, readline's list is small enough to walk
+        for (long n = history_length - 1; n >= 0; n--) {
+            HIST_ENTRY *entry = history_get(history_base + n);
+            if (entry && strncmp(entry->line, prefix, len) == 0) {
+                return strdup(entry->line);
+            }
+        }
+        return NULL;
+    }
+
+    hist_expand_update(SIZE_MAX);
+    size_t keyLen = len < HIST_PREFIX_KEY ? len : HIST_PREFIX_KEY;
+    int node = trie_find(&prefixTrie, prefix, keyLen);
+    if (node < 0) {
+        return NULL;
+    }
+    long newest = prefixTrie.nodes[node].best;
+    if (len <= HIST_PREFIX_KEY) {
+        return eventText(newest);
+    }
+    // a prefix longer than the trie keys, the trigram index finds the entries
+    // that contain it and only those are checked for it at the start
+    char *pattern = strndup(prefix, len);
+    size_t ids[64];
+    size_t before = (size_t)newest + 1;
+    size_t found;
+    char *event = NULL;
+    while (event == NULL && (found = hist_search(pattern, false, before, ids, 64)) > 0) {
+        for (size_t i = 0; i < found && event == NULL; i++) {
+            size_t entryLen;
+            const char *text = hist_get(ids[i], &entryLen);
+            if (text && entryLen >= len && memcmp(text, prefix, len) == 0) {
+                event = strndup(text, entryLen);
+            }
+        }
+        before = ids[found - 1];
+    }
+    free(pattern);
+    return event;
+}
+
+// Function to get the last word of a line for !$
+static char *lastWord(const char *line) {
+    const char *end = line + strlen(line);
+    while (end > line && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    const char *start = end;
+    while (start > line && start[-1] != ' ' && start[-1] != '\t') {
+        start--;
+    }
+    return strndup(start, end - start);
+}
+
+// growable output string
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Out;
+
+static void outAppend(Out *o, const char *s, size_t n) {
+    if (o->len + n + 1 > o->cap) {
+        o->cap = (o->len + n + 1) * 2;
+        o->buf = realloc(o->buf, o->cap);
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+    o->buf[o->len] = '\0';
+}
+
+// Function for ^old^new, the previous command with the first old replaced
+static int quickSubstitution(const char *line, char **result) {
+    const char *old = line + 1;
+    const char *sep = strchr(old, '^');
+    if (sep == NULL || sep == old) {
+        fprintf(stderr, "%s: bad substitution\n", line);
+        return -1;
+    }
+    const char *repl = sep + 1;
+    const char *replEnd = strchr(repl, '^');
+    size_t replLen = replEnd ? (size_t)(replEnd - repl) : strlen(repl);
+
+    char *prev = eventText(eventCount() - 1);
+    char *oldText = strndup(old, sep - old);
+    char *at = prev ? strstr(prev, oldText) : NULL;
+    if (at == NULL) {
+        fprintf(stderr, "%s: substitution failed\n", line);
+        free(prev);
+        free(oldText);
+        return -1;
+    }
+
+    Out o = {NULL, 0, 0};
+    outAppend(&o, prev, at - prev);
+    outAppend(&o, repl, replLen);
+    outAppend(&o, at + strlen(oldText), strlen(at + strlen(oldText)));
+    if (replEnd != NULL) {
+        outAppend(&o, replEnd + 1, strlen(replEnd + 1)); // text after ^old^new^
+    }
+    free(prev);
+    free(oldText);
+    *result = o.buf;
+    return 1;
+}
+
+int hist_expand(const char *line, char **result) {
+    *result = NULL;
+    if (line[0] == '^') {
+        return quickSubstitution(line, result);
+    }
+    if (strchr(line, '!') == NULL) {
+        return 0; // the usual case, nothing to do
+    }
+
+    Out o = {NULL, 0, 0};
+    bool changed = false;
+    bool quoted = false;
+    for (const char *p = line; *p; p++) {
+        if (*p == '\'') {
+            quoted = !quoted; // no expansion inside single quotes
+        }
+        if (*p == '\\' && p[1] == '!') {
+            outAppend(&o, p, 2); // left for quote removal later
+            p++;
+            continue;
+        }
+        bool bracket = p > line && p[-1] == '[' && strchr(p, ']') != NULL; // [!x] is a glob class
+        if (*p != '!' || quoted || bracket || p[1] == '\0' || strchr(" \t\n=(\"", p[1])) {
+            outAppend(&o, p, 1);
+            continue;
+        }
+
+        char *event = NULL;
+        const char *next = p + 1;
+        if (p[1] == '!') {
+            event = eventText(eventCount() - 1);
+            next = p + 2;
+        } else if (p[1] == '$') {
+            char *prev = eventText(eventCount() - 1);
+            event = prev ? lastWord(prev) : NULL;
+            free(prev);
+            next = p + 2;
+        } else if (p[1] == '-' || (p[1] >= '0' && p[1] <= '9')) {
+            char *end;
+            long n = strtol(p + 1, &end, 10);
+            event = eventText(n < 0 ? eventCount() + n : n - 1); // !n counts from 1
+            next = end;
+        } else {
+            size_t len = strcspn(p + 1, " \t;&|");
+            event = prefixEvent(p + 1, len);
+            next = p + 1 + len;
+        }
+
+        if (event == NULL) {
+            fprintf(stderr, "%.*s: event not found\n", (int)(next - p), p);
+            free(o.buf);
+            return -1;
+        }
+        outAppend(&o, event, strlen(event));
+        free(event);
+        changed = true;
+        p = next - 1;
+    }
+
+    if (!changed) {
+        free(o.buf);
+        return 0;
+    }
+    *result = o.buf;
+    return 1;
+}
+
+/*
+History expansion end-----------------------------------------
+*/
@@ -0,0 +1,780 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/history.h>
+#include "lab.h"
+
+/*
+Persistent history -----------------------------------------
+The history file is append only. Each entry is a small header followed by
+the line with no newline or terminator:
+
+    uint32 magic | uint32 length | int64 time | length bytes
+
+Next to it is an index file with the offset of every entry, so entry n can
+be found without reading the ones before it:
+
+    uint32 magic | uint32 unused | uint64 bytes of the history file indexed
+    uint64 offset of entry 0 | uint64 offset of entry 1 | ...
+
+Both are mmapped when the shell starts and only the last few entries are
+copied into readline. If the index is missing or behind (another shell or a
+crash) the entries after the indexed bytes are scanned and added to it.
+
+Every shell appends whole entries with one O_APPEND write, so shells sharing
+the file need no lock for it. Each one watches the file with inotify and
+when it grows only the bytes past its own covered offset are read.
+
+Older entries are moved into a block file (path.blk) of compressed blocks of
+HIST_BLOCK_ENTRIES entries. In a block each entry is front coded against the
+one before it and the block is then compressed with lz_compress, so any
+block can be decoded on its own:
+
+    uint32 magic | uint32 unused | uint64 entries archived | uint64 bytes archived
+    block: uint32 magic | uint32 count | uint32 raw size | uint32 packed size
+           uint64 first entry | packed bytes
+    raw entry: varint shared prefix | varint suffix length
+               | varint zigzag time delta | suffix bytes
+
+Once entries are in the block file their bytes in the history file are
+punched out with fallocate. Offsets do not change, so the index and other
+shells appending stay valid, and the disk space is given back.
+*/
+
+#define HIST_MAGIC 0x54534948u // "HIST"
+#define HIST_INDEX_MAGIC 0x58444948u // "HIDX"
+#define HIST_ARCHIVE_MAGIC 0x4b4c4248u // "HBLK"
+#define HIST_BLOCK_MAGIC 0x314b4c42u // "BLK1"
+#define HIST_BLOCK_ENTRIES 256
+#define HIST_KEEP_RAW 1024 // newest entries always stay uncompressed
+#define HIST_COMPACT_AT 8192 // compact once this many are uncompressed
+#define HIST_BLOCK_CACHE 4
+
+typedef struct {
+    uint32_t magic;
+    uint32_t len;
+    int64_t time;
+} HistHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t unused;
+    uint64_t covered; // bytes of the history file that are in the index
+} HistIndexHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t unused;
+    uint64_t entries; // entries [0, entries) are in blocks
+    uint64_t bytes; // bytes of the history file they came from
+} HistArchiveHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t rawSize;
+    uint32_t packedSize;
+    uint64_t first;
+} HistBlockHeader;
+
+typedef struct {
+    uint64_t first; // first entry in the block
+    uint32_t count;
+    uint32_t rawSize;
+    uint32_t packedSize;
+    uint64_t offset; // of the packed bytes in the block file
+} BlockInfo;
+
+// a decoded block, entries are stored one after the other in text
+typedef struct {
+    long block; // -1 when the slot is empty
+    char *text;
+    uint32_t *starts;
+    uint32_t *lens;
+    int64_t *times;
+} DecodedBlock;
+
+static int blockFd = -1;
+static char *blockMap = NULL;
+static size_t blockMapSize = 0;
+static BlockInfo *blocks = NULL;
+static size_t blockCount = 0;
+static uint64_t archivedEntries = 0;
+static uint64_t archivedBytes = 0;
+static DecodedBlock blockCache[HIST_BLOCK_CACHE];
+static int nextCacheSlot = 0;
+
+static int dataFd = -1;
+static int indexFd = -1;
+static char *dataMap = NULL; // mmap of the history file
+static size_t dataMapSize = 0;
+static uint64_t *offsets = NULL; // entry offsets, copied out of the index
+static size_t entryCount = 0;
+static size_t offsetCapacity = 0;
+static uint64_t covered = 0; // bytes of the history file in offsets
+static size_t readlineCount = 0; // entries before this are already in readline
+static int watchFd = -1; // inotify on the history file
+
+static int mapData(size_t size) {
+    if (size == dataMapSize) {
+        return 0;
+    }
+    if (dataMap != NULL) {
+        munmap(dataMap, dataMapSize);
+        dataMap = NULL;
+        dataMapSize = 0;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, dataFd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    dataMap = map;
+    dataMapSize = size;
+    return 0;
+}
+
+static void pushOffset(uint64_t offset) {
+    if (entryCount == offsetCapacity) {
+        offsetCapacity = offsetCapacity ? offsetCapacity * 2 : 1024;
+        offsets = realloc(offsets, offsetCapacity * sizeof(uint64_t));
+    }
+    offsets[entryCount++] = offset;
+}
+
+// Function to read the index file into offsets, returns false if it does not
+// belong to this history file so it has to be rebuilt
+static bool readIndex() {
+    struct stat st;
+    if (fstat(indexFd, &st) != 0 || (size_t)st.st_size < sizeof(HistIndexHeader)) {
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, indexFd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    HistIndexHeader hdr;
+    memcpy(&hdr, map, sizeof(hdr));
+    size_t n = (st.st_size - sizeof(hdr)) / sizeof(uint64_t);
+    bool ok = hdr.magic == HIST_INDEX_MAGIC && hdr.covered <= dataMapSize;
+    if (ok) {
+        offsetCapacity = n + 1024;
+        offsets = malloc(offsetCapacity * sizeof(uint64_t));
+        memcpy(offsets, (char *)map + sizeof(hdr), n * sizeof(uint64_t));
+        entryCount = n;
+        covered = hdr.covered;
+        // drop offsets past what the header says is covered, a torn update
+        while (entryCount > 0 && offsets[entryCount - 1] >= covered) {
+            entryCount--;
+        }
+        // anything else out of order or past the file is a corrupt index
+        for (size_t i = 0; ok && i < entryCount; i++) {
+            ok = offsets[i] < covered && covered - offsets[i] >= sizeof(HistHeader) &&
+                 (i == 0 || offsets[i] >= offsets[i - 1]);
+        }
+    }
+    munmap(map, st.st_size);
+    return ok;
+}
+
+// Function to find the entries in the history file after covered and add
+// them to offsets and the index file. Returns the number of new entries.
+static size_t scanNewEntries() {
+    size_t added = 0;
+    size_t firstNew = entryCount;
+    uint64_t pos = covered;
+
+    while (pos + sizeof(HistHeader) <= dataMapSize) {
+        HistHeader hdr;
+        memcpy(&hdr, dataMap + pos, sizeof(hdr));
+        if (hdr.magic != HIST_MAGIC) {
+            pos++; // garbage from a crashed write, resync on the next magic
+            continue;
+        }
+        if (pos + sizeof(hdr) + hdr.len > dataMapSize) {
+            break; // still being written
+        }
+        pushOffset(pos);
+        pos += sizeof(hdr) + hdr.len;
+        added++;
+    }
+    covered = pos;
+
+    if (indexFd >= 0 && (added > 0 || firstNew == 0)) {
+        // other shells update the index too, the lock keeps the header and
+        // the offsets written together
+        flock(indexFd, LOCK_EX);
+        HistIndexHeader ihdr = {HIST_INDEX_MAGIC, 0, covered};
+        off_t at = sizeof(ihdr) + firstNew * sizeof(uint64_t);
+        bool ok = pwrite(indexFd, &offsets[firstNew], added * sizeof(uint64_t), at) ==
+                  (ssize_t)(added * sizeof(uint64_t));
+        if (ok && ftruncate(indexFd, at + added * sizeof(uint64_t)) == 0) {
+            pwrite(indexFd, &ihdr, sizeof(ihdr), 0);
+        }
+        flock(indexFd, LOCK_UN);
+    }
+    return added;
+}
+
+static uint8_t *putVarint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static bool getVarint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        uint8_t b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void clearBlockCache() {
+    for (int i = 0; i < HIST_BLOCK_CACHE; i++) {
+        free(blockCache[i].text);
+        free(blockCache[i].starts);
+        free(blockCache[i].lens);
+        free(blockCache[i].times);
+        memset(&blockCache[i], 0, sizeof(DecodedBlock));
+        blockCache[i].block = -1;
+    }
+}
+
+// Function to (re)map the block file and list its blocks. Other shells may
+// have added blocks since the last time, so this is also how they are found.
+static void loadArchive() {
+    if (blockMap != NULL) {
+        munmap(blockMap, blockMapSize);
+        blockMap = NULL;
+        blockMapSize = 0;
+    }
+    free(blocks);
+    blocks = NULL;
+    blockCount = 0;
+    archivedEntries = 0;
+    archivedBytes = 0;
+    clearBlockCache();
+
+    struct stat st;
+    if (blockFd < 0 || fstat(blockFd, &st) != 0 || (size_t)st.st_size < sizeof(HistArchiveHeader)) {
+        return;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, blockFd, 0);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    blockMap = map;
+    blockMapSize = st.st_size;
+
+    HistArchiveHeader hdr;
+    memcpy(&hdr, blockMap, sizeof(hdr));
+    if (hdr.magic != HIST_ARCHIVE_MAGIC) {
+        return;
+    }
+
+    // only blocks the header counts are real, anything after is from a
+    // compaction that did not finish
+    size_t pos = sizeof(hdr);
+    uint64_t next = 0;
+    size_t capacity = 0;
+    while (next < hdr.entries && pos + sizeof(HistBlockHeader) <= blockMapSize) {
+        HistBlockHeader bh;
+        memcpy(&bh, blockMap + pos, sizeof(bh));
+        if (bh.magic != HIST_BLOCK_MAGIC || bh.first != next ||
+            pos + sizeof(bh) + bh.packedSize > blockMapSize) {
+            break;
+        }
+        if (blockCount == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            blocks = realloc(blocks, capacity * sizeof(BlockInfo));
+        }
+        BlockInfo *b = &blocks[blockCount++];
+        b->first = bh.first;
+        b->count = bh.count;
+        b->rawSize = bh.rawSize;
+        b->packedSize = bh.packedSize;
+        b->offset = pos + sizeof(bh);
+        pos += sizeof(bh) + bh.packedSize;
+        next += bh.count;
+    }
+    archivedEntries = next;
+    archivedBytes = next == hdr.entries ? hdr.bytes : 0;
+    if (next != hdr.entries) {
+        archivedEntries = 0; // damaged, fall back to the history file
+        blockCount = 0;
+    }
+}
+
+static long findBlock(size_t id) {
+    size_t lo = 0, hi = blockCount;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (blocks[mid].first + blocks[mid].count <= id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < blockCount && blocks[lo].first <= id ? (long)lo : -1;
+}
+
+// Function to get a block decoded, from the cache if it is there
+static DecodedBlock *decodeBlock(long b) {
+    for (int i = 0; i < HIST_BLOCK_CACHE; i++) {
+        if (blockCache[i].block == b && blockCache[i].text != NULL) {
+            return &blockCache[i];
+        }
+    }
+
+    BlockInfo *info = &blocks[b];
+    uint8_t *raw = malloc(info->rawSize);
+    if (!lz_decompress((uint8_t *)blockMap + info->offset, info->packedSize, raw, info->rawSize)) {
+        free(raw);
+        return NULL;
+    }
+
+    DecodedBlock *d = &blockCache[nextCacheSlot];
+    nextCacheSlot = (nextCacheSlot + 1) % HIST_BLOCK_CACHE;
+    free(d->text);
+    free(d->starts);
+    free(d->lens);
+    free(d->times);
+    d->block = -1;
+    d->starts = malloc(info->count * sizeof(uint32_t));
+    d->lens = malloc(info->count * sizeof(uint32_t));
+    d->times = malloc(info->count * sizeof(int64_t));
+
+    size_t capacity = info->rawSize * 2 + 64;
+    d->text = malloc(capacity);
+    size_t used = 0;
+    int64_t when = 0;
+    const uint8_t *p = raw;
+    const uint8_t *end = raw + info->rawSize;
+    bool ok = true;
+    for (uint32_t i = 0; i < info->count && ok; i++) {
+        uint64_t prefix, suffix, delta;
+        ok = getVarint(&p, end, &prefix) && getVarint(&p, end, &suffix) &&
+             getVarint(&p, end, &delta) && suffix <= (uint64_t)(end - p) &&
+             (i > 0 ? prefix <= d->lens[i - 1] : prefix == 0);
+        if (!ok) {
+            break;
+        }
+        if (used + prefix + suffix > capacity) {
+            capacity = (used + prefix + suffix) * 2;
+            d->text = realloc(d->text, capacity);
+        }
+        // the shared prefix comes from the entry before
+        if (prefix > 0) {
+            memmove(d->text + used, d->text + d->starts[i - 1], prefix);
+        }
+        memcpy(d->text + used + prefix, p, suffix);
+        p += suffix;
+        when += (int64_t)(delta >> 1) ^ -(int64_t)(delta & 1);
+        d->starts[i] = used;
+        d->lens[i] = prefix + suffix;
+        d->times[i] = when;
+        used += prefix + suffix;
+    }
+    free(raw);
+    if (!ok) {
+        return NULL;
+    }
+    d->block = b;
+    return d;
+}
+
+// Function to get an entry from the blocks, false if it is not in them
+static bool archivedEntry(size_t id, const char **text, size_t *len, int64_t *when) {
+    long b = id < archivedEntries ? findBlock(id) : -1;
+    DecodedBlock *d = b >= 0 ? decodeBlock(b) : NULL;
+    if (d == NULL) {
+        return false;
+    }
+    size_t i = id - blocks[b].first;
+    *text = d->text + d->starts[i];
+    *len = d->lens[i];
+    *when = d->times[i];
+    return true;
+}
+
+// Function to read an entry from the history file, false if its bytes have
+// been punched out because another shell moved it into a block
+static bool journalEntry(size_t id, const char **text, size_t *len, int64_t *when) {
+    HistHeader hdr;
+    memcpy(&hdr, dataMap + offsets[id], sizeof(hdr));
+    if (hdr.magic != HIST_MAGIC || offsets[id] + sizeof(hdr) + hdr.len > dataMapSize) {
+        return false;
+    }
+    *text = dataMap + offsets[id] + sizeof(hdr);
+    *len = hdr.len;
+    *when = hdr.time;
+    return true;
+}
+
+static bool getEntry(size_t id, const char **text, size_t *len, int64_t *when) {
+    if (id >= entryCount) {
+        return false;
+    }
+    if (archivedEntry(id, text, len, when) || journalEntry(id, text, len, when)) {
+        return true;
+    }
+    loadArchive(); // another shell compacted, pick up its blocks
+    return archivedEntry(id, text, len, when);
+}
+
+// Function to pack entries [first, first + count) into one block
+static bool writeBlock(size_t first, size_t count, off_t at, off_t *next) {
+    size_t rawCapacity = 64;
+    for (size_t i = first; i < first + count; i++) {
+        HistHeader hdr;
+        memcpy(&hdr, dataMap + offsets[i], sizeof(hdr));
+        if (hdr.magic != HIST_MAGIC) {
+            return false;
+        }
+        rawCapacity += hdr.len + 30;
+    }
+
+    uint8_t *raw = malloc(rawCapacity);
+    uint8_t *p = raw;
+    const char *prev = NULL;
+    size_t prevLen = 0;
+    int64_t prevTime = 0;
+    for (size_t i = first; i < first + count; i++) {
+        const char *text;
+        size_t len;
+        int64_t when;
+        journalEntry(i, &text, &len, &when);
+
+        size_t prefix = 0;
+        while (prev != NULL && prefix < len && prefix < prevLen && prev[prefix] == text[prefix]) {
+            prefix++;
+        }
+        int64_t delta = when - prevTime;
+        p = putVarint(p, prefix);
+        p = putVarint(p, len - prefix);
+        p = putVarint(p, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+        memcpy(p, text + prefix, len - prefix);
+        p += len - prefix;
+        prev = text;
+        prevLen = len;
+        prevTime = when;
+    }
+
+    size_t rawSize = p - raw;
+    uint8_t *packed = malloc(sizeof(HistBlockHeader) + lz_bound(rawSize));
+    size_t packedSize = lz_compress(raw, rawSize, packed + sizeof(HistBlockHeader));
+    HistBlockHeader bh = {HIST_BLOCK_MAGIC, (uint32_t)count, (uint32_t)rawSize,
+                          (uint32_t)packedSize, first};
+    memcpy(packed, &bh, sizeof(bh));
+
+    size_t total = sizeof(bh) + packedSize;
+    bool ok = pwrite(blockFd, packed, total, at) == (ssize_t)total;
+    free(raw);
+    free(packed);
+    *next = at + total;
+    return ok;
+}
+
+int hist_compact(bool force) {
+    if (dataFd < 0 || blockFd < 0) {
+        return -1;
+    }
+    if (flock(blockFd, LOCK_EX | (force ? 0 : LOCK_NB)) != 0) {
+        return 0; // another shell is compacting
+    }
+    loadArchive(); // it may have been compacted by another shell already
+
+    size_t keep = force ? 0 : HIST_KEEP_RAW;
+    size_t target = archivedEntries;
+    if (entryCount > archivedEntries + keep) {
+        target = archivedEntries + (entryCount - archivedEntries - keep) / HIST_BLOCK_ENTRIES * HIST_BLOCK_ENTRIES;
+    }
+    if (target <= archivedEntries) {
+        flock(blockFd, LOCK_UN);
+        return 0;
+    }
+
+    off_t at = blockCount > 0 ? (off_t)(blocks[blockCount - 1].offset + blocks[blockCount - 1].packedSize)
+                              : (off_t)sizeof(HistArchiveHeader);
+    size_t done = archivedEntries;
+    bool ok = true;
+    while (ok && done < target) {
+        ok = writeBlock(done, HIST_BLOCK_ENTRIES, at, &at);
+        done += ok ? HIST_BLOCK_ENTRIES : 0;
+    }
+
+    if (done > archivedEntries && ftruncate(blockFd, at) == 0 && fdatasync(blockFd) == 0) {
+        // the blocks are on disk, now they count and the raw bytes can go.
+        // When every entry went into blocks they end where the scan stopped.
+        uint64_t end = done < entryCount ? offsets[done] : covered;
+        HistArchiveHeader hdr = {HIST_ARCHIVE_MAGIC, 0, done, end};
+        if (pwrite(blockFd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && fdatasync(blockFd) == 0) {
+            uint64_t from = archivedBytes;
+            fallocate(dataFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, from, end - from);
+        }
+    }
+    flock(blockFd, LOCK_UN);
+    loadArchive();
+    return ok ? 0 : -1;
+}
+
+static char *defaultHistPath() {
+    const char *env = getenv("LAB_HISTFILE");
+    if (env != NULL) {
+        return strdup(env);
+    }
+    const char *home = getenv("HOME");
+    if (home == NULL) {
+        return NULL;
+    }
+    size_t n = strlen(home) + sizeof("/.lab_history");
+    char *path = malloc(n);
+    snprintf(path, n, "%s/.lab_history", home);
+    return path;
+}
+
+int hist_open(const char *path) {
+    hist_close();
+
+    char *owned = path ? strdup(path) : defaultHistPath();
+    if (owned == NULL) {
+        return -1;
+    }
+
+    dataFd = open(owned, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    size_t n = strlen(owned) + sizeof(".idx");
+    char *indexPath = malloc(n);
+    snprintf(indexPath, n, "%s.idx", owned);
+    if (dataFd >= 0) {
+        indexFd = open(indexPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        snprintf(indexPath, n, "%s.blk", owned);
+        blockFd = open(indexPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    }
+    free(indexPath);
+    if (blockFd >= 0) {
+        struct stat bst;
+        if (fstat(blockFd, &bst) == 0 && bst.st_size == 0) {
+            HistArchiveHeader hdr = {HIST_ARCHIVE_MAGIC, 0, 0, 0};
+            pwrite(blockFd, &hdr, sizeof(hdr), 0);
+        }
+        loadArchive();
+    }
+
+    struct stat st;
+    if (dataFd < 0 || fstat(dataFd, &st) != 0 || mapData(st.st_size) != 0) {
+        hist_close();
+        free(owned);
+        return -1;
+    }
+
+    // other shells appending wake us up, no polling of the file size
+    watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watchFd >= 0 && inotify_add_watch(watchFd, owned, IN_MODIFY) < 0) {
+        close(watchFd);
+        watchFd = -1;
+    }
+    free(owned);
+
+    if (indexFd < 0 || !readIndex()) {
+        // no usable index, start over after the entries that are in blocks,
+        // their bytes in the history file are gone and they need no offsets
+        free(offsets);
+        offsets = NULL;
+        entryCount = 0;
+        offsetCapacity = 0;
+        for (uint64_t i = 0; i < archivedEntries; i++) {
+            pushOffset(0);
+        }
+        covered = archivedBytes;
+    }
+    scanNewEntries();
+    readlineCount = entryCount; // older entries only go in with hist_load_readline
+    if (entryCount - archivedEntries >= HIST_COMPACT_AT) {
+        hist_compact(false);
+    }
+    return 0;
+}
+
+void hist_close() {
+    hist_search_free(); // ids in the search index belong to this file
+    frecency_free();
+    hist_expand_free();
+    if (dataMap != NULL) {
+        munmap(dataMap, dataMapSize);
+    }
+    if (dataFd >= 0) {
+        close(dataFd);
+    }
+    if (indexFd >= 0) {
+        close(indexFd);
+    }
+    if (watchFd >= 0) {
+        close(watchFd);
+    }
+    if (blockMap != NULL) {
+        munmap(blockMap, blockMapSize);
+    }
+    if (blockFd >= 0) {
+        close(blockFd);
+    }
+    clearBlockCache();
+    free(blocks);
+    free(offsets);
+    dataMap = NULL;
+    dataMapSize = 0;
+    dataFd = -1;
+    indexFd = -1;
+    watchFd = -1;
+    blockFd = -1;
+    blockMap = NULL;
+    blockMapSize = 0;
+    blocks = NULL;
+    blockCount = 0;
+    archivedEntries = 0;
+    archivedBytes = 0;
+    readlineCount = 0;
+    offsets = NULL;
+    entryCount = 0;
+    offsetCapacity = 0;
+    covered = 0;
+}
+
+size_t hist_count() {
+    return entryCount;
+}
+
+const char *hist_get(size_t i, size_t *len) {
+    const char *text;
+    size_t n;
+    int64_t when;
+    if (!getEntry(i, &text, &n, &when)) {
+        return NULL;
+    }
+    if (len != NULL) {
+        *len = n;
+    }
+    return text;
+}
+
+int64_t hist_time(size_t i) {
+    const char *text;
+    size_t n;
+    int64_t when;
+    return getEntry(i, &text, &n, &when) ? when : 0;
+}
+
+int hist_append(const char *line) {
+    if (dataFd < 0) {
+        return -1;
+    }
+
+    size_t len = strlen(line);
+    size_t total = sizeof(HistHeader) + len;
+    char stackBuf[512];
+    char *buf = total <= sizeof(stackBuf) ? stackBuf : malloc(total);
+    HistHeader hdr = {HIST_MAGIC, (uint32_t)len, (int64_t)time(NULL)};
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), line, len);
+
+    // the whole entry in one write, O_APPEND puts it at the end atomically
+    ssize_t written = write(dataFd, buf, total);
+    if (buf != stackBuf) {
+        free(buf);
+    }
+    if (written != (ssize_t)total) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(dataFd, &st) != 0 || mapData(st.st_size) != 0) {
+        return -1;
+    }
+    scanNewEntries();
+    if (entryCount - archivedEntries >= HIST_COMPACT_AT) {
+        hist_compact(false);
+    }
+    return 0;
+}
+
+// Function to copy entries [first, entryCount) into readline
+static void addToReadline(size_t first) {
+    char stackBuf[512];
+
+    for (size_t i = first; i < entryCount; i++) {
+        size_t len;
+        const char *text = hist_get(i, &len);
+        if (text == NULL) {
+            continue; // damaged entry, leave it out
+        }
+        // entries are not terminated in the file, readline wants a string
+        char *line = len < sizeof(stackBuf) ? stackBuf : malloc(len + 1);
+        memcpy(line, text, len);
+        line[len] = '\0';
+        add_history(line);
+        if (line != stackBuf) {
+            free(line);
+        }
+    }
+    readlineCount = entryCount;
+}
+
+void hist_load_readline(size_t tail) {
+    addToReadline(entryCount > tail ? entryCount - tail : 0);
+}
+
+size_t hist_sync() {
+    if (dataFd < 0) {
+        return 0;
+    }
+
+    // drain the events, any number of them just means the file grew
+    char events[4096];
+    bool changed = false;
+    while (watchFd >= 0 && read(watchFd, events, sizeof(events)) > 0) {
+        changed = true;
+    }
+    if (watchFd >= 0 && !changed) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(dataFd, &st) != 0 || (uint64_t)st.st_size <= covered ||
+        mapData(st.st_size) != 0) {
+        return 0;
+    }
+    return scanNewEntries();
+}
+
+size_t hist_sync_readline() {
+    hist_sync();
+    size_t added = entryCount - readlineCount;
+    addToReadline(readlineCount);
+    return added;
+}
+
+/*
+Persistent history end-----------------------------------------
+*/
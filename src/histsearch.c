@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <readline/readline.h>
+#include "lab.h"
+
+/*
+History search -----------------------------------------
+A trigram index over the history file. Every distinct three byte sequence in
+an entry maps to the sorted list of entries containing it. A substring query
+only verifies the entries that are in the lists of all of its trigrams,
+walking the shortest list and binary searching the others. Fuzzy queries
+(the pattern's characters in order, not next to each other) are filtered
+with a 64 bit mask of the characters in each entry.
+
+The index is built the first time it is needed and after that only the
+entries added to the history file since are indexed.
+*/
+
+typedef struct {
+    uint32_t trigram; // 0 marks an empty slot, trigrams are stored + 1
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *ids; // entry ids, ascending
+} Posting;
+
+static Posting *postings = NULL;
+static size_t postingCapacity = 0; // power of two
+static size_t postingUsed = 0;
+static uint64_t *masks = NULL; // per entry character mask for fuzzy search
+static size_t indexedCount = 0; // entries [0, indexedCount) are indexed
+
+// Ctrl-R state, the query is kept while the key is pressed repeatedly
+static char *searchQuery = NULL;
+static size_t searchBefore = 0;
+
+static uint32_t trigramAt(const char *s) {
+    return ((uint32_t)(unsigned char)s[0] << 16 | (uint32_t)(unsigned char)s[1] << 8 |
+            (uint32_t)(unsigned char)s[2]) + 1;
+}
+
+static size_t slotFor(uint32_t trigram) {
+    size_t mask = postingCapacity - 1;
+    size_t i = (trigram * 2654435761u) & mask;
+    while (postings[i].trigram != 0 && postings[i].trigram != trigram) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void growPostings() {
+    Posting *old = postings;
+    size_t oldCapacity = postingCapacity;
+    postingCapacity = oldCapacity ? oldCapacity * 2 : 4096;
+    postings = calloc(postingCapacity, sizeof(Posting));
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].trigram != 0) {
+            postings[slotFor(old[i].trigram)] = old[i];
+        }
+    }
+    free(old);
+}
+
+static Posting *findPosting(uint32_t trigram) {
+    if (postingCapacity == 0) {
+        return NULL;
+    }
+    Posting *p = &postings[slotFor(trigram)];
+    return p->trigram == trigram ? p : NULL;
+}
+
+static void addPosting(uint32_t trigram, uint32_t id) {
+    if ((postingUsed + 1) * 4 > postingCapacity * 3) {
+        growPostings();
+    }
+    Posting *p = &postings[slotFor(trigram)];
+    if (p->trigram == 0) {
+        p->trigram = trigram;
+        postingUsed++;
+    }
+    if (p->count > 0 && p->ids[p->count - 1] == id) {
+        return; // trigram repeats in the same entry
+    }
+    if (p->count == p->capacity) {
+        p->capacity = p->capacity ? p->capacity * 2 : 4;
+        p->ids = realloc(p->ids, p->capacity * sizeof(uint32_t));
+    }
+    p->ids[p->count++] = id;
+}
+
+// fuzzy matching ignores case, so the mask does too
+static uint64_t charBit(unsigned char c) {
+    return 1ull << (tolower(c) & 63);
+}
+
+static uint64_t charMask(const char *s, size_t len) {
+    uint64_t m = 0;
+    for (size_t i = 0; i < len; i++) {
+        m |= charBit(s[i]);
+    }
+    return m;
+}
+
+// Function to index the entries added to the history file since last time
+static void updateIndex() {
+    size_t count = hist_count();
+    if (count <= indexedCount) {
+        return;
+    }
+
+    masks = realloc(masks, count * sizeof(uint64_t));
+    for (size_t id = indexedCount; id < count; id++) {
+        size_t len;
+        const char *text = hist_get(id, &len);
+        if (text == NULL) {
+            masks[id] = 0;
+            continue; // unreadable entry, it never matches
+        }
+        masks[id] = charMask(text, len);
+        for (size_t i = 0; i + 3 <= len; i++) {
+            addPosting(trigramAt(text + i), id);
+        }
+    }
+    indexedCount = count;
+}
+
+// index of the first id >= target in a sorted list
+static size_t lowerBound(const uint32_t *ids, size_t n, uint32_t target) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ids[mid] < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool fuzzyMatch(const char *text, size_t len, const char *pattern) {
+    size_t j = 0;
+    for (size_t i = 0; i < len && pattern[j] != '\0'; i++) {
+        if (tolower((unsigned char)text[i]) == tolower((unsigned char)pattern[j])) {
+            j++;
+        }
+    }
+    return pattern[j] == '\0';
+}
+
+static bool substringMatch(const char *text, size_t len, const char *pattern, size_t plen) {
+    return memmem(text, len, pattern, plen) != NULL;
+}
+
+size_t hist_search(const char *pattern, bool fuzzy, size_t before, size_t *results, size_t max) {
+    updateIndex();
+    if (before > indexedCount) {
+        before = indexedCount;
+    }
+
+    size_t plen = strlen(pattern);
+    size_t found = 0;
+    Posting *shortest = NULL;
+    Posting *lists[64];
+    size_t listCount = 0;
+
+    if (!fuzzy && plen >= 3) {
+        // every trigram of the pattern has to be in the entry
+        for (size_t i = 0; i + 3 <= plen && listCount < 64; i++) {
+            Posting *p = findPosting(trigramAt(pattern + i));
+            if (p == NULL) {
+                return 0; // a trigram no entry has
+            }
+            lists[listCount++] = p;
+            if (shortest == NULL || p->count < shortest->count) {
+                shortest = p;
+            }
+        }
+    }
+
+    if (shortest != NULL) {
+        // newest first, so walk the shortest list backwards from before
+        size_t k = lowerBound(shortest->ids, shortest->count, before);
+        while (k > 0 && found < max) {
+            uint32_t id = shortest->ids[--k];
+            bool candidate = true;
+            for (size_t l = 0; l < listCount && candidate; l++) {
+                Posting *p = lists[l];
+                size_t at = lowerBound(p->ids, p->count, id);
+                candidate = at < p->count && p->ids[at] == id;
+            }
+            size_t len;
+            const char *text = candidate ? hist_get(id, &len) : NULL;
+            if (text != NULL && substringMatch(text, len, pattern, plen)) {
+                results[found++] = id;
+            }
+        }
+        return found;
+    }
+
+    // short patterns and fuzzy ones check every entry, the mask skips most
+    uint64_t need = charMask(pattern, plen);
+    for (size_t id = before; id > 0 && found < max; id--) {
+        if ((masks[id - 1] & need) != need) {
+            continue;
+        }
+        size_t len;
+        const char *text = hist_get(id - 1, &len);
+        if (text == NULL) {
+            continue;
+        }
+        bool match = fuzzy ? fuzzyMatch(text, len, pattern) : substringMatch(text, len, pattern, plen);
+        if (match) {
+            results[found++] = id - 1;
+        }
+    }
+    return found;
+}
+
+void hist_search_free() {
+    for (size_t i = 0; i < postingCapacity; i++) {
+        free(postings[i].ids);
+    }
+    free(postings);
+    free(masks);
+    free(searchQuery);
+    searchQuery = NULL;
+    postings = NULL;
+    masks = NULL;
+    postingCapacity = 0;
+    postingUsed = 0;
+    indexedCount = 0;
+}
+
+// Function to put the newest match for searchQuery older than before on the
+// line, returns false and leaves the line alone when there is none.
+static bool showMatch(size_t before) {
+    size_t id;
+    if (hist_search(searchQuery, false, before, &id, 1) == 0) {
+        return false;
+    }
+    size_t len;
+    const char *text = hist_get(id, &len);
+    if (text == NULL) {
+        return false;
+    }
+    char *line = strndup(text, len);
+    if (line == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    rl_replace_line(line, 0);
+    rl_point = rl_end;
+    free(line);
+    searchBefore = id;
+    return true;
+}
+
+// Function bound to Ctrl-R. Starts from what is on the line and reads keys
+// itself: typing narrows the query, backspace widens it, Ctrl-R moves to the
+// next older match and Ctrl-G puts the original line back. Any other key ends
+// the search and then runs as usual, so Enter accepts the match.
+int hist_reverse_search(int count, int key) {
+    UNUSED(count);
+    UNUSED(key);
+
+    char *saved = strdup(rl_line_buffer);
+    size_t qlen = strlen(rl_line_buffer);
+    size_t qcap = qlen + 16;
+    free(searchQuery);
+    searchQuery = malloc(qcap);
+    if (saved == NULL || searchQuery == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(searchQuery, rl_line_buffer, qlen + 1);
+    searchBefore = hist_count();
+    if (!showMatch(searchBefore)) {
+        rl_ding();
+    }
+
+    for (;;) {
+        rl_message("(reverse-i-search)`%s': ", searchQuery);
+        int c = rl_read_key();
+        if (c <= 0) {
+            break;
+        }
+        bool found = true;
+        if (c == CTRL('r')) {
+            found = showMatch(searchBefore);
+        } else if (c == CTRL('g')) {
+            rl_replace_line(saved, 0);
+            rl_point = rl_end;
+            break;
+        } else if (c == RUBOUT || c == CTRL('h')) {
+            if (qlen > 0) {
+                searchQuery[--qlen] = '\0';
+                found = showMatch(hist_count());
+            }
+        } else if (isprint(c)) {
+            if (qlen + 1 >= qcap) {
+                qcap *= 2;
+                searchQuery = realloc(searchQuery, qcap);
+                if (searchQuery == NULL) {
+                    perror("Malloc failed");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            searchQuery[qlen++] = (char)c;
+            searchQuery[qlen] = '\0';
+            // the entry on the line may still match the longer query
+            size_t from = searchBefore < hist_count() ? searchBefore + 1 : searchBefore;
+            found = showMatch(from);
+        } else {
+            rl_execute_next(c);
+            break;
+        }
+        if (!found) {
+            rl_ding();
+        }
+    }
+
+    rl_clear_message();
+    free(saved);
+    return 0;
+}
+
+/*
+History search end-----------------------------------------
+*/
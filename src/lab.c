@@ -1,13 +1,23 @@
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "../src/lab.h"
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <pwd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <termios.h>
 
@@ -15,18 +25,50 @@
 // objects (structs for c)
 typedef struct {
     int id;
-    pid_t pid;
+    pid_t pid; // 0 while the job is still pending
     char command[300]; // command typed
-    char status[8]; // running or done
+    char status[16]; // pending, running or done
+    char **args; // copy of the args, kept until a pending job is started
+    int *after; // ids of jobs that must finish successfully first
+    int afterCount;
+    bool throttled; // stopped by the shell because of memory/cpu pressure
+    uint64_t runtimeKey; // runtime history key of the command
+    int exitStatus; // raw status from wait4 once done
+    struct timespec start; // wall clock when launched
+    struct timespec end; // wall clock when reaped
+    struct rusage usage; // filled in by wait4 when the job is reaped
 } Job;
 
 // global vars
 int shell_terminal;
 
-#define MAX_JOBS 100 // 100 is the max jobs for now
-Job jobList[MAX_JOBS];
+Job *jobList = NULL; // grows as needed, queued jobs can be many
 int jobCount = 0;
+int jobCapacity = 0;
 int nextJobID = 1; // keep track of id to use
+int jobLimit = 0; // max background jobs running at once, 0 means nproc
+bool jobShortestFirst = false; // start the queued job with the lowest estimate first
+
+// outcome of every job id that has finished, so dependencies still resolve
+// after the job has been printed and removed from the table
+char *jobOutcome = NULL;
+int jobOutcomeSize = 0;
+
+// pressure stall (PSI) admission control, thresholds are avg10 percentages
+// from /proc/pressure and 0 turns a check off
+double psiCpuLimit = 0;
+double psiMemLimit = 0;
+bool psiStopJobs = false; // SIGSTOP running jobs while over the limit
+struct timespec psiLastRead;
+bool psiLastHigh = false;
+bool psiIgnored = false; // set at exit, the queue runs out whatever the pressure
+
+// set from the SIGCHLD handler so the prompt can reap without waiting for enter
+volatile sig_atomic_t childExited = 0;
+
+// totals of every child reaped this session (fg and bg) for times
+struct rusage sessionUsage;
+int sessionChildren = 0;
 
 
 char *get_prompt(const char *env) {
@@ -69,39 +111,87 @@ int change_dir(char **dir) {
     return -1; // error if it gets here
 }
 
-char **cmd_parse(const char *line) {
-    char *lineCopy = strdup(line); // dup line
-    if (lineCopy == NULL) {
-        perror("strdup failed");
-        exit(EXIT_FAILURE);
+// Function to skip to the ) that closes a group whose ( is before p
+static const char *closeGroup(const char *p, char open, char close) {
+    int depth = 1;
+    while (*p != '\0') {
+        if (*p == open) {
+            depth++;
+        } else if (*p == close && --depth == 0) {
+            return p + 1;
+        }
+        p = cmd_skip(p);
     }
+    return p;
+}
 
+const char *cmd_skip(const char *p) {
+    if (*p == '\\') {
+        return p[1] != '\0' ? p + 2 : p + 1;
+    }
+    if (*p == '\'') {
+        const char *close = strchr(p + 1, '\'');
+        return close != NULL ? close + 1 : p + strlen(p);
+    }
+    if (*p == '`') {
+        for (p++; *p != '\0' && *p != '`'; p += *p == '\\' && p[1] != '\0' ? 2 : 1) {
+        }
+        return *p != '\0' ? p + 1 : p;
+    }
+    if (*p == '"') {
+        for (p++; *p != '\0' && *p != '"';) {
+            p = *p == '$' || *p == '`' || *p == '\\' ? cmd_skip(p) : p + 1;
+        }
+        return *p != '\0' ? p + 1 : p;
+    }
+    if (p[0] == '$' && (p[1] == '(' || p[1] == '{')) {
+        return closeGroup(p + 2, p[1], p[1] == '(' ? ')' : '}');
+    }
+    return p + 1;
+}
+
+const char *cmd_word_end(const char *p, const char *stops) {
+    const char *start = p;
+    size_t nameLen = var_name_length(p);
+    if (nameLen > 0 && p[nameLen] == '[') {
+        const char *close = closeGroup(p + nameLen + 1, '[', ']'); // m[two words]=x
+        p = *close == '=' || (close[0] == '+' && close[1] == '=') ? close : p;
+    }
+    while (*p != '\0' && (strchr(stops, *p) == NULL || (*p == '(' && p > start && p[-1] == '='))) {
+        p = *p == '(' && p > start && p[-1] == '=' ? closeGroup(p + 1, '(', ')') : cmd_skip(p);
+    }
+    return p;
+}
+
+char **cmd_parse(const char *line) {
     int tokenCount = 0;
     int tokenCapacity = 10;
     char **args = malloc(tokenCapacity * sizeof(char *));
     if (args == NULL) {
         perror("Malloc failed");
-        free(lineCopy);
         exit(EXIT_FAILURE);
     }
 
-    char *token = strtok(lineCopy, " ");
-    while (token) {
-        if (tokenCount == tokenCapacity) {
+    // split on blanks, but not the ones in quotes, $( ), ${ } or name=( )
+    const char *p = line;
+    while (true) {
+        p += strspn(p, " \t\n");
+        if (*p == '\0') {
+            break;
+        }
+        const char *start = p;
+        p = cmd_word_end(p, " \t\n");
+        if (tokenCount + 1 >= tokenCapacity) {
             tokenCapacity *= 2;
             args = realloc(args, tokenCapacity * sizeof(char *));
             if (args == NULL) {
                 perror("Reallocating failed");
-                free(lineCopy);
                 exit(EXIT_FAILURE);
             }
         }
-        args[tokenCount++] = strdup(token);
-        token = strtok(NULL, " ");
+        args[tokenCount++] = strndup(start, p - start);
     }
     args[tokenCount] = NULL;
-
-    free(lineCopy);
     return args;
 }
 
@@ -137,9 +227,39 @@ char *trim_white(char *line) {
     return line;
 }
 
-// Function to print command history
+// Function to print command history, from the history file when it is open
+// so entries from before this session are included. Lines are collected in
+// a buffer and written in large chunks instead of one printf each.
 void print_history() {
     printf("Command History: \n");
+    fflush(stdout);
+
+    size_t count = hist_count();
+    if (count > 0) {
+        char buf[65536];
+        size_t used = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t len;
+            const char *line = hist_get(i, &len);
+            if (line == NULL) {
+                continue; // unreadable entry, the numbers still match !n
+            }
+            if (used + len + 32 > sizeof(buf)) {
+                fwrite(buf, 1, used, stdout);
+                used = 0;
+            }
+            if (len + 32 > sizeof(buf)) {
+                printf("%zu: %.*s\n", i + 1, (int)len, line); // too long to buffer
+                continue;
+            }
+            used += snprintf(buf + used, sizeof(buf) - used, "%zu: ", i + 1);
+            memcpy(buf + used, line, len);
+            used += len;
+            buf[used++] = '\n';
+        }
+        fwrite(buf, 1, used, stdout);
+        return;
+    }
 
     HIST_ENTRY **historyList = history_list();
     if (historyList != NULL) {
@@ -149,71 +269,665 @@ void print_history() {
     }
 }
 
+// Function for history -s pattern and history -f pattern, prints matching
+// entries oldest first like the plain history listing
+void search_history(char **argv) {
+    bool fuzzy = strcmp(argv[1], "-f") == 0;
+    if (argv[2] == NULL) {
+        fprintf(stderr, "usage: history [-s|-f] pattern\n");
+        return;
+    }
+
+    // the parser split the pattern on spaces, put it back together
+    char pattern[1024] = "";
+    for (int i = 2; argv[i] != NULL; i++) {
+        if (i > 2) {
+            strncat(pattern, " ", sizeof(pattern) - strlen(pattern) - 1);
+        }
+        strncat(pattern, argv[i], sizeof(pattern) - strlen(pattern) - 1);
+    }
+
+    size_t max = 1000;
+    size_t *ids = malloc(max * sizeof(size_t));
+    size_t found = hist_search(pattern, fuzzy, hist_count(), ids, max);
+    for (size_t i = found; i > 0; i--) {
+        size_t len;
+        const char *line = hist_get(ids[i - 1], &len);
+        if (line == NULL) {
+            continue;
+        }
+        printf("%zu: %.*s\n", ids[i - 1] + 1, (int)len, line);
+    }
+    free(ids);
+}
+
+// Function to add a line to readline's history and the history file. Lines
+// other shells wrote before ours go into readline first so the order matches
+// the file.
+void sh_add_history(const char *line) {
+    if (hist_append(line) == 0) {
+        hist_sync_readline(); // frecency picks it up from the file
+    } else {
+        add_history(line);
+        frecency_add(line, strlen(line), time(NULL));
+    }
+}
+
 
 /*
 Job handling start-----------------------------------------
 */
 
-// Function to add a job to the list
-void addJob(pid_t pid, char *command) {
-    if (jobCount < MAX_JOBS) {
-        jobList[jobCount].id = nextJobID++;
-        jobList[jobCount].pid = pid;
+// Function to copy an arg list so a queued job can outlive the parsed line
+char **copyArgs(char **args) {
+    int n = 0;
+    while (args[n] != NULL) {
+        n++;
+    }
 
-        snprintf(jobList[jobCount].command, sizeof(jobList[jobCount].command), "%s", command);
-        snprintf(jobList[jobCount].status, sizeof(jobList[jobCount].status), "Running"); // set status to running
+    char **copy = malloc((n + 1) * sizeof(char *));
+    if (copy == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        copy[i] = strdup(args[i]);
+    }
+    copy[n] = NULL;
+    return copy;
+}
 
-        printf("[%d] %d %s\n", jobList[jobCount].id, pid, command);
-        jobCount++;
-    } else {
-        fprintf(stderr, "Too many jobs\n");
+// Function to get the background job limit, defaults to the number of cpus
+int getJobLimit() {
+    if (jobLimit > 0) {
+        return jobLimit;
     }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
 }
 
-// Function to remove a job from the list
-void removeJob(pid_t pid) {
+int pendingJobCount() {
+    int pending = 0;
     for (int i = 0; i < jobCount; i++) {
-        if (jobList[i].pid == pid) {
-            // shifting
-            for (int j = i; j < jobCount - 1; j++) {
-                jobList[j] = jobList[j + 1];
-            }
+        if (strcmp(jobList[i].status, "Pending") == 0) {
+            pending++;
+        }
+    }
+    return pending;
+}
+
+int runningJobCount() {
+    int running = 0;
+    for (int i = 0; i < jobCount; i++) {
+        if (strcmp(jobList[i].status, "Running") == 0) {
+            running++;
+        }
+    }
+    return running;
+}
+
+// Function to add a job to the list, it starts pending until the queue runs it
+Job *addJob(char **args, char *command) {
+    if (jobCount == jobCapacity) {
+        int newCapacity = jobCapacity ? jobCapacity * 2 : 16;
+        Job *grown = realloc(jobList, newCapacity * sizeof(Job));
+        if (grown == NULL) {
+            fprintf(stderr, "Too many jobs\n");
+            return NULL;
+        }
+        jobList = grown;
+        jobCapacity = newCapacity;
+    }
+
+    Job *job = &jobList[jobCount++];
+    memset(job, 0, sizeof(*job));
+    job->id = nextJobID++;
+    job->args = copyArgs(args);
+    job->runtimeKey = runtime_key(args);
+    snprintf(job->command, sizeof(job->command), "%s", command);
+    snprintf(job->status, sizeof(job->status), "Pending");
+    return job;
+}
+
+void setJobOutcome(int id, char outcome) {
+    if (id >= jobOutcomeSize) {
+        int newSize = jobOutcomeSize ? jobOutcomeSize : 64;
+        while (newSize <= id) {
+            newSize *= 2;
+        }
+        char *grown = realloc(jobOutcome, newSize);
+        if (grown == NULL) {
+            return;
+        }
+        memset(grown + jobOutcomeSize, JOB_UNKNOWN, newSize - jobOutcomeSize);
+        jobOutcome = grown;
+        jobOutcomeSize = newSize;
+    }
+    jobOutcome[id] = outcome;
+}
+
+char getJobOutcome(int id) {
+    return id < jobOutcomeSize ? jobOutcome[id] : JOB_UNKNOWN;
+}
+
+Job *findJob(int id) {
+    for (int i = 0; i < jobCount; i++) {
+        if (jobList[i].id == id) {
+            return &jobList[i];
+        }
+    }
+    return NULL;
+}
+
+// finished jobs are the ones printing jobs should remove
+bool jobFinished(const Job *job) {
+    return strcmp(job->status, "Done") == 0 || strcmp(job->status, "Skipped") == 0;
+}
+
+// Function to check a pending job's dependencies, returns JOB_SUCCEEDED when
+// it can start, JOB_FAILED when one of them failed, JOB_UNKNOWN to keep waiting
+char checkJobDeps(const Job *job) {
+    return sched_deps(job->after, job->afterCount, jobOutcome, jobOutcomeSize);
+}
+
+// Function to remove a job from the list
+void removeJob(int index) {
+    cmd_free(jobList[index].args);
+    free(jobList[index].after);
 
-            jobCount--;
+    // shifting
+    memmove(&jobList[index], &jobList[index + 1], (jobCount - index - 1) * sizeof(Job));
+    jobCount--;
+}
+
+double timevalSeconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+double elapsedSeconds(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Function to add a reaped child's usage to the session totals
+void addSessionUsage(const struct rusage *usage) {
+    sched_add_usage(&sessionUsage, usage);
+    sessionChildren++;
+}
+
+// Function to tell the user a command could not be run, with the closest
+// command names when it does not exist
+static void reportExecError(const char *name, int err) {
+    if (err != ENOENT) {
+        fprintf(stderr, "%s: %s\n", name, strerror(err));
+        return;
+    }
+    fprintf(stderr, "%s: command not found\n", name);
+    const char *close[5];
+    size_t count = strchr(name, '/') ? 0 : path_suggest(name, close, 5);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(stderr, "%s %s", i == 0 ? "Did you mean:" : ",", close[i]);
+    }
+    if (count > 0) {
+        fprintf(stderr, "\n");
+    }
+}
+
+// Function to fork and exec a command in its own process group
+pid_t forkCommand(char **args, int bg) {
+    char path[PATH_MAX];
+    const char *resolved = path_lookup(args[0], path, sizeof(path)); // before the fork, so the child keeps it
+
+    // the child writes errno here if exec fails, a successful exec closes it
+    int status[2];
+    if (pipe2(status, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        fprintf(stderr, "Fork failed");
+        close(status[0]);
+        close(status[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // child
+        close(status[0]);
+        pid_t child = getpid();
+        setpgid(child, child);
+        if (!bg) {
+            tcsetpgrp(shell_terminal, child); // do not give away control
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        if (resolved != NULL) {
+            execv(resolved, args); // falls through to execvp if it went away
+        }
+        execvp(args[0], args);
+
+        int err = errno;
+        ssize_t written = write(status[1], &err, sizeof(err));
+        UNUSED(written);
+        _exit(err == ENOENT ? 127 : 126); // what other shells use for not found and not runnable
+    }
+
+    // parent
+    setpgid(pid, pid);  // put child in own process group
+    close(status[1]);
+    int err;
+    ssize_t n;
+    while ((n = read(status[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+    }
+    close(status[0]);
+    if (n == sizeof(err)) {
+        reportExecError(args[0], err);
+    }
+    return pid;
+}
+
+// Function to start a pending job in the background
+void startJob(Job *job) {
+    pid_t pid = forkCommand(job->args, 1);
+    if (pid < 0) {
+        return; // stays pending, the next reap will try again
+    }
+
+    job->pid = pid;
+    snprintf(job->status, sizeof(job->status), "Running"); // set status to running
+    clock_gettime(CLOCK_REALTIME, &job->start);
+    cmd_free(job->args);
+    job->args = NULL;
+
+    printf("[%d] %d %s\n", job->id, pid, job->command);
+}
+
+// Function to read the some avg10 value from a /proc/pressure file, -1 if
+// the kernel does not have PSI
+double readPressure(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    double avg10 = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "some avg10=%lf", &avg10) == 1) {
             break;
         }
     }
+    fclose(f);
+    return avg10;
+}
+
+bool psiEnabled() {
+    return psiCpuLimit > 0 || psiMemLimit > 0;
+}
+
+// Function to check if pressure is over the limits. The files are only read
+// every 250ms, the kernel's avg10 does not move faster than that anyway.
+bool pressureHigh() {
+    if (!psiEnabled() || psiIgnored) {
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsedSeconds(&psiLastRead, &now) < 0.25) {
+        return psiLastHigh;
+    }
+    psiLastRead = now;
+
+    double cpu = psiCpuLimit > 0 ? readPressure("/proc/pressure/cpu") : -1;
+    double mem = psiMemLimit > 0 ? readPressure("/proc/pressure/memory") : -1;
+    psiLastHigh = sched_pressure_high(cpu, mem, psiCpuLimit, psiMemLimit);
+    return psiLastHigh;
+}
+
+// Function to pick the running job to stop first, highest nice value and
+// then the newest job
+int lowestPriorityJob() {
+    int *index = malloc((jobCount + 1) * sizeof(int));
+    int *nice = malloc((jobCount + 1) * sizeof(int));
+    if (index == NULL || nice == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int count = 0;
+    for (int i = 0; i < jobCount; i++) {
+        if (strcmp(jobList[i].status, "Running") != 0) {
+            continue;
+        }
+        errno = 0;
+        nice[count] = getpriority(PRIO_PROCESS, jobList[i].pid);
+        if (errno == 0) {
+            index[count++] = i;
+        }
+    }
+
+    int pick = sched_victim(nice, count);
+    pick = pick < 0 ? -1 : index[pick];
+    free(index);
+    free(nice);
+    return pick;
+}
+
+// Function to stop the lowest priority running job while pressure is high
+void throttleJobs() {
+    int i = lowestPriorityJob();
+    if (i >= 0 && kill(-jobList[i].pid, SIGSTOP) == 0) {
+        jobList[i].throttled = true;
+        snprintf(jobList[i].status, sizeof(jobList[i].status), "Stopped");
+        printf("[%d] %s\t %s\n", jobList[i].id, jobList[i].status, jobList[i].command);
+    }
+}
+
+// Function to continue the oldest job stopped for pressure, returns true if
+// one was resumed
+bool resumeThrottledJob() {
+    for (int i = 0; i < jobCount; i++) {
+        if (jobList[i].throttled && kill(-jobList[i].pid, SIGCONT) == 0) {
+            jobList[i].throttled = false;
+            snprintf(jobList[i].status, sizeof(jobList[i].status), "Running");
+            printf("[%d] Continued\t %s\n", jobList[i].id, jobList[i].command);
+            return true;
+        }
+    }
+    return false;
+}
+
+int throttledJobCount() {
+    int stopped = 0;
+    for (int i = 0; i < jobCount; i++) {
+        if (jobList[i].throttled) {
+            stopped++;
+        }
+    }
+    return stopped;
+}
+
+// estimate used for commands that were never timed while sorting the queue,
+// the average of the ones that were so they neither jump nor starve it
+double unknownEstimate = 0;
+
+double jobEstimate(const Job *job) {
+    double estimate = runtime_estimate(job->runtimeKey);
+    return estimate >= 0 ? estimate : unknownEstimate;
+}
+
+// qsort compare for job table indices, shortest estimate first then by id
+int compareJobEstimates(const void *a, const void *b) {
+    const Job *ja = &jobList[*(const int *)a];
+    const Job *jb = &jobList[*(const int *)b];
+    double ea = jobEstimate(ja);
+    double eb = jobEstimate(jb);
+    if (ea != eb) {
+        return ea < eb ? -1 : 1;
+    }
+    return ja->id - jb->id;
+}
+
+void sortShortestFirst(int *ready, int readyCount) {
+    double total = 0;
+    int known = 0;
+    for (int r = 0; r < readyCount; r++) {
+        double e = runtime_estimate(jobList[ready[r]].runtimeKey);
+        if (e >= 0) {
+            total += e;
+            known++;
+        }
+    }
+    unknownEstimate = known ? total / known : 0;
+    qsort(ready, readyCount, sizeof(int), compareJobEstimates);
+}
+
+// Function to start queued jobs, oldest first or shortest first with job sjf
+// on, while under the limit. Jobs can only depend on older ids so one pass in
+// table order is a topological order, and a failed dependency skips
+// everything after it in the chain.
+void startPendingJobs() {
+    bool high = pressureHigh();
+    if (sched_should_throttle(high, psiStopJobs, runningJobCount())) {
+        throttleJobs(); // one is always left running so the queue keeps moving
+    }
+
+    // stopped jobs still hold their slot, they get it back before new ones
+    int stopped = throttledJobCount();
+    int slots = sched_slots(getJobLimit(), runningJobCount(), stopped, high);
+    if (sched_should_resume(high, stopped)) {
+        resumeThrottledJob();
+    }
+
+    // skip jobs whose dependencies failed and collect the ones ready to go
+    int *ready = malloc(jobCount * sizeof(int));
+    int readyCount = 0;
+    for (int i = 0; i < jobCount; i++) {
+        if (strcmp(jobList[i].status, "Pending") != 0) {
+            continue;
+        }
+
+        char deps = checkJobDeps(&jobList[i]);
+        if (deps == JOB_FAILED) {
+            snprintf(jobList[i].status, sizeof(jobList[i].status), "Skipped");
+            setJobOutcome(jobList[i].id, JOB_FAILED);
+            printf("[%d] %s\t %s\n", jobList[i].id, jobList[i].status, jobList[i].command);
+        } else if (deps == JOB_SUCCEEDED) {
+            ready[readyCount++] = i;
+        }
+    }
+
+    if (jobShortestFirst && readyCount > 1 && slots > 0) {
+        sortShortestFirst(ready, readyCount);
+    }
+
+    for (int r = 0; r < readyCount && slots > 0; r++) {
+        startJob(&jobList[ready[r]]);
+        if (jobList[ready[r]].pid > 0) {
+            slots--;
+        }
+    }
+    free(ready);
 }
 
 // Function to check for completed background jobs and mark as done if so
-void checkForBackgroundJobs() {
+int reapBackgroundJobs() {
     int status;
     pid_t pid;
+    int reaped = 0;
 
+    childExited = 0;
     for (int i = 0; i < jobCount; i++) {
-        pid = waitpid(jobList[i].pid, &status, WNOHANG);
-        
+        if (jobList[i].pid == 0 || jobFinished(&jobList[i])) {
+            continue; // not started or already reaped, nothing to wait for
+        }
+
+        pid = wait4(jobList[i].pid, &status, WNOHANG, &jobList[i].usage);
+
         if (pid > 0) {
             // Process has finished
+            clock_gettime(CLOCK_REALTIME, &jobList[i].end);
+            jobList[i].exitStatus = status;
+            runtime_record(jobList[i].runtimeKey, elapsedSeconds(&jobList[i].start, &jobList[i].end));
+            bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            setJobOutcome(jobList[i].id, ok ? JOB_SUCCEEDED : JOB_FAILED);
+            addSessionUsage(&jobList[i].usage);
+            jobList[i].throttled = false;
             snprintf(jobList[i].status, sizeof(jobList[i].status), "Done");
             printf("[%d] %s\t %s\n", jobList[i].id, jobList[i].status, jobList[i].command);
+            reaped++;
         }
     }
+
+    // finished jobs free up slots for the queue
+    startPendingJobs();
+    return reaped;
 }
 
-void printJobs() {
+void checkForBackgroundJobs() {
+    reapBackgroundJobs();
+}
+
+// Function called by readline while it waits for input so queued jobs start
+// as soon as running ones finish, not only when enter is pressed
+int jobEventHook() {
+    bool reap = childExited && pendingJobCount() > 0;
+
+    // pressure can drop or rise without any child exiting, so it is polled
+    // and the prompt is only redrawn when a job is about to stop or start
+    if (!reap && psiEnabled()) {
+        bool high = pressureHigh();
+        int running = runningJobCount();
+        int stopped = throttledJobCount();
+        int slots = sched_slots(getJobLimit(), running, stopped, high);
+        reap = sched_should_throttle(high, psiStopJobs, running) ||
+               sched_should_resume(high, stopped) || (pendingJobCount() > 0 && slots > 0);
+    }
+    if (!reap) {
+        return 0;
+    }
+
+    rl_clear_visible_line(); // any messages go where the prompt was
+    reapBackgroundJobs();
+    rl_on_new_line();
+    rl_redisplay();
+    return 0;
+}
+
+int sh_event_hook() {
+    hist_sync_readline();
+    frecency_update(20000); // score the history file a chunk at a time while idle
+    hist_expand_update(20000);
+    return jobEventHook();
+}
+
+// Function to continue every job stopped for pressure
+void resumeAllThrottledJobs() {
     for (int i = 0; i < jobCount; i++) {
-        if (strcmp(jobList[i].status, "Done") == 0) {
-            // done
-            printf("[%d] %s\t %s\n", jobList[i].id, jobList[i].status, jobList[i].command);
+        if (jobList[i].throttled) {
+            kill(-jobList[i].pid, SIGCONT);
+            jobList[i].throttled = false;
+            snprintf(jobList[i].status, sizeof(jobList[i].status), "Running");
+            printf("[%d] Continued\t %s\n", jobList[i].id, jobList[i].command);
+        }
+    }
+}
 
-            // If the job is done, remove it so it is gone from the list
-            removeJob(jobList[i].pid);
-            i--;
+// Function to block until every queued job has been started. Only used on
+// exit, so pressure no longer holds anything back: stopped jobs are continued
+// and queued ones start as slots free up, or we could wait forever.
+void drainJobQueue() {
+    sigset_t mask, old;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    psiIgnored = true;
+    resumeAllThrottledJobs();
+    while (true) {
+        sigprocmask(SIG_BLOCK, &mask, &old);
+        reapBackgroundJobs();
+        if (pendingJobCount() == 0 || runningJobCount() == 0) {
+            sigprocmask(SIG_SETMASK, &old, NULL);
+            break;
+        }
+        if (!childExited) {
+            sigsuspend(&old); // sleep until some child changes state
+        }
+        sigprocmask(SIG_SETMASK, &old, NULL);
+    }
+}
+
+void sigchldHandler(int sig) {
+    UNUSED(sig);
+    childExited = 1;
+}
+
+// Function to format the time left for a job, or nothing if never timed
+void formatEta(const Job *job, char *buf, size_t size) {
+    buf[0] = '\0';
+    double estimate = runtime_estimate(job->runtimeKey);
+    if (estimate < 0 || jobFinished(job)) {
+        return;
+    }
+
+    if (job->pid == 0) {
+        snprintf(buf, size, " (est %.1fs)", estimate);
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    double left = estimate - elapsedSeconds(&job->start, &now);
+    snprintf(buf, size, " (eta %.1fs)", left > 0 ? left : 0);
+}
+
+// Function to print one job with its resource usage, for jobs -l
+void printJobLong(const Job *job) {
+    struct timespec end = job->end;
+    if (strcmp(job->status, "Done") != 0) {
+        clock_gettime(CLOCK_REALTIME, &end); // still running, show time so far
+    }
+
+    char started[32];
+    struct tm tm;
+    time_t startSec = job->start.tv_sec;
+    localtime_r(&startSec, &tm);
+    strftime(started, sizeof(started), "%H:%M:%S", &tm);
+
+    char eta[48];
+    formatEta(job, eta, sizeof(eta));
+    printf("[%d] %d %s\t %s%s\n", job->id, job->pid, job->status, job->command, eta);
+    if (job->pid == 0) {
+        return; // not started, nothing measured yet
+    }
+    char usage[160];
+    sched_format_usage(usage, sizeof(usage), &job->usage, elapsedSeconds(&job->start, &end));
+    printf("    start %s  %s\n", started, usage);
+}
+
+// Function to print the shell and children totals like the times builtin
+void printTimes() {
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+
+    printf("shell:    user %.3fs  sys %.3fs\n",
+           timevalSeconds(&self.ru_utime), timevalSeconds(&self.ru_stime));
+    char usage[160];
+    sched_format_usage(usage, sizeof(usage), &sessionUsage, -1);
+    printf("children: %s  (%d reaped)\n", usage, sessionChildren);
+}
+
+void printJobs(bool longFormat) {
+    for (int i = 0; i < jobCount; i++) {
+        bool done = jobFinished(&jobList[i]);
+        char eta[48];
+        formatEta(&jobList[i], eta, sizeof(eta));
+
+        if (longFormat) {
+            printJobLong(&jobList[i]);
+        } else if (done) {
+            printf("[%d] %s\t %s\n", jobList[i].id, jobList[i].status, jobList[i].command);
+        } else if (jobList[i].pid == 0) {
+            // queued, no pid yet
+            printf("[%d] %s %s", jobList[i].id, jobList[i].status, jobList[i].command);
+            for (int d = 0; d < jobList[i].afterCount; d++) {
+                printf("%s%%%d", d == 0 ? " (after " : ",", jobList[i].after[d]);
+            }
+            printf("%s%s\n", jobList[i].afterCount > 0 ? ")" : "", eta);
         } else {
             // running still
-            printf("[%d] %d %s %s\n", jobList[i].id, jobList[i].pid, jobList[i].status, jobList[i].command);
+            printf("[%d] %d %s %s%s\n", jobList[i].id, jobList[i].pid, jobList[i].status, jobList[i].command, eta);
+        }
 
+        if (done) {
+            // If the job is done, remove it so it is gone from the list
+            removeJob(i);
+            i--;
         }
     }
 }
@@ -224,68 +938,693 @@ Job handling end-----------------------------------------
 
 
 // Function to runs command with args
-void runCommand(struct shell *sh, char **args, int bg, char *command) {
-    pid_t pid = fork();
+int runCommand(struct shell *sh, char **args, int bg, char *command) {
+    if (bg) {
+        // if wanted in background, queue it and start it if there is room
+        if (addJob(args, command) != NULL) {
+            startPendingJobs();
+        }
+        return 0;
+    }
 
+    struct timespec start, end;
+    clock_gettime(CLOCK_REALTIME, &start);
+    pid_t pid = forkCommand(args, bg);
     if (pid < 0) {
-        fprintf(stderr, "Fork failed");
+        return 1;
+    }
+
+    tcsetpgrp(shell_terminal, pid);  // give child terminal control
+
+    int status = 0;
+    struct rusage usage;
+    pid_t waited;
+    while ((waited = wait4(pid, &status, WUNTRACED, &usage)) < 0 && errno == EINTR) {
+    }
+    if (waited == pid && !WIFSTOPPED(status)) { //wait for chlid then run
+        addSessionUsage(&usage);
+        clock_gettime(CLOCK_REALTIME, &end);
+        runtime_record(runtime_key(args), elapsedSeconds(&start, &end));
+    }
+
+    // Give terminal control to shell again
+    tcsetpgrp(shell_terminal, sh->shell_pgid);
+    tcgetattr(shell_terminal, &sh->shell_tmodes);
+    tcsetattr(shell_terminal, TCSADRAIN, &sh->shell_tmodes);
+
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WIFSTOPPED(status) ? 128 + WSTOPSIG(status) : WEXITSTATUS(status);
+}
+
+// Function to parse a dependency list like %3,%5 into job ids
+int parseJobDeps(const char *list, int **deps) {
+    int count = 0;
+    int capacity = 4;
+    *deps = malloc(capacity * sizeof(int));
+
+    char *copy = strdup(list);
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (*tok == '%') {
+            tok++;
+        }
+        char *end;
+        long id = strtol(tok, &end, 10);
+        if (*tok == '\0' || *end != '\0' || id <= 0) {
+            fprintf(stderr, "job: bad job id '%s'\n", tok);
+            count = -1;
+            break;
+        }
+        if (findJob(id) == NULL && getJobOutcome(id) == JOB_UNKNOWN) {
+            fprintf(stderr, "job: %%%ld: no such job\n", id);
+            count = -1;
+            break;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *deps = realloc(*deps, capacity * sizeof(int));
+        }
+        (*deps)[count++] = id;
+    }
+
+    free(copy);
+    if (count < 0) {
+        free(*deps);
+        *deps = NULL;
+    }
+    return count;
+}
+
+// Function for job add [--after %a,%b] cmd, queues cmd to run in the
+// background once every listed job has finished successfully
+void jobAdd(char **argv) {
+    int i = 2;
+    int *deps = NULL;
+    int depCount = 0;
+
+    if (argv[i] != NULL && strcmp(argv[i], "--after") == 0) {
+        if (argv[i + 1] == NULL) {
+            fprintf(stderr, "job: --after needs a job list\n");
+            return;
+        }
+        depCount = parseJobDeps(argv[i + 1], &deps);
+        if (depCount < 0) {
+            return;
+        }
+        i += 2;
+    }
+    if (argv[i] == NULL) {
+        fprintf(stderr, "usage: job add [--after %%n,...] command\n");
+        free(deps);
         return;
     }
 
-    if (pid == 0) {
-        // child
-        pid_t child = getpid();
-        setpgid(child, child);
-        if (!bg) {
-            tcsetpgrp(shell_terminal, child); // do not give away control
+    // rebuild the command text for the job table
+    char command[300] = "";
+    for (int j = i; argv[j] != NULL; j++) {
+        if (j > i) {
+            strncat(command, " ", sizeof(command) - strlen(command) - 1);
         }
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        int ret = execvp(args[0], args);
+        strncat(command, argv[j], sizeof(command) - strlen(command) - 1);
+    }
 
-        if (ret == -1) {
-            fprintf(stderr, "Exec failed\n");
+    Job *job = addJob(&argv[i], command);
+    if (job == NULL) {
+        free(deps);
+        return;
+    }
+    job->after = deps;
+    job->afterCount = depCount;
+    int id = job->id;
+
+    startPendingJobs();
+    job = findJob(id); // the table may have moved
+    if (job != NULL && job->pid == 0) {
+        printf("[%d] %s %s\n", job->id, job->status, job->command);
+    }
+}
+
+// Function for job psi [cpu n] [mem n] [stop on|off], with no options it
+// prints the current pressure and settings
+void jobPsi(char **argv) {
+    for (int i = 2; argv[i] != NULL; i += 2) {
+        if (argv[i + 1] == NULL) {
+            fprintf(stderr, "job: psi %s needs a value\n", argv[i]);
+            return;
         }
-        exit(EXIT_FAILURE);
-    } else {
-        // parent
-        setpgid(pid, pid);  // put child in own process group
+        if (strcmp(argv[i], "cpu") == 0) {
+            psiCpuLimit = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "mem") == 0) {
+            psiMemLimit = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "stop") == 0) {
+            psiStopJobs = strcmp(argv[i + 1], "on") == 0;
+        } else {
+            fprintf(stderr, "usage: job psi [cpu n] [mem n] [stop on|off]\n");
+            return;
+        }
+    }
+
+    double cpu = readPressure("/proc/pressure/cpu");
+    double mem = readPressure("/proc/pressure/memory");
+    if (cpu < 0 && mem < 0) {
+        fprintf(stderr, "job: /proc/pressure is not available, psi limits have no effect\n");
+    }
+    if (argv[2] == NULL) {
+        printf("cpu %.2f (limit %.2f)  mem %.2f (limit %.2f)  stop %s\n",
+               cpu, psiCpuLimit, mem, psiMemLimit, psiStopJobs ? "on" : "off");
+    }
+
+    memset(&psiLastRead, 0, sizeof(psiLastRead)); // new limits apply right away
+    startPendingJobs();
+}
 
-        if (bg) {
-            // if wanted in background, put there
-            addJob(pid, command);
+// Function for the job builtin, job limit [n] shows or sets the queue limit,
+// job add queues a command with dependencies, job psi sets pressure limits
+// and job sjf orders the queue shortest job first
+void jobCommand(char **argv) {
+    if (argv[1] != NULL && strcmp(argv[1], "psi") == 0) {
+        jobPsi(argv);
+        return;
+    }
+    if (argv[1] != NULL && strcmp(argv[1], "sjf") == 0) {
+        if (argv[2] == NULL) {
+            printf("%s\n", jobShortestFirst ? "on" : "off");
         } else {
+            jobShortestFirst = strcmp(argv[2], "on") == 0;
+        }
+        return;
+    }
+    if (argv[1] != NULL && strcmp(argv[1], "add") == 0) {
+        jobAdd(argv);
+        return;
+    }
+    if (argv[1] != NULL && strcmp(argv[1], "limit") == 0) {
+        if (argv[2] == NULL) {
+            printf("%d\n", getJobLimit());
+            return;
+        }
+        int limit = atoi(argv[2]);
+        if (limit < 0) {
+            fprintf(stderr, "job: limit must be 0 (nproc) or more\n");
+            return;
+        }
+        jobLimit = limit;
+        startPendingJobs(); // a higher limit can start queued jobs now
+        return;
+    }
+    fprintf(stderr, "usage: job limit [n] | job add [--after %%n,...] command | job psi ... | job sjf [on|off]\n");
+}
+
+// Function for the ffind builtin, ffind [path...] [-name pattern] [-type f|d|l]
+// walks the paths on the walker's threads and prints what it finds sorted
+void findCommand(char **argv) {
+    const char *pattern = NULL;
+    int type = DT_UNKNOWN;
+    int starts = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-name") == 0 && argv[i + 1] != NULL) {
+            pattern = argv[++i];
+        } else if (strcmp(argv[i], "-type") == 0 && argv[i + 1] != NULL) {
+            char t = argv[++i][0];
+            type = t == 'f' ? DT_REG : t == 'd' ? DT_DIR : t == 'l' ? DT_LNK : -1;
+            if (type < 0) {
+                fprintf(stderr, "ffind: unknown type %s\n", argv[i]);
+                return;
+            }
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: ffind [path...] [-name pattern] [-type f|d|l]\n");
+            return;
+        } else {
+            starts++;
+        }
+    }
+
+    struct glob_result found = {0};
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-name") == 0 || strcmp(argv[i], "-type") == 0) {
+            i++;
+        } else if (walk_find(argv[i], pattern, type, &found) == 0 && access(argv[i], F_OK) != 0) {
+            fprintf(stderr, "ffind: %s: %s\n", argv[i], strerror(errno));
+        }
+    }
+    if (starts == 0) {
+        walk_find(".", pattern, type, &found);
+    }
+
+    // the paths are back to back in the arena, one write for all of them
+    for (size_t i = 0; i < found.size; i++) {
+        if (found.arena[i] == '\0') {
+            found.arena[i] = '\n';
+        }
+    }
+    fwrite(found.arena, 1, found.size, stdout);
+    fflush(stdout);
+    glob_result_free(&found);
+}
 
-            tcsetpgrp(shell_terminal, pid);  // give child terminal control
 
-            int status;
-            waitpid(pid, &status, WUNTRACED); //wait for chlid then run
+typedef struct {
+    const char **names;
+    size_t count;
+    size_t capacity;
+} AliasNames;
+
+static void collectAlias(const char *name, const char *value, void *ctx) {
+    UNUSED(value);
+    AliasNames *list = ctx;
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->names = realloc(list->names, list->capacity * sizeof(char *));
+    }
+    list->names[list->count++] = name;
+}
 
-            // Give terminal control to shell again
-            tcsetpgrp(shell_terminal, sh->shell_pgid);
-            tcgetattr(shell_terminal, &sh->shell_tmodes);
-            tcsetattr(shell_terminal, TCSADRAIN, &sh->shell_tmodes);
+static int compareAliasNames(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
 
+// Function to print an alias so it can be pasted back in
+void printAlias(const char *name) {
+    printf("alias %s='", name);
+    for (const char *p = alias_get(name); *p; p++) {
+        if (*p == '\'') {
+            fputs("'\\''", stdout);
+        } else {
+            putchar(*p);
         }
     }
+    printf("'\n");
 }
 
+// Function for the alias builtin, alias lists them all, alias name shows one
+// and alias name=value defines one
+void aliasCommand(char **argv) {
+    if (argv[1] == NULL) {
+        AliasNames list = {0};
+        alias_list(collectAlias, &list);
+        qsort(list.names, list.count, sizeof(char *), compareAliasNames);
+        for (size_t i = 0; i < list.count; i++) {
+            printAlias(list.names[i]);
+        }
+        free(list.names);
+        return;
+    }
+
+    for (int i = 1; argv[i] != NULL; i++) {
+        char *equals = strchr(argv[i], '=');
+        if (equals == NULL) {
+            if (alias_get(argv[i]) != NULL) {
+                printAlias(argv[i]);
+            } else {
+                fprintf(stderr, "alias: %s: not found\n", argv[i]);
+            }
+        } else if (equals == argv[i]) {
+            fprintf(stderr, "alias: %s: invalid alias name\n", argv[i]);
+        } else {
+            char *name = strndup(argv[i], equals - argv[i]);
+            alias_set(name, equals + 1);
+            free(name);
+        }
+    }
+}
+
+// Function for the unalias builtin, unalias name... or unalias -a for all
+void unaliasCommand(char **argv) {
+    if (argv[1] == NULL) {
+        fprintf(stderr, "usage: unalias [-a] name [name ...]\n");
+        return;
+    }
+    if (strcmp(argv[1], "-a") == 0) {
+        alias_free();
+        return;
+    }
+    for (int i = 1; argv[i] != NULL; i++) {
+        if (!alias_unset(argv[i])) {
+            fprintf(stderr, "unalias: %s: not found\n", argv[i]);
+        }
+    }
+}
+
+
+// Function for the builtins that only print, echo [-n] and pwd, so they can
+// print into a memory stream for $(...) as well as to stdout
+bool builtin_print(char **argv, FILE *out) {
+    if (strcmp(argv[0], "echo") == 0) {
+        int i = 1;
+        bool newline = true;
+        if (argv[1] != NULL && strcmp(argv[1], "-n") == 0) {
+            newline = false;
+            i++;
+        }
+        for (; argv[i] != NULL; i++) {
+            fputs(argv[i], out);
+            if (argv[i + 1] != NULL) {
+                fputc(' ', out);
+            }
+        }
+        if (newline) {
+            fputc('\n', out);
+        }
+        return true;
+    } else if (strcmp(argv[0], "pwd") == 0) {
+        char *cwd = getcwd(NULL, 0);
+        if (cwd == NULL) {
+            perror("pwd");
+            return true;
+        }
+        fprintf(out, "%s\n", cwd);
+        free(cwd);
+        return true;
+    }
+    return false;
+}
+
+// Function for the declare builtin, declare -a name makes an indexed array
+// and declare -A name an associative one, name=value assigns too
+void declareCommand(char **argv) {
+    bool array = false, assoc = false;
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        for (const char *flag = argv[i] + 1; *flag; flag++) {
+            if (*flag == 'a') {
+                array = true;
+            } else if (*flag == 'A') {
+                assoc = true;
+            } else {
+                fprintf(stderr, "declare: -%c: invalid option\n", *flag);
+                return;
+            }
+        }
+    }
+    for (; argv[i] != NULL; i++) {
+        size_t nameLen = var_name_length(argv[i]);
+        bool assignment = var_assignment(argv[i]);
+        if (nameLen == 0 || (!assignment && argv[i][nameLen] != '\0')) {
+            fprintf(stderr, "declare: `%s': not a valid identifier\n", argv[i]);
+            continue;
+        }
+        if (array || assoc) {
+            char *name = strndup(argv[i], nameLen);
+            var_declare(name, assoc);
+            free(name);
+        }
+        if (assignment) {
+            char *words[] = {argv[i], NULL};
+            sh_assign(words);
+        }
+    }
+}
+
+// Function to take the next field of a line for read, the rest of the line
+// with the blanks at the end removed when last is set
+static char *readField(const char **p, const char *end, const char *ifs, bool raw, bool last) {
+    while (*p < end && **p != '\0' && strchr(ifs, **p) != NULL && isspace((unsigned char)**p)) {
+        (*p)++;
+    }
+    char *field = malloc(end - *p + 1);
+    size_t len = 0, keep = 0;
+    while (*p < end) {
+        char c = **p;
+        if (!raw && c == '\\' && *p + 1 < end) {
+            field[len++] = (*p)[1]; // escaped, never a separator
+            keep = len;
+            *p += 2;
+            continue;
+        }
+        bool separator = c != '\0' && strchr(ifs, c) != NULL;
+        if (separator && !last) {
+            (*p)++;
+            while (*p < end && **p != '\0' && strchr(ifs, **p) != NULL && isspace((unsigned char)**p)) {
+                (*p)++;
+            }
+            break;
+        }
+        field[len++] = c;
+        keep = separator && isspace((unsigned char)c) ? keep : len;
+        (*p)++;
+    }
+    field[last ? keep : len] = '\0';
+    return field;
+}
+
+// Function for the read builtin, read [-r] [-d delim] [name ...] splits a
+// line of standard input on IFS into the names, REPLY gets it all if there
+// are none. 1 at the end of the input.
+int readCommand(char **argv) {
+    bool raw = false;
+    char delim = '\n';
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            raw = true;
+        } else if (strcmp(argv[i], "-d") == 0 && argv[i + 1] != NULL) {
+            delim = argv[++i][0]; // -d '' is NUL
+        } else if (strncmp(argv[i], "-d", 2) == 0 && argv[i][2] != '\0') {
+            delim = argv[i][2];
+        } else {
+            fprintf(stderr, "read: %s: invalid option\nusage: read [-r] [-d delim] [name ...]\n", argv[i]);
+            return 2;
+        }
+    }
+    // checked before anything is read, like bash
+    for (int n = i; argv[n] != NULL; n++) {
+        if (argv[n][0] == '\0' || var_name_length(argv[n]) != strlen(argv[n])) {
+            fprintf(stderr, "read: `%s': not a valid identifier\n", argv[n]);
+            return 1;
+        }
+    }
+
+    char *line;
+    size_t len;
+    int got = read_line(STDIN_FILENO, delim, &line, &len);
+    while (!raw && got == 1 && len > 0 && line[len - 1] == '\\') {
+        char *more; // a backslash at the end goes on to the next line
+        size_t moreLen;
+        got = read_line(STDIN_FILENO, delim, &more, &moreLen);
+        line = realloc(line, len + moreLen);
+        memcpy(line + len - 1, more, moreLen + 1);
+        len += moreLen - 1;
+        free(more);
+    }
+    if (got < 0) {
+        perror("read");
+    }
+
+    const char *ifs = var_get("IFS");
+    ifs = ifs != NULL ? ifs : " \t\n";
+    const char *p = line;
+    if (argv[i] == NULL) {
+        char *field = readField(&p, line + len, "", raw, true);
+        var_set("REPLY", field);
+        free(field);
+    }
+    for (; argv[i] != NULL; i++) {
+        char *field = readField(&p, line + len, ifs, raw, argv[i + 1] == NULL);
+        var_set(argv[i], field);
+        free(field);
+    }
+    free(line);
+    return got == 1 ? 0 : 1;
+}
+
+// Function to check a file for a unary test operator like -f
+static bool testFile(char op, const char *path) {
+    struct stat st;
+    if (op == 'L' || op == 'h') {
+        return lstat(path, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (op == 'r' || op == 'w' || op == 'x') {
+        return access(path, op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK) == 0;
+    }
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    switch (op) {
+    case 'f':
+        return S_ISREG(st.st_mode);
+    case 'd':
+        return S_ISDIR(st.st_mode);
+    case 's':
+        return st.st_size > 0;
+    case 'p':
+        return S_ISFIFO(st.st_mode);
+    default:
+        return true; // -e
+    }
+}
+
+// Function to parse an integer for test, false if it is not one
+static bool testNumber(const char *s, long long *n) {
+    char *end;
+    errno = 0;
+    *n = strtoll(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || errno != 0) {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        return false;
+    }
+    return true;
+}
+
+// Function to evaluate the arguments of test, 0 for true, 1 for false and 2
+// for an error
+static int testExpression(char **argv, int argc) {
+    for (int pass = 0; pass < 2 && argc > 3; pass++) {
+        const char *join = pass == 0 ? "-o" : "-a"; // -o binds looser than -a
+        for (int i = argc - 2; i > 0; i--) {
+            if (strcmp(argv[i], join) != 0) {
+                continue;
+            }
+            int left = testExpression(argv, i);
+            if (left == 2) {
+                return 2;
+            }
+            if ((left == 0) == (pass == 0)) {
+                return left; // true -o ..., false -a ...
+            }
+            return testExpression(argv + i + 1, argc - i - 1);
+        }
+    }
+    if (argc > 0 && strcmp(argv[0], "!") == 0) {
+        int result = testExpression(argv + 1, argc - 1);
+        return result == 2 ? 2 : !result;
+    }
+    if (argc == 0) {
+        return 1;
+    }
+    if (argc == 1) {
+        return argv[0][0] == '\0';
+    }
+    if (argc == 2) {
+        const char *op = argv[0];
+        if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') {
+            fprintf(stderr, "test: %s: unary operator expected\n", op);
+            return 2;
+        }
+        if (op[1] == 'n' || op[1] == 'z') {
+            return (argv[1][0] == '\0') == (op[1] == 'n');
+        }
+        if (strchr("efdsLhrwxp", op[1]) == NULL) {
+            fprintf(stderr, "test: %s: unary operator expected\n", op);
+            return 2;
+        }
+        return !testFile(op[1], argv[1]);
+    }
+    if (argc == 3) {
+        const char *a = argv[0], *op = argv[1], *b = argv[2];
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+            return strcmp(a, b) != 0;
+        }
+        if (strcmp(op, "!=") == 0) {
+            return strcmp(a, b) == 0;
+        }
+        if (strcmp(op, "<") == 0 || strcmp(op, ">") == 0) {
+            int order = strcmp(a, b);
+            return !(op[0] == '<' ? order < 0 : order > 0);
+        }
+        const char *ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        for (int i = 0; i < 6; i++) {
+            if (strcmp(op, ops[i]) != 0) {
+                continue;
+            }
+            long long x, y;
+            if (!testNumber(a, &x) || !testNumber(b, &y)) {
+                return 2;
+            }
+            bool results[] = {x == y, x != y, x < y, x <= y, x > y, x >= y};
+            return !results[i];
+        }
+        fprintf(stderr, "test: %s: binary operator expected\n", op);
+        return 2;
+    }
+    fprintf(stderr, "test: too many arguments\n");
+    return 2;
+}
+
+// Function for the test and [ builtins, the status
+int testCommand(char **argv) {
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n");
+            return 2;
+        }
+        argc--;
+    }
+    return testExpression(argv + 1, argc - 1);
+}
 
 bool do_builtin(struct shell *sh, char **argv) {
     if (strcmp(argv[0], "exit") == 0) {
+        if (argv[1] != NULL) {
+            sh->status = atoi(argv[1]) & 255;
+        }
         sh_destroy(sh);  // Call sh_destroy for exit
         return true;
+    }
+    sh->status = 0;
+    if (strcmp(argv[0], "true") == 0 || strcmp(argv[0], ":") == 0) {
+        return true;
+    } else if (strcmp(argv[0], "false") == 0) {
+        sh->status = 1;
+        return true;
+    } else if (strcmp(argv[0], "test") == 0 || strcmp(argv[0], "[") == 0) {
+        sh->status = testCommand(argv); // no fork for the conditions of loops
+        return true;
+    } else if (strcmp(argv[0], "shift") == 0) {
+        sh->status = script_shift(argv[1] != NULL ? strtoul(argv[1], NULL, 10) : 1);
+        return true;
+    } else if (strcmp(argv[0], "source") == 0 || strcmp(argv[0], ".") == 0) {
+        if (argv[1] == NULL) {
+            fprintf(stderr, "%s: filename argument required\n", argv[0]);
+            sh->status = 2;
+        } else {
+            sh->status = script_source(sh, argv[1]);
+        }
+        return true;
     } else if (strcmp(argv[0], "cd") == 0) {
-        change_dir(argv); // change directory
+        sh->status = change_dir(argv) == 0 ? 0 : 1; // change directory
         return true;
     } else if (strcmp(argv[0], "history") == 0) {
-        print_history();  // print cmd history
+        if (argv[1] != NULL && (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-f") == 0)) {
+            search_history(argv); // search the history file
+        } else if (argv[1] != NULL && strcmp(argv[1], "compact") == 0) {
+            hist_compact(true); // compress everything but the last block
+        } else {
+            print_history();  // print cmd history
+        }
         return true;
     } else if (strcmp(argv[0], "jobs") == 0) {
-        printJobs();  // Call printJobs for jobs
+        bool longFormat = argv[1] != NULL && strcmp(argv[1], "-l") == 0;
+        printJobs(longFormat);  // Call printJobs for jobs
+        return true;
+    } else if (strcmp(argv[0], "job") == 0) {
+        jobCommand(argv);
+        return true;
+    } else if (strcmp(argv[0], "times") == 0) {
+        printTimes();  // session cpu totals
+        return true;
+    } else if (strcmp(argv[0], "ffind") == 0) {
+        findCommand(argv); // parallel find
+        return true;
+    } else if (strcmp(argv[0], "read") == 0) {
+        sh->status = readCommand(argv);
+        return true;
+    } else if (strcmp(argv[0], "declare") == 0) {
+        declareCommand(argv);
+        return true;
+    } else if (builtin_print(argv, stdout)) {
+        fflush(stdout);
+        return true;
+    } else if (strcmp(argv[0], "alias") == 0) {
+        aliasCommand(argv);
+        return true;
+    } else if (strcmp(argv[0], "unalias") == 0) {
+        unaliasCommand(argv);
         return true;
     }
     return false;  // Return false if the command is not built-in
@@ -299,8 +1638,17 @@ void sh_init(struct shell *sh) {
     signal(SIGTTIN, SIG_IGN);
     signal(SIGTTOU, SIG_IGN);
 
+    // note finished children so the job queue can move while at the prompt
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchldHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
     shell_terminal = STDIN_FILENO;
     sh->shell_is_interactive = isatty(shell_terminal);
+    sh->status = 0;
 
     if (sh->shell_is_interactive) {
         // Ensure the shell is in the foreground
@@ -325,9 +1673,29 @@ void sh_init(struct shell *sh) {
 
 
 void sh_destroy(struct shell *sh) {
+    // queued jobs would never start once we are gone, so run them out first
+    drainJobQueue();
+
     // Clean up and exit
+    for (int i = 0; i < jobCount; i++) {
+        cmd_free(jobList[i].args);
+        free(jobList[i].after);
+    }
+    free(jobList);
+    free(jobOutcome);
+    runtime_free();
+    path_cache_free();
+    dir_cache_free();
+    alias_free();
+    script_functions_free();
+    var_free();
+    arith_cache_free();
+    param_cache_free();
+    read_cache_free();
+    frecency_free();
+    hist_close();
     tcsetattr(shell_terminal, TCSADRAIN, &sh->shell_tmodes);
-    exit(0);
+    exit(sh->status);
 }
 
 void parse_args(int argc, char **argv) {
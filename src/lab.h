@@ -2,19 +2,178 @@
 #define LAB_H
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #define lab_VERSION_MAJOR 1
 #define lab_VERSION_MINOR 0
 #define UNUSED(x) (void)x;
 
+// what became of a background job, its dependents wait on this
+#define JOB_UNKNOWN 0
+#define JOB_SUCCEEDED 1
+#define JOB_FAILED 2
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+  /**
+   * @brief A node of struct trie. value is set on the node a key ends at and
+   * best holds the best value in the subtree, both -1 when unset.
+   */
+  struct trie_node
+  {
+    int child;
+    int sibling;
+    int value;
+    int best;
+    unsigned char ch;
+  };
+
+  /**
+   * @brief A byte trie, node 0 is the root
+   */
+  struct trie
+  {
+    struct trie_node *nodes;
+    size_t count;
+    size_t capacity;
+  };
+
+  /**
+   * @brief A node of struct bk_tree, children are a sibling list and each
+   * child has its edit distance to the parent
+   */
+  struct bk_node
+  {
+    const char *word;
+    int child;
+    int sibling;
+    int distance;
+  };
+
+  /**
+   * @brief A BK-tree of words by edit distance, node 0 is the root
+   */
+  struct bk_tree
+  {
+    struct bk_node *nodes;
+    size_t count;
+    size_t capacity;
+  };
+
+  /**
+   * @brief One op of a compiled glob pattern, a literal run (arg is the
+   * offset in literals), ?, a class (arg is the class index) or *
+   */
+  struct glob_op
+  {
+    uint8_t type;
+    uint32_t arg;
+    uint32_t len; // characters it matches, 0 for *
+  };
+
+  /**
+   * @brief A glob pattern compiled by glob_compile
+   */
+  struct glob_matcher
+  {
+    struct glob_op *ops;
+    size_t opCount;
+    size_t opCapacity;
+    char *literals;
+    size_t literalSize;
+    uint8_t (*classes)[32];
+    size_t classCount;
+    size_t minLength;
+    size_t prefixLength; // length of the literal the pattern starts with
+    int suffixOp; // literal op the pattern ends with after a *, or -1
+    bool hasStar;
+  };
+
+  /**
+   * @brief Paths from glob_run, NUL terminated in one arena
+   */
+  struct glob_result
+  {
+    char *arena;
+    size_t size;
+    size_t capacity;
+    size_t *offsets;
+    size_t count;
+    size_t offsetCapacity;
+  };
+
+  /**
+   * @brief A node of a parsed brace expression, a literal run of the word,
+   * a sequence of nodes, a {a,b} list of sequences or a {x..y} range
+   */
+  struct brace_node
+  {
+    uint8_t type;
+    int child; // first node of a sequence, first sequence of a list
+    int next; // next node in the same sequence or list
+    int cur; // sequence of a list being produced
+    size_t start; // literal text in the word
+    size_t len;
+    int64_t from; // range, letters are their character codes
+    int64_t to;
+    int64_t step;
+    int64_t at;
+    int width; // zero padded to this many digits
+    bool letters;
+  };
+
+  /**
+   * @brief The words of a brace expression, produced one at a time by
+   * brace_next into a buffer that is reused
+   */
+  struct brace_gen
+  {
+    char *word;
+    struct brace_node *nodes;
+    size_t count;
+    size_t capacity;
+    char *buf;
+    size_t bufLen;
+    size_t bufCapacity;
+    bool started;
+    bool done;
+  };
+
+  struct walk_dir;
+
+  /**
+   * @brief Called by walk_run for every directory with the directory open
+   * as fd. It calls walk_emit and walk_descend for the entries it wants.
+   * It runs on several threads at once.
+   */
+  typedef void (*walk_visit_fn)(struct walk_dir *dir, int fd, uint64_t states, void *ctx);
+
+  /**
+   * @brief A directory listing from dir_list. names holds a d_type byte and
+   * then the name for every entry, order has the offsets of the names sorted.
+   */
+  struct dir_listing
+  {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char *names;
+    size_t namesSize;
+    uint32_t *order;
+    size_t count;
+    unsigned long used;
+  };
+
   struct shell
   {
     int shell_is_interactive;
@@ -22,6 +181,7 @@ extern "C"
     struct termios shell_tmodes;
     int shell_terminal;
     char *prompt;
+    int status; // of the last command, what $? gives
   };
 
 
@@ -67,6 +227,25 @@ extern "C"
    */
   void cmd_free(char ** line);
 
+  /**
+   * @brief Skip one character of a command line, or the whole of the quoted
+   * string, $( ), ${ } or backquoted command that starts there
+   *
+   * @param p where to start
+   * @return just past it
+   */
+  const char *cmd_skip(const char *p);
+
+  /**
+   * @brief Find the end of the word at p, the first character in stops
+   * that is not quoted or inside $( ), ${ }, name=( ) or name[ ]=
+   *
+   * @param p the start of the word
+   * @param stops the characters that end it
+   * @return where it ends
+   */
+  const char *cmd_word_end(const char *p, const char *stops);
+
   /**
    * @brief Trim the whitespace from the start and end of a string.
    * For example "   ls -a   " becomes "ls -a". This function modifies
@@ -86,7 +265,7 @@ extern "C"
    * true. If the first argument is NOT a built in command this function will
    * return false.
    *
-   * @param sh The shell
+   * @param sh The shell, its status is set when the command was a builtin
    * @param argv The command to check
    * @return True if the command was a built in command
    */
@@ -121,21 +300,1180 @@ extern "C"
   void parse_args(int argc, char **argv);
 
  /**
-   * @brief Run a command thats not builtin
+   * @brief Run a command thats not builtin. Background commands are added to
+   * the job table as Pending and started once fewer than the job limit
+   * (job limit n, default nproc) are running.
    *
    * @param args arguments
    * @param bg put in background or not
    * @param command command to run
+   * @return the exit status, 128 plus the signal if it was killed or
+   * stopped, 0 for a background command
+   */
+  int runCommand(struct shell *sh, char **args, int bg, char *command);
+
+ /**
+   * @brief Fork and exec a command in its own process group. If the exec
+   * fails the child exits 127 (not found) or 126 and the error is printed,
+   * with close command names when it was not found.
+   *
+   * @param args arguments
+   * @param bg leave the terminal with the shell
+   * @return the child's pid or -1 if it could not be forked
    */
-  void runCommand(struct shell *sh, char **args, int bg, char *command);
+  pid_t forkCommand(char **args, int bg);
 
  /**
-   * @brief Check for background jobs to report
+   * @brief Check for background jobs to report. Finished jobs are reaped
+   * with wait4 so their resource usage is kept in the job table.
    *
    */
   void checkForBackgroundJobs();
 
+ /**
+   * @brief Hook for readline's rl_event_hook. When a child has exited and
+   * jobs are queued this reaps and starts them without waiting for enter.
+   *
+   * @return always 0
+   */
+  int jobEventHook();
+
+ /**
+   * @brief The shell's rl_event_hook, runs jobEventHook and picks up lines
+   * other shells added to the history file while we wait at the prompt
+   *
+   * @return always 0
+   */
+  int sh_event_hook();
+
+ /**
+   * @brief Print the job table, done jobs are removed after printing
+   *
+   * @param longFormat also print cpu time, max rss, context switches and
+   * wall clock time for each job (jobs -l)
+   */
+  void printJobs(bool longFormat);
+
+ /**
+   * @brief Print the cpu time used by the shell and the totals of every
+   * child reaped this session, like the times builtin in bash
+   *
+   */
+  void printTimes();
+
+ /**
+   * @brief Add the usage of a reaped child to session totals. Times and
+   * context switches are summed, maxrss keeps the largest.
+   *
+   * @param total the totals
+   * @param usage from wait4
+   */
+  void sched_add_usage(struct rusage *total, const struct rusage *usage);
+
+ /**
+   * @brief Format resource usage the way jobs -l and times print it
+   *
+   * @param buf where to write
+   * @param size size of buf
+   * @param usage the usage
+   * @param wall wall clock seconds, left out when negative
+   * @return what snprintf returns
+   */
+  int sched_format_usage(char *buf, size_t size, const struct rusage *usage, double wall);
+
+ /**
+   * @brief How many queued jobs may start now
+   *
+   * @param limit the job limit
+   * @param running jobs running now
+   * @param stopped jobs stopped for pressure, they keep their slots
+   * @param high pressure is over the limit, nothing starts
+   * @return the number of jobs to start, never negative
+   */
+  int sched_slots(int limit, int running, int stopped, bool high);
+
+ /**
+   * @brief Decide whether a job's dependencies let it run
+   *
+   * @param after ids of the jobs it waits for
+   * @param afterCount how many
+   * @param outcomes outcome of each job id so far, ids past the end are unknown
+   * @param outcomeCount size of outcomes
+   * @return JOB_FAILED if one of them failed, JOB_UNKNOWN while one has not
+   * finished, JOB_SUCCEEDED when it can start
+   */
+  char sched_deps(const int *after, int afterCount, const char *outcomes, int outcomeCount);
+
+ /**
+   * @brief Check PSI readings against the job psi limits
+   *
+   * @param cpu cpu some avg10, -1 when it could not be read
+   * @param mem memory some avg10, -1 when it could not be read
+   * @param cpuLimit cpu limit, 0 turns the check off
+   * @param memLimit memory limit, 0 turns the check off
+   * @return true if either reading is at or over its limit
+   */
+  bool sched_pressure_high(double cpu, double mem, double cpuLimit, double memLimit);
+
+ /**
+   * @brief Decide whether to stop a running job for pressure
+   *
+   * @param high pressure is over the limit
+   * @param stopJobs job psi stop is on
+   * @param running jobs running now
+   * @return true to stop one, never the last one running
+   */
+  bool sched_should_throttle(bool high, bool stopJobs, int running);
+
+ /**
+   * @brief Decide whether to continue a job stopped for pressure
+   *
+   * @param high pressure is over the limit
+   * @param stopped jobs stopped for pressure
+   * @return true to continue one
+   */
+  bool sched_should_resume(bool high, int stopped);
+
+ /**
+   * @brief Pick the job to stop first
+   *
+   * @param nice nice value of each running job, oldest first
+   * @param count how many
+   * @return index of the highest nice value, the newest on a tie, -1 if
+   * count is 0
+   */
+  int sched_victim(const int *nice, int count);
+
+
+ /**
+   * @brief Normalize a command for the runtime history. The key is a hash of
+   * the basename of argv[0] and the first non option argument when it is a
+   * plain word, so "git commit -m x" and "git commit" share a key while
+   * "cat a.txt" and "cat b.txt" both become "cat".
+   *
+   * @param args the command
+   * @return the key, never 0 unless args is empty
+   */
+  uint64_t runtime_key(char **args);
+
+ /**
+   * @brief Record how long a command took. The table is loaded lazily from
+   * $LAB_RUNTIME_FILE or ~/.lab_runtimes and every update is appended to it.
+   *
+   * @param key from runtime_key
+   * @param seconds wall time of the run
+   */
+  void runtime_record(uint64_t key, double seconds);
+
+ /**
+   * @brief Get the expected wall time of a command
+   *
+   * @param key from runtime_key
+   * @return average seconds, or -1 if the command has never been timed
+   */
+  double runtime_estimate(uint64_t key);
+
+ /**
+   * @brief Free the in memory runtime table
+   *
+   */
+  void runtime_free();
+
+ /**
+   * @brief Open the persistent history file and its offset index, both are
+   * mmapped so opening does not depend on how many entries there are. With
+   * a NULL path $LAB_HISTFILE or ~/.lab_history is used.
+   *
+   * @param path the history file, the index is path.idx
+   * @return 0 on success, -1 if the file could not be opened
+   */
+  int hist_open(const char *path);
+
+ /**
+   * @brief Unmap and close the history file
+   *
+   */
+  void hist_close();
+
+ /**
+   * @brief Number of entries in the history file
+   *
+   * @return the count, 0 when no file is open
+   */
+  size_t hist_count();
+
+ /**
+   * @brief Get entry i (0 is the oldest). The text points into the mapped
+   * file or a decoded block and is NOT nul terminated. Copy it before
+   * looking up more than a few other entries.
+   *
+   * @param i the entry
+   * @param len set to the length of the entry
+   * @return the text or NULL if i is out of range
+   */
+  const char *hist_get(size_t i, size_t *len);
+
+ /**
+   * @brief Get the time an entry was added
+   *
+   * @param i the entry
+   * @return seconds since the epoch
+   */
+  int64_t hist_time(size_t i);
+
+ /**
+   * @brief Append a line to the history file with a single O_APPEND write,
+   * so shells sharing the file do not need to lock it
+   *
+   * @param line the line
+   * @return 0 on success, -1 on error
+   */
+  int hist_append(const char *line);
+
+ /**
+   * @brief Move older history entries into compressed blocks in path.blk and
+   * punch their bytes out of the history file. Runs on its own once 8192
+   * entries are uncompressed, the newest 1024 are always left alone.
+   *
+   * @param force compress every full block, waiting for other shells
+   * @return 0 on success, -1 on error
+   */
+  int hist_compact(bool force);
+
+ /**
+   * @brief Copy the newest entries of the history file into readline
+   *
+   * @param tail how many entries to copy
+   */
+  void hist_load_readline(size_t tail);
+
+ /**
+   * @brief Pick up entries other shells appended to the history file. Only
+   * does work when inotify reported a change, and only reads the new bytes.
+   *
+   * @return the number of new entries
+   */
+  size_t hist_sync();
+
+ /**
+   * @brief hist_sync and then copy every entry readline does not have yet
+   * into readline, in file order
+   *
+   * @return the number of entries added to readline
+   */
+  size_t hist_sync_readline();
+
+ /**
+   * @brief Search the history file, newest matches first. Substring queries
+   * of 3 or more bytes go through a trigram index that is built on the first
+   * search and extended with new entries after that.
+   *
+   * @param pattern the text to look for
+   * @param fuzzy match the pattern's characters in order, ignoring case,
+   * instead of as a substring
+   * @param before only look at entries older than this one
+   * @param results filled with matching entry ids
+   * @param max size of results
+   * @return the number of results
+   */
+  size_t hist_search(const char *pattern, bool fuzzy, size_t before, size_t *results, size_t max);
+
+ /**
+   * @brief Free the history search index
+   *
+   */
+  void hist_search_free();
+
+ /**
+   * @brief Readline command for Ctrl-R. Incremental search that starts from
+   * the current line, typed keys narrow the query, Ctrl-R goes to older
+   * matches, Ctrl-G cancels and any other key ends the search.
+   *
+   * @param count readline count
+   * @param key the key pressed
+   * @return 0
+   */
+  int hist_reverse_search(int count, int key);
+
+ /**
+   * @brief Apply history expansion (!!, !n, !-n, !prefix, !$ and ^old^new)
+   * to a line. Prints a message to stderr when an event is not found.
+   *
+   * @param line the line as typed
+   * @param result set to the expanded line when something was expanded,
+   * the caller frees it
+   * @return 1 if expanded, 0 if the line has nothing to expand, -1 on error
+   */
+  int hist_expand(const char *line, char **result);
+
+ /**
+   * @brief Add up to max history file entries to the !prefix trie
+   *
+   * @param max the most entries to do in this call
+   * @return how many were added
+   */
+  size_t hist_expand_update(size_t max);
+
+ /**
+   * @brief Free the !prefix trie
+   *
+   */
+  void hist_expand_free();
+
+ /**
+   * @brief Add a line to readline's history and to the history file
+   *
+   * @param line the line
+   */
+  void sh_add_history(const char *line);
+
+ /**
+   * @brief Worst case size of lz_compress output
+   *
+   * @param n input size
+   * @return bytes the output buffer needs
+   */
+  size_t lz_bound(size_t n);
+
+ /**
+   * @brief Compress with the shell's small LZ77 codec
+   *
+   * @param in the input
+   * @param n input size
+   * @param out at least lz_bound(n) bytes
+   * @return the compressed size
+   */
+  size_t lz_compress(const uint8_t *in, size_t n, uint8_t *out);
+
+ /**
+   * @brief Decompress lz_compress output
+   *
+   * @param in the compressed bytes
+   * @param n compressed size
+   * @param out buffer of exactly the original size
+   * @param outSize the original size
+   * @return true if the input decoded to exactly outSize bytes
+   */
+  bool lz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t outSize);
+
+ /**
+   * @brief Initialize an empty trie
+   *
+   * @param t the trie
+   */
+  void trie_init(struct trie *t);
+
+ /**
+   * @brief Free the nodes of a trie
+   *
+   * @param t the trie
+   */
+  void trie_free(struct trie *t);
+
+ /**
+   * @brief Find the node for a key or prefix
+   *
+   * @param t the trie
+   * @param key the key, does not need a terminator
+   * @param len length of key
+   * @return the node index or -1 if no key starts with it
+   */
+  int trie_find(const struct trie *t, const char *key, size_t len);
+
+ /**
+   * @brief Add a key, or change its value. Every node on the way down has
+   * its best set to value when better(value, best) says it is better.
+   *
+   * @param t the trie
+   * @param key the key
+   * @param len length of key
+   * @param value the value for the key, 0 or more
+   * @param better compares two values, NULL to not track best
+   * @param ctx passed to better
+   * @return the node the key ends at
+   */
+  int trie_insert(struct trie *t, const char *key, size_t len, int value,
+                  bool (*better)(int a, int b, void *ctx), void *ctx);
+
+ /**
+   * @brief Call fn for every key starting with prefix, in byte order
+   *
+   * @param t the trie
+   * @param prefix the prefix
+   * @param len length of prefix
+   * @param fn called with each key (nul terminated) and its value
+   * @param ctx passed to fn
+   */
+  void trie_walk(const struct trie *t, const char *prefix, size_t len,
+                 void (*fn)(const char *key, size_t len, int value, void *ctx), void *ctx);
+
+ /**
+   * @brief Count one use of a command for its frecency score
+   *
+   * @param line the command
+   * @param len length of line
+   * @param when time of the use in seconds since the epoch
+   */
+  void frecency_add(const char *line, size_t len, int64_t when);
+
+ /**
+   * @brief Score up to max history file entries that have not been scored
+   * yet, oldest first
+   *
+   * @param max the most entries to do in this call
+   * @return how many were scored
+   */
+  size_t frecency_update(size_t max);
+
+ /**
+   * @brief Get the highest scoring command that starts with prefix and is
+   * longer than it
+   *
+   * @param prefix what has been typed
+   * @param len length of prefix
+   * @return the whole command or NULL
+   */
+  const char *frecency_suggest(const char *prefix, size_t len);
+
+ /**
+   * @brief Free the frecency table
+   *
+   */
+  void frecency_free();
+
+ /**
+   * @brief Show frecency suggestions in grey after the cursor and bind right
+   * arrow, End and Ctrl-F to accept them
+   *
+   */
+  void frecency_install();
+
+  /**
+   * @brief Build the PATH cache if it is missing or PATH changed, otherwise
+   * apply the changes inotify reported in the PATH directories
+   *
+   */
+  void path_cache_refresh();
 
+ /**
+   * @brief Find the full path of a command the way execvp would
+   *
+   * @param name the command, NULL is returned if it has a /
+   * @param buf where to put the path
+   * @param size size of buf
+   * @return buf or NULL if the command is not in the cache
+   */
+  const char *path_lookup(const char *name, char *buf, size_t size);
+
+ /**
+   * @brief Call fn for every command name in PATH
+   *
+   * @param fn called with each name
+   * @param ctx passed to fn
+   */
+  void path_names(void (*fn)(const char *name, void *ctx), void *ctx);
+
+ /**
+   * @brief Complete the first word of the line from the PATH cache and the
+   * other words from the directory cache
+   *
+   */
+  void path_install_completion();
+
+ /**
+   * @brief Free the PATH cache and stop watching the directories
+   *
+   */
+  void path_cache_free();
+
+  /**
+   * @brief Get the listing of a directory, from the cache if the directory
+   * has not changed since it was read. The listing is valid until the next
+   * dir_list call.
+   *
+   * @param path the directory
+   * @return the listing sorted by name, or NULL if it cannot be read
+   */
+  const struct dir_listing *dir_list(const char *path);
+
+ /**
+   * @brief Find the names in a listing that start with prefix
+   *
+   * @param d the listing
+   * @param prefix the prefix
+   * @param len length of prefix
+   * @param first set to the index of the first match
+   * @return how many names match, they are next to each other
+   */
+  size_t dir_prefix(const struct dir_listing *d, const char *prefix, size_t len, size_t *first);
+
+ /**
+   * @brief Get name i of a listing
+   *
+   * @param d the listing
+   * @param i index in name order
+   * @return the name
+   */
+  const char *dir_name(const struct dir_listing *d, size_t i);
+
+ /**
+   * @brief Get the d_type of name i of a listing, DT_UNKNOWN if the file
+   * system does not give one
+   *
+   * @param d the listing
+   * @param i index in name order
+   * @return the d_type
+   */
+  unsigned char dir_type(const struct dir_listing *d, size_t i);
+
+ /**
+   * @brief Readline generator for file names from the directory cache
+   *
+   * @param text the word being completed
+   * @param state 0 on the first call
+   * @return the next match or NULL
+   */
+  char *dir_file_generator(const char *text, int state);
+
+ /**
+   * @brief Readline generator like dir_file_generator for directories only
+   *
+   * @param text the word being completed
+   * @param state 0 on the first call
+   * @return the next match or NULL
+   */
+  char *dir_dir_generator(const char *text, int state);
+
+ /**
+   * @brief Free every cached listing
+   *
+   */
+  void dir_cache_free();
+
+  /**
+   * @brief Set up an empty BK-tree
+   *
+   * @param t the tree
+   */
+  void bk_init(struct bk_tree *t);
+
+ /**
+   * @brief Free the nodes of a BK-tree, not the words
+   *
+   * @param t the tree
+   */
+  void bk_free(struct bk_tree *t);
+
+ /**
+   * @brief Levenshtein distance between two words
+   *
+   * @param a first word
+   * @param b second word
+   * @return the number of single character edits from a to b
+   */
+  int bk_distance(const char *a, const char *b);
+
+ /**
+   * @brief Add a word to a BK-tree, the word has to outlive the tree
+   *
+   * @param t the tree
+   * @param word the word
+   */
+  void bk_insert(struct bk_tree *t, const char *word);
+
+ /**
+   * @brief Find the words within tolerance edits of word, in no order.
+   * When there are more than max the closest max are returned.
+   *
+   * @param t the tree
+   * @param word what to look for
+   * @param tolerance the largest distance to return
+   * @param results the words found
+   * @param distances the distance of each word found
+   * @param max size of results and distances
+   * @return the number found
+   */
+  size_t bk_search(const struct bk_tree *t, const char *word, int tolerance,
+                   const char **results, int *distances, size_t max);
+
+ /**
+   * @brief Find PATH commands within two edits of name, closest first
+   *
+   * @param name the command that was not found
+   * @param results the names, valid until the PATH cache changes
+   * @param max size of results
+   * @return the number found
+   */
+  size_t path_suggest(const char *name, const char **results, size_t max);
+
+  /**
+   * @brief Compile a glob pattern with *, ?, [...] (with ranges, ! or ^ and
+   * [:class:]) and backslash escapes
+   *
+   * @param m the matcher to fill in, free it with glob_matcher_free
+   * @param pattern the pattern
+   * @param len length of pattern
+   */
+  void glob_compile(struct glob_matcher *m, const char *pattern, size_t len);
+
+ /**
+   * @brief Check if a whole string matches a compiled pattern
+   *
+   * @param m the matcher
+   * @param s the string
+   * @param len length of s
+   * @return true if it matches
+   */
+  bool glob_match(const struct glob_matcher *m, const char *s, size_t len);
+
+ /**
+   * @brief Free a compiled pattern
+   *
+   * @param m the matcher
+   */
+  void glob_matcher_free(struct glob_matcher *m);
+
+ /**
+   * @brief Check if a word has an unescaped *, ? or [...]
+   *
+   * @param word the word
+   * @return true if it is a glob pattern
+   */
+  bool glob_has_magic(const char *word);
+
+ /**
+   * @brief Add the paths matching a pattern to out, sorted. A segment of
+   * just ** matches any number of directories.
+   *
+   * @param pattern the pattern
+   * @param out where the paths go
+   * @return how many paths were added
+   */
+  size_t glob_run(const char *pattern, struct glob_result *out);
+
+ /**
+   * @brief Free the paths from glob_run
+   *
+   * @param r the result
+   */
+  void glob_result_free(struct glob_result *r);
+
+ /**
+   * @brief Add a path made of a, b and an optional / to a glob result
+   *
+   * @param r the result
+   * @param a first part
+   * @param alen length of a
+   * @param b second part
+   * @param blen length of b
+   * @param slash add a / on the end
+   */
+  void glob_result_add(struct glob_result *r, const char *a, size_t alen, const char *b, size_t blen,
+                       bool slash);
+
+ /**
+   * @brief Walk a tree on a pool of work stealing threads. The paths the
+   * visit function emits are added to out sorted, the same every run.
+   *
+   * @param start directory to start in, "" for the current one or ending in /
+   * @param states passed to visit for the start directory
+   * @param threads how many threads to use
+   * @param visit called for every directory
+   * @param ctx passed to visit
+   * @param out where the paths go
+   * @return how many paths were added
+   */
+  size_t walk_run(const char *start, uint64_t states, int threads, walk_visit_fn visit, void *ctx,
+                  struct glob_result *out);
+
+ /**
+   * @brief Emit an entry of the directory being visited
+   *
+   * @param dir the directory
+   * @param name the entry
+   * @param len length of name
+   * @param slash emit it with a / on the end
+   */
+  void walk_emit(struct walk_dir *dir, const char *name, size_t len, bool slash);
+
+ /**
+   * @brief Go into a subdirectory of the directory being visited
+   *
+   * @param dir the directory
+   * @param name the subdirectory
+   * @param len length of name
+   * @param states passed to visit for the subdirectory, not 0
+   * @param follow go into it if it is a symlink
+   */
+  void walk_descend(struct walk_dir *dir, const char *name, size_t len, uint64_t states, bool follow);
+
+ /**
+   * @brief Get the path of the directory being visited, "" or ending in /
+   *
+   * @param dir the directory
+   * @return the path
+   */
+  const char *walk_path(const struct walk_dir *dir);
+
+ /**
+   * @brief Call fn for every entry of a directory but . and .., read with
+   * getdents64
+   *
+   * @param fd the directory
+   * @param fn called with the name and d_type
+   * @param arg passed to fn
+   */
+  void walk_read(int fd, void (*fn)(const char *name, unsigned char type, void *arg), void *arg);
+
+ /**
+   * @brief Get the type of an entry, with statx only if the d_type from the
+   * directory is DT_UNKNOWN or a link to follow
+   *
+   * @param fd the directory
+   * @param name the entry
+   * @param type its d_type
+   * @param follow look through symlinks
+   * @return a DT_ value
+   */
+  int walk_type(int fd, const char *name, unsigned char type, bool follow);
+
+ /**
+   * @brief How many threads walk_run should use, the online CPUs up to 16
+   *
+   * @return the thread count
+   */
+  int walk_threads();
+
+ /**
+   * @brief Find files under start like find(1), in parallel
+   *
+   * @param start the starting path, it is included if it matches
+   * @param pattern glob for the file name or NULL for any
+   * @param type DT_ value to match or DT_UNKNOWN for any
+   * @param out where the paths go, sorted
+   * @return how many were found
+   */
+  size_t walk_find(const char *start, const char *pattern, int type, struct glob_result *out);
+
+ /**
+   * @brief Get a shell variable, or the environment variable if there is no
+   * shell variable with the name
+   *
+   * @param name the name, not NUL terminated
+   * @param len length of name
+   * @return the value or NULL
+   */
+  const char *var_lookup(const char *name, size_t len);
+
+ /**
+   * @brief Get a shell variable, or the environment variable if there is no
+   * shell variable with the name
+   *
+   * @param name the name
+   * @return the value or NULL
+   */
+  const char *var_get(const char *name);
+
+ /**
+   * @brief Set a shell variable. If it is in the environment it is set
+   * there so commands see it.
+   *
+   * @param name the name
+   * @param value the value
+   */
+  void var_set(const char *name, const char *value);
+
+ /**
+   * @brief Make a variable an array. An indexed array keeps a value it had
+   * as element 0, making an associative array drops it.
+   *
+   * @param name the name
+   * @param assoc true for an associative array
+   */
+  void var_declare(const char *name, bool assoc);
+
+ /**
+   * @brief Remove all elements of an array, making the variable an indexed
+   * array if it was not an array
+   *
+   * @param name the name
+   */
+  void var_clear_array(const char *name);
+
+ /**
+   * @brief Set an element of an array. An indexed subscript is an arithmetic
+   * expression and a negative one counts from the end. Indexed arrays are
+   * dense, so a subscript of 2^24 or more is refused rather than allocated.
+   *
+   * @param name the name
+   * @param key the subscript
+   * @param value the value
+   * @return false if the subscript is bad, which is printed
+   */
+  bool var_set_element(const char *name, const char *key, const char *value);
+
+ /**
+   * @brief Add a value after the last element of an indexed array
+   *
+   * @param name the name
+   * @param value the value
+   */
+  void var_append(const char *name, const char *value);
+
+ /**
+   * @brief Get an element of an array. A plain variable is element 0.
+   *
+   * @param name the name
+   * @param key the subscript
+   * @return the value or NULL
+   */
+  const char *var_get_element(const char *name, const char *key);
+
+ /**
+   * @brief Call fn with each element of an array, in index order for an
+   * indexed array
+   *
+   * @param name the name
+   * @param fn called with each value, may be NULL to count them
+   * @param ctx passed to fn
+   * @return how many elements there are
+   */
+  size_t var_each(const char *name, void (*fn)(const char *value, void *ctx), void *ctx);
+
+ /**
+   * @brief Check if a variable is an associative array
+   *
+   * @param name the name
+   * @return true if it is
+   */
+  bool var_is_assoc(const char *name);
+
+ /**
+   * @brief Check if a word is name=value, name+=value or name[sub]=value
+   *
+   * @param word the word
+   * @return true if it is an assignment
+   */
+  bool var_assignment(const char *word);
+
+ /**
+   * @brief Get the length of the variable name at the start of s
+   *
+   * @param s the text
+   * @return the length, 0 if s does not start with a name
+   */
+  size_t var_name_length(const char *s);
+
+ /**
+   * @brief Get the length of the parameter at the start of s inside ${ },
+   * a name, all the digits of a positional parameter or one of ? # @ *
+   *
+   * @param s the text
+   * @return the length, 0 if s does not start with one
+   */
+  size_t var_param_length(const char *s);
+
+ /**
+   * @brief Remove all shell variables
+   */
+  void var_free();
+
+ /**
+   * @brief Evaluate an arithmetic expression with 64 bit integers. It is
+   * compiled the first time and cached by its text.
+   *
+   * @param expr the expression, without the $(( ))
+   * @param value set to the result
+   * @return 0 or -1 on an error, which is printed
+   */
+  int arith_eval(const char *expr, int64_t *value);
+
+ /**
+   * @brief Free the compiled expressions
+   */
+  void arith_cache_free();
+
+ /**
+   * @brief Expand what is inside ${...}: a name, ${#v}, ${v:-w} ${v:=w}
+   * ${v:+w} ${v:?w} and the forms without the colon, ${v:offset:length},
+   * ${v#p} ${v##p} ${v%p} ${v%%p}, and ${v/p/r} ${v//p/r} ${v/#p/r} ${v/%p/r}
+   *
+   * @param body the text between the braces
+   * @param len length of body
+   * @param value set to the value, freed with free
+   * @return 0 or -1 on an error, which is printed
+   */
+  int param_expand(const char *body, size_t len, char **value);
+
+ /**
+   * @brief Free the compiled patterns of parameter expansion
+   */
+  void param_cache_free();
+
+ /**
+   * @brief Replace $(cmd) and `cmd` in a line with what cmd prints, and
+   * $name, ${...} and $((expr)) with their values. echo and pwd run in
+   * the shell, other builtins in a forked child and other commands are
+   * forked and exec'd.
+   *
+   * @param line the line
+   * @param result set to the new line when it returns 1
+   * @return 1 if something was substituted, 0 if not and -1 on an error
+   */
+  int cmd_substitute(const char *line, char **result);
+
+ /**
+   * @brief Get the exit status of the last command substitution and forget
+   * it, what $? is after a command that is only assignments
+   *
+   * @return the status, 0 if nothing was run since the last call
+   */
+  int cmd_substitute_status();
+
+ /**
+   * @brief Run echo or pwd, the builtins that only print
+   *
+   * @param argv the command
+   * @param out where they print
+   * @return false if it is not one of them
+   */
+  bool builtin_print(char **argv, FILE *out);
+
+ /**
+   * @brief Define an alias, replacing one with the same name
+   *
+   * @param name the alias
+   * @param value what it expands to, split into words once here
+   */
+  void alias_set(const char *name, const char *value);
+
+ /**
+   * @brief Remove an alias
+   *
+   * @param name the alias
+   * @return false if there was no such alias
+   */
+  bool alias_unset(const char *name);
+
+ /**
+   * @brief Get the value of an alias
+   *
+   * @param name the alias
+   * @return the value or NULL
+   */
+  const char *alias_get(const char *name);
+
+ /**
+   * @brief Call fn for every alias, in no particular order
+   *
+   * @param fn called with the name and value
+   * @param ctx passed to fn
+   */
+  void alias_list(void (*fn)(const char *name, const char *value, void *ctx), void *ctx);
+
+ /**
+   * @brief Expand the aliases at the start of a command. The word after an
+   * alias whose value ends in a space is expanded too, and an alias is not
+   * expanded again inside itself.
+   *
+   * @param words the command from cmd_parse
+   * @return NULL if the first word is not an alias, otherwise new words
+   * freed with cmd_free
+   */
+  char **alias_expand(char **words);
+
+ /**
+   * @brief Remove all aliases
+   */
+  void alias_free();
+
+ /**
+   * @brief Parse the braces of a word. Nothing is expanded until
+   * brace_next is called.
+   *
+   * @param g the generator
+   * @param word the word
+   * @return true if the word has braces to expand, g is set up either way
+   */
+  bool brace_init(struct brace_gen *g, const char *word);
+
+ /**
+   * @brief Produce the next word of a brace expression. Empty words are
+   * skipped like bash does.
+   *
+   * @param g the generator
+   * @param len set to the length of the word
+   * @return the word, valid until the next call, or NULL when there are no more
+   */
+  const char *brace_next(struct brace_gen *g, size_t *len);
+
+ /**
+   * @brief Free a brace generator
+   *
+   * @param g the generator
+   */
+  void brace_free(struct brace_gen *g);
+
+ /**
+   * @brief Copy the words of a glob result into one block of argv
+   * pointers followed by the strings
+   *
+   * @param r the words, freed
+   * @return the argument list, freed with free
+   */
+  char **glob_result_pack(struct glob_result *r);
+
+ /**
+   * @brief Expand the words of a command: braces, $name, ${...}, $(cmd),
+   * $((expr)) and backquotes, splitting of unquoted results, globbing and
+   * quote removal. "${name[@]}" gives one word for each element.
+   *
+   * @param words the command from cmd_parse
+   * @return the arguments, pointers and strings in one block freed with
+   * free, or NULL on an error or if they would be over ARG_MAX
+   */
+  char **sh_expand(char **words);
+
+ /**
+   * @brief Run a command that is only assignments, including name=(a b c),
+   * name[sub]=value and name+=value
+   *
+   * @param words the command from cmd_parse
+   * @return -1 if it is not only assignments, nothing is done then, otherwise
+   * 0, or 1 when an assignment failed and the ones after it were not done
+   */
+  int sh_assign(char **words);
+
+ /**
+   * @brief Expand a word to a single string, with no splitting or globbing,
+   * like the word of a case or the value of an assignment
+   *
+   * @param word the word
+   * @param pattern true to get a glob pattern with the quoted characters
+   * escaped, false for the plain value
+   * @return the string, freed with free, or NULL on an error
+   */
+  char *sh_expand_word(const char *word, bool pattern);
+
+ /**
+   * @brief Read one line, or up to delim, without taking anything after it
+   * from fd. A regular file is read in blocks that are kept for the next
+   * line, a pipe is looked at with tee before it is read.
+   *
+   * @param fd where to read
+   * @param delim the delimiter, it is not put in the line
+   * @param line set to the line, freed with free
+   * @param len set to the length of the line
+   * @return 1 for a line, 0 at the end of the input with what came before
+   * it in line, -1 on an error
+   */
+  int read_line(int fd, char delim, char **line, size_t *len);
+
+ /**
+   * @brief Free the block kept by read_line
+   */
+  void read_cache_free();
+
+ /**
+   * @brief Compile commands with if, while, until, for, case, && and || into
+   * a program for script_run
+   *
+   * @param text the commands, any number of lines
+   * @param incomplete set to true when the text ends inside a quote or an
+   * open if or loop, so more lines could finish it
+   * @return the program, freed with script_free, or NULL on a syntax error
+   */
+  struct script *script_compile(const char *text, bool *incomplete);
+
+ /**
+   * @brief Run a program from script_compile
+   *
+   * @param sh the shell, NULL for one kept here
+   * @param s the program
+   * @return the status of the last command
+   */
+  int script_run(struct shell *sh, struct script *s);
+
+ /**
+   * @brief Free a program from script_compile
+   *
+   * @param s the program
+   */
+  void script_free(struct script *s);
+
+ /**
+   * @brief The words of a program that is just one command in the
+   * foreground and not a function call, so it can be run the way it always was
+   *
+   * @param s the program
+   * @return the words, owned by s, or NULL
+   */
+  char **script_simple(struct script *s);
+
+ /**
+   * @brief Compile and run commands
+   *
+   * @param sh the shell, NULL for one kept here
+   * @param text the commands
+   * @return the status of the last command, 2 for a syntax error
+   */
+  int script_eval(struct shell *sh, const char *text);
+
+ /**
+   * @brief Run the commands in a file, for source and .
+   *
+   * @param sh the shell, NULL for one kept here
+   * @param path the file
+   * @return the status of the last command, 1 if the file can not be read
+   */
+  int script_source(struct shell *sh, const char *path);
+
+ /**
+   * @brief Get a positional parameter of the function call running now
+   *
+   * @param n 1 for $1, 0 for the name of the shell
+   * @return the value, NULL if there are not that many
+   */
+  const char *script_arg(size_t n);
+
+ /**
+   * @brief The number of positional parameters, what $# gives
+   *
+   * @return the count, 0 outside of a function
+   */
+  size_t script_arg_count();
+
+ /**
+   * @brief Call fn with each positional parameter in order, for "$@"
+   *
+   * @param fn called with each value, may be NULL to only count them
+   * @param ctx passed to fn
+   * @return the number of parameters
+   */
+  size_t script_each_arg(void (*fn)(const char *value, void *ctx), void *ctx);
+
+ /**
+   * @brief Get a special parameter: $1 and up, $#, $@ or $*
+   *
+   * @param name the parameter, digits or one of # @ *
+   * @param len the length of name
+   * @return the value, valid until the next call, NULL if it is not set.
+   * $@ and $* are the parameters joined with spaces
+   */
+  const char *script_param(const char *name, size_t len);
+
+ /**
+   * @brief Drop the first n positional parameters, for the shift builtin
+   *
+   * @param n how many
+   * @return 0, or 1 if there are fewer than n
+   */
+  int script_shift(size_t n);
+
+ /**
+   * @brief Remove all functions and the arguments of the calls
+   */
+  void script_functions_free();
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+LZ codec -----------------------------------------
+A small LZ77 in the style of LZ4, enough for history blocks where most of the
+redundancy is repeated words. The compressed data is a list of sequences:
+
+    token | extra literal length | literals | offset (2 bytes) | extra match length
+
+The high 4 bits of the token are the literal count and the low 4 bits the
+match length minus 4, a 15 in either means more length bytes follow (255
+means keep reading). The last sequence has only literals and ends the input.
+*/
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(const uint8_t *p) {
+    return (read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *putLength(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+size_t lz_compress(const uint8_t *in, size_t n, uint8_t *out) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t *ip = in;
+    const uint8_t *anchor = in; // first literal not written yet
+    const uint8_t *end = in + n;
+    uint8_t *op = out;
+
+    while (n >= LZ_MIN_MATCH && ip + LZ_MIN_MATCH <= end) {
+        uint32_t h = hash4(ip);
+        const uint8_t *ref = in + table[h];
+        table[h] = (uint32_t)(ip - in);
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        size_t matchLen = LZ_MIN_MATCH;
+        while (ip + matchLen < end && ref[matchLen] == ip[matchLen]) {
+            matchLen++;
+        }
+
+        size_t litLen = ip - anchor;
+        uint8_t *token = op++;
+        *token = (uint8_t)((litLen < 15 ? litLen : 15) << 4);
+        if (litLen >= 15) {
+            op = putLength(op, litLen - 15);
+        }
+        memcpy(op, anchor, litLen);
+        op += litLen;
+
+        uint16_t offset = (uint16_t)(ip - ref);
+        memcpy(op, &offset, sizeof(offset));
+        op += sizeof(offset);
+
+        size_t extra = matchLen - LZ_MIN_MATCH;
+        *token |= (uint8_t)(extra < 15 ? extra : 15);
+        if (extra >= 15) {
+            op = putLength(op, extra - 15);
+        }
+
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    // whatever is left goes out as literals
+    size_t litLen = end - anchor;
+    *op++ = (uint8_t)((litLen < 15 ? litLen : 15) << 4);
+    if (litLen >= 15) {
+        op = putLength(op, litLen - 15);
+    }
+    memcpy(op, anchor, litLen);
+    op += litLen;
+    return op - out;
+}
+
+static bool getLength(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t outSize) {
+    const uint8_t *ip = in;
+    const uint8_t *end = in + n;
+    uint8_t *op = out;
+    uint8_t *outEnd = out + outSize;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t litLen = token >> 4;
+        if (litLen == 15 && !getLength(&ip, end, &litLen)) {
+            return false;
+        }
+        if (litLen > (size_t)(end - ip) || litLen > (size_t)(outEnd - op)) {
+            return false;
+        }
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+
+        if (ip == end) {
+            break; // last sequence, literals only
+        }
+
+        uint16_t offset;
+        if (end - ip < 2) {
+            return false;
+        }
+        memcpy(&offset, ip, sizeof(offset));
+        ip += sizeof(offset);
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !getLength(&ip, end, &matchLen)) {
+            return false;
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op - out || matchLen > (size_t)(outEnd - op)) {
+            return false;
+        }
+
+        // byte by byte, the match can overlap what it is copying
+        const uint8_t *ref = op - offset;
+        for (size_t i = 0; i < matchLen; i++) {
+            op[i] = ref[i];
+        }
+        op += matchLen;
+    }
+    return op == outEnd;
+}
+
+/*
+LZ codec end-----------------------------------------
+*/
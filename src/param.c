@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+Parameter expansion -----------------------------------------
+The operators inside ${...}: ${#v}, ${v:-w} and the other defaults,
+${v:offset:length}, ${v#p} ${v##p} ${v%p} ${v%%p} and ${v/p/r} with its
+//, /# and /% forms, on a variable or an array element like ${a[i]}. Patterns go through the compiled glob matcher, and the
+last few compiled patterns are kept so a loop does not compile the same one
+again. The matcher's minimum length cuts down the lengths that are tried,
+and a pattern with no magic characters is searched for with memmem.
+*/
+
+#define PARAM_MATCHERS 32 // power of two
+
+typedef struct {
+    char *pattern;
+    struct glob_matcher m;
+    bool literal;
+} Matcher;
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Out;
+
+static Matcher matchers[PARAM_MATCHERS];
+
+static void outAppend(Out *o, const char *s, size_t n) {
+    if (o->len + n + 1 > o->cap) {
+        o->cap = (o->len + n + 1) * 2;
+        o->buf = realloc(o->buf, o->cap);
+        if (o->buf == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+    o->buf[o->len] = '\0';
+}
+
+void param_cache_free() {
+    for (int i = 0; i < PARAM_MATCHERS; i++) {
+        if (matchers[i].pattern != NULL) {
+            free(matchers[i].pattern);
+            glob_matcher_free(&matchers[i].m);
+        }
+    }
+    memset(matchers, 0, sizeof(matchers));
+}
+
+static const Matcher *compiledPattern(const char *pattern) {
+    uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+    for (const char *p = pattern; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 0x100000001b3ull;
+    }
+    Matcher *slot = &matchers[h & (PARAM_MATCHERS - 1)];
+    if (slot->pattern != NULL && strcmp(slot->pattern, pattern) == 0) {
+        return slot;
+    }
+    if (slot->pattern != NULL) {
+        free(slot->pattern);
+        glob_matcher_free(&slot->m);
+    }
+    slot->pattern = strdup(pattern);
+    slot->literal = !glob_has_magic(pattern) && strchr(pattern, '\\') == NULL;
+    glob_compile(&slot->m, pattern, strlen(pattern));
+    return slot;
+}
+
+// Function to expand $name, $(cmd) and the rest in a word of an operator
+static char *expandWord(const char *word, size_t len) {
+    char *text = strndup(word, len);
+    char *expanded;
+    int result = cmd_substitute(text, &expanded);
+    if (result > 0) {
+        free(text);
+        return expanded;
+    }
+    if (result < 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static void joinElement(const char *value, void *ctx) {
+    Out *o = ctx;
+    outAppend(o, value, strlen(value));
+    outAppend(o, " ", 1);
+}
+
+// Function to get a copy of the value of name, or of name[sub] when there is
+// a subscript, NULL if it is not set. [@] and [*] are the elements joined
+// with spaces.
+static char *getValue(const char *name, const char *sub, int *result) {
+    if (sub == NULL) {
+        const char *v = var_get(name);
+        return v ? strdup(v) : NULL;
+    }
+    if (strcmp(sub, "@") == 0 || strcmp(sub, "*") == 0) {
+        Out o = {NULL, 0, 0};
+        if (var_each(name, joinElement, &o) == 0) {
+            return NULL;
+        }
+        o.buf[--o.len] = '\0'; // the last space
+        return o.buf;
+    }
+    char *key = expandWord(sub, strlen(sub));
+    if (key == NULL) {
+        *result = -1;
+        return NULL;
+    }
+    const char *v = var_get_element(name, key);
+    free(key);
+    return v ? strdup(v) : NULL;
+}
+
+// Function for ${v#p} ${v##p} ${v%p} ${v%%p}, the part of s that is kept
+static void removeMatch(const char *s, size_t len, const Matcher *p, bool suffix, bool longest,
+                        size_t *keepAt, size_t *keepLen) {
+    *keepAt = 0;
+    *keepLen = len;
+    size_t min = p->m.minLength;
+    if (min > len) {
+        return;
+    }
+    for (size_t n = longest ? len : min; longest ? n + 1 > min : n <= len; longest ? n-- : n++) {
+        const char *at = suffix ? s + len - n : s;
+        if (glob_match(&p->m, at, n)) {
+            *keepAt = suffix ? 0 : n;
+            *keepLen = len - n;
+            return;
+        }
+    }
+}
+
+// Function to find the longest match of p starting at s, -1 if there is none
+static long matchAt(const char *s, size_t len, const Matcher *p, bool toEnd) {
+    size_t min = p->m.minLength;
+    if (min > len) {
+        return -1;
+    }
+    if (toEnd) {
+        return glob_match(&p->m, s, len) ? (long)len : -1;
+    }
+    for (size_t n = len; n + 1 > min; n--) {
+        if (glob_match(&p->m, s, n)) {
+            return (long)n;
+        }
+    }
+    return -1;
+}
+
+// Function for ${v/p/r}, mode is one of / # % for //, /# and /%
+static void replaceMatches(const char *s, size_t len, const Matcher *p, const char *with, char mode,
+                           Out *o) {
+    size_t plen = strlen(p->pattern);
+    size_t wlen = strlen(with);
+    size_t at = 0;
+    while (at <= len) {
+        long n = -1;
+        if (p->literal && mode != '#' && mode != '%') {
+            const char *found = plen ? memmem(s + at, len - at, p->pattern, plen) : NULL;
+            if (found != NULL) {
+                outAppend(o, s + at, found - (s + at));
+                at = found - s;
+                n = (long)plen;
+            }
+        } else {
+            n = matchAt(s + at, len - at, p, mode == '%');
+        }
+        if (n > 0 || (n == 0 && len == 0)) {
+            outAppend(o, with, wlen);
+            at += n;
+            if (mode != '/') {
+                break;
+            }
+            continue;
+        }
+        if (mode == '#' || (p->literal && mode != '%')) {
+            break; // anchored, or no more of the literal
+        }
+        if (at < len) {
+            outAppend(o, s + at, 1);
+        }
+        at++;
+    }
+    if (at < len) {
+        outAppend(o, s + at, len - at);
+    }
+}
+
+// Function for ${v:offset} and ${v:offset:length}
+static int substring(const char *s, size_t len, const char *spec, Out *o) {
+    char *text = strdup(spec);
+    char *colon = strchr(text, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+    }
+    int64_t offset, count = (int64_t)len;
+    if (arith_eval(text, &offset) < 0 || (colon != NULL && arith_eval(colon + 1, &count) < 0)) {
+        free(text);
+        return -1;
+    }
+    free(text);
+    if (offset < 0) {
+        offset += (int64_t)len; // from the end
+    }
+    if (offset < 0 || offset > (int64_t)len) {
+        return 0; // bash gives nothing
+    }
+    int64_t end = count < 0 ? (int64_t)len + count : offset + count;
+    if (end < offset) {
+        if (count < 0) {
+            fprintf(stderr, "%s: substring expression < 0\n", spec);
+            return -1;
+        }
+        end = offset;
+    }
+    if (end > (int64_t)len) {
+        end = (int64_t)len;
+    }
+    outAppend(o, s + offset, (size_t)(end - offset));
+    return 0;
+}
+
+int param_expand(const char *body, size_t len, char **value) {
+    *value = NULL;
+    char *text = strndup(body, len);
+    Out o = {NULL, 0, 0};
+    outAppend(&o, "", 0);
+
+    // ${#name}, ${#name[i]} and ${#name[@]} for the number of elements
+    size_t lengthOf = text[0] == '#' ? var_param_length(text + 1) : 0;
+    bool element = lengthOf > 0 && text[1 + lengthOf] == '[' && text[len - 1] == ']';
+    if (lengthOf > 0 && (lengthOf == len - 1 || element)) {
+        char *sub = element ? text + 2 + lengthOf : NULL;
+        text[1 + lengthOf] = '\0';
+        text[len - 1] = element ? '\0' : text[len - 1];
+        int result = 0;
+        size_t n = 0;
+        if (sub != NULL && (strcmp(sub, "@") == 0 || strcmp(sub, "*") == 0)) {
+            n = var_each(text + 1, NULL, NULL);
+        } else if (text[1] == '@' || text[1] == '*') {
+            n = script_arg_count(); // ${#@} like $#
+        } else {
+            char *v = getValue(text + 1, sub, &result);
+            n = v ? strlen(v) : 0;
+            free(v);
+        }
+        char number[24];
+        outAppend(&o, number, (size_t)snprintf(number, sizeof(number), "%zu", n));
+        free(text);
+        if (result < 0) {
+            free(o.buf);
+            return -1;
+        }
+        *value = o.buf;
+        return 0;
+    }
+
+    size_t nameLen = var_param_length(text);
+    if (nameLen == 0) {
+        fprintf(stderr, "${%s}: bad substitution\n", text);
+        free(text);
+        free(o.buf);
+        return -1;
+    }
+    char *op = text + nameLen;
+    char *sub = NULL;
+    if (*op == '[' && strchr(op, ']') != NULL) {
+        sub = op + 1;
+        op = strchr(op, ']');
+        *op++ = '\0';
+    }
+    char opChar = *op;
+    text[nameLen] = '\0'; // text is the name now
+    int result = 0;
+    char *v = getValue(text, sub, &result);
+    const char *s = v ? v : "";
+    size_t slen = strlen(s);
+
+    bool colon = opChar == ':' && op[1] != '\0' && strchr("-=+?", op[1]) != NULL;
+    char kind = colon ? op[1] : opChar;
+    const char *word = op + (colon ? 2 : 1);
+    bool missing = v == NULL || (colon && slen == 0);
+    if (opChar == '\0') {
+        outAppend(&o, s, slen);
+    } else if (kind == '-' || kind == '=' || kind == '+' || kind == '?') {
+        // defaults, the word is only expanded if it is used
+        bool useWord = kind == '+' ? !missing : missing;
+        if (!useWord) {
+            outAppend(&o, kind == '+' ? "" : s, kind == '+' ? 0 : slen);
+        } else {
+            char *w = expandWord(word, strlen(word));
+            if (w == NULL) {
+                result = -1;
+            } else if (kind == '?') {
+                fprintf(stderr, "%s: %s\n", text, *w ? w : "parameter null or not set");
+                result = -1;
+            } else {
+                if (kind == '=' && sub != NULL) {
+                    char *key = expandWord(sub, strlen(sub));
+                    result = key != NULL && var_set_element(text, key, w) ? 0 : -1;
+                    free(key);
+                } else if (kind == '=') {
+                    var_set(text, w);
+                }
+                outAppend(&o, w, strlen(w));
+            }
+            free(w);
+        }
+    } else if (opChar == ':') {
+        result = substring(s, slen, op + 1, &o);
+    } else if (opChar == '#' || opChar == '%') {
+        bool longest = op[1] == opChar;
+        char *pattern = expandWord(op + 1 + longest, strlen(op + 1 + longest));
+        if (pattern == NULL) {
+            result = -1;
+        } else {
+            size_t keepAt, keepLen;
+            removeMatch(s, slen, compiledPattern(pattern), opChar == '%', longest, &keepAt, &keepLen);
+            outAppend(&o, s + keepAt, keepLen);
+        }
+        free(pattern);
+    } else if (opChar == '/') {
+        char mode = op[1] == '/' || op[1] == '#' || op[1] == '%' ? op[1] : 0;
+        char *from = op + 1 + (mode ? 1 : 0);
+        char *slash = from;
+        while (*slash && *slash != '/') {
+            slash += slash[0] == '\\' && slash[1] ? 2 : 1;
+        }
+        char *pattern = expandWord(from, slash - from);
+        char *with = *slash ? expandWord(slash + 1, strlen(slash + 1)) : strdup("");
+        if (pattern == NULL || with == NULL) {
+            result = -1;
+        } else if (*pattern == '\0') {
+            outAppend(&o, s, slen);
+        } else {
+            replaceMatches(s, slen, compiledPattern(pattern), with, mode ? mode : 0, &o);
+        }
+        free(pattern);
+        free(with);
+    } else {
+        fprintf(stderr, "${%.*s}: bad substitution\n", (int)len, body);
+        result = -1;
+    }
+
+    free(v);
+    free(text);
+    if (result < 0) {
+        free(o.buf);
+        return -1;
+    }
+    *value = o.buf;
+    return 0;
+}
+
+/*
+Parameter expansion end-----------------------------------------
+*/
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <readline/readline.h>
+#include "lab.h"
+
+/*
+PATH cache -----------------------------------------
+Every executable in the PATH directories, scanned once and kept in a trie
+whose value is an index into a table of names. Each name has a bit for every
+PATH directory it is in, so running a command looks up the first directory
+that has it without walking PATH, and Tab completes argv[0] from the same
+trie. The directories are watched with inotify and only the names in the
+events are checked again. Directories past the 64th are not cached, lookups
+that miss fall back to execvp. So do relative entries like . or an empty
+one, they mean a different directory after every cd, and a name found after
+one is left to execvp too since the relative directory may have it first.
+*/
+
+#define PATH_MAX_DIRS 64
+
+typedef struct {
+    char *name;
+    uint64_t dirs; // bit i set when PATH directory i has it
+} PathName;
+
+static char *pathValue = NULL; // PATH the cache was built for
+static char **pathDirs = NULL;
+static int *pathWatches = NULL;
+static int pathDirCount = 0;
+static int pathFirstRelative = PATH_MAX_DIRS; // index of the first relative entry
+static int pathWatchFd = -1;
+static struct trie pathTrie;
+static PathName *pathNames = NULL;
+static int pathNameCount = 0;
+static int pathNameCapacity = 0;
+static bool pathReady = false;
+static unsigned long pathVersion = 0; // bumped whenever a name comes or goes
+
+// command not found suggestions, built from the names when first needed
+static struct bk_tree suggestTree;
+static bool suggestReady = false;
+static unsigned long suggestVersion = 0;
+
+// Tab completion matches, they point into pathNames
+static const char **completionMatches = NULL;
+static int completionCount = 0;
+static int completionCapacity = 0;
+static int completionNext = 0;
+
+// Function to check that dir/name is a file we can run
+static bool isExecutable(int dirFd, const char *name) {
+    struct stat st;
+    if (fstatat(dirFd, name, &st, 0) < 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    return faccessat(dirFd, name, X_OK, AT_EACCESS) == 0;
+}
+
+static int nameId(const char *name) {
+    size_t len = strlen(name);
+    int node = trie_find(&pathTrie, name, len);
+    int id = node >= 0 ? pathTrie.nodes[node].value : -1;
+    if (id >= 0) {
+        return id;
+    }
+    if (pathNameCount == pathNameCapacity) {
+        pathNameCapacity = pathNameCapacity ? pathNameCapacity * 2 : 1024;
+        pathNames = realloc(pathNames, pathNameCapacity * sizeof(PathName));
+    }
+    id = pathNameCount++;
+    pathNames[id].name = strdup(name);
+    pathNames[id].dirs = 0;
+    trie_insert(&pathTrie, name, len, id, NULL, NULL);
+    return id;
+}
+
+// Function to set or clear the bit of directory dir for name
+static void setName(int dir, const char *name, bool present) {
+    pathVersion++;
+    if (present) {
+        int id = nameId(name); // may move pathNames
+        pathNames[id].dirs |= 1ull << dir;
+        return;
+    }
+    int node = trie_find(&pathTrie, name, strlen(name));
+    if (node >= 0 && pathTrie.nodes[node].value >= 0) {
+        pathNames[pathTrie.nodes[node].value].dirs &= ~(1ull << dir);
+    }
+}
+
+static void scanDir(int dir) {
+    DIR *d = opendir(pathDirs[dir]);
+    if (d == NULL) {
+        return;
+    }
+    int fd = dirfd(d);
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) {
+            continue;
+        }
+        if (isExecutable(fd, entry->d_name)) {
+            setName(dir, entry->d_name, true);
+        }
+    }
+    closedir(d);
+}
+
+void path_cache_free() {
+    for (int i = 0; i < pathNameCount; i++) {
+        free(pathNames[i].name);
+    }
+    for (int i = 0; i < pathDirCount; i++) {
+        free(pathDirs[i]);
+    }
+    free(pathNames);
+    free(pathDirs);
+    free(pathWatches);
+    free(pathValue);
+    free(completionMatches);
+    if (suggestReady) {
+        bk_free(&suggestTree);
+    }
+    if (pathReady) {
+        trie_free(&pathTrie);
+    }
+    if (pathWatchFd >= 0) {
+        close(pathWatchFd);
+    }
+    pathNames = NULL;
+    pathNameCount = 0;
+    pathNameCapacity = 0;
+    pathDirs = NULL;
+    pathWatches = NULL;
+    pathDirCount = 0;
+    pathFirstRelative = PATH_MAX_DIRS;
+    pathValue = NULL;
+    completionMatches = NULL;
+    completionCount = 0;
+    completionCapacity = 0;
+    pathWatchFd = -1;
+    pathReady = false;
+    suggestReady = false;
+}
+
+// Function to scan every PATH directory and start watching them
+static void buildCache(const char *path) {
+    path_cache_free();
+    trie_init(&pathTrie);
+    pathReady = true;
+    pathValue = strdup(path);
+    pathWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    pathDirs = malloc(PATH_MAX_DIRS * sizeof(char *));
+    pathWatches = malloc(PATH_MAX_DIRS * sizeof(int));
+    char *copy = strdup(path);
+    char *rest = copy;
+    char *dir;
+    while ((dir = strsep(&rest, ":")) != NULL && pathDirCount < PATH_MAX_DIRS) {
+        int i = pathDirCount++;
+        pathDirs[i] = strdup(dir);
+        if (dir[0] != '/') {
+            // relative to wherever the shell is, nothing to scan or watch
+            pathWatches[i] = -1;
+            if (pathFirstRelative == PATH_MAX_DIRS) {
+                pathFirstRelative = i;
+            }
+            continue;
+        }
+        pathWatches[i] = pathWatchFd < 0 ? -1 :
+            inotify_add_watch(pathWatchFd, dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                                IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+        scanDir(i);
+    }
+    free(copy);
+}
+
+// Function to apply inotify events, returns false if the whole cache has to
+// be built again
+static bool applyEvents() {
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while (pathWatchFd >= 0 && (n = read(pathWatchFd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                return false;
+            }
+            if (ev->len == 0) {
+                continue;
+            }
+            // one directory can be in PATH twice
+            for (int dir = 0; dir < pathDirCount; dir++) {
+                if (pathWatches[dir] != ev->wd) {
+                    continue;
+                }
+                bool present = false;
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) {
+                    int fd = open(pathDirs[dir], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                    present = fd >= 0 && isExecutable(fd, ev->name);
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                }
+                setName(dir, ev->name, present);
+            }
+        }
+    }
+    return true;
+}
+
+void path_cache_refresh() {
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "/usr/local/bin:/usr/bin:/bin";
+    }
+    if (!pathReady || strcmp(path, pathValue) != 0 || !applyEvents()) {
+        buildCache(path);
+    }
+}
+
+const char *path_lookup(const char *name, char *buf, size_t size) {
+    if (strchr(name, '/') != NULL) {
+        return NULL; // a path already, nothing to look up
+    }
+    path_cache_refresh();
+    int node = trie_find(&pathTrie, name, strlen(name));
+    int id = node >= 0 ? pathTrie.nodes[node].value : -1;
+    if (id < 0 || pathNames[id].dirs == 0) {
+        return NULL;
+    }
+    int dir = __builtin_ctzll(pathNames[id].dirs); // first in PATH wins
+    if (dir > pathFirstRelative) {
+        return NULL; // the relative entry before it may have one too
+    }
+    if (snprintf(buf, size, "%s/%s", pathDirs[dir], name) >= (int)size) {
+        return NULL;
+    }
+    return buf;
+}
+
+void path_names(void (*fn)(const char *name, void *ctx), void *ctx) {
+    path_cache_refresh();
+    for (int i = 0; i < pathNameCount; i++) {
+        if (pathNames[i].dirs != 0) {
+            fn(pathNames[i].name, ctx);
+        }
+    }
+}
+
+// Function to check if two words have the same letters, a swap of two
+// letters costs 2 edits but is the likeliest typo
+static bool sameLetters(const char *a, const char *b) {
+    int counts[256] = {0};
+    for (; *a; a++) {
+        counts[(unsigned char)*a]++;
+    }
+    for (; *b; b++) {
+        counts[(unsigned char)*b]--;
+    }
+    for (int i = 0; i < 256; i++) {
+        if (counts[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to order suggestions, closest first, then swapped letters, then by name
+static bool suggestBefore(const char *name, const char *a, int da, const char *b, int db) {
+    if (da != db) {
+        return da < db;
+    }
+    bool sa = sameLetters(name, a);
+    if (sa != sameLetters(name, b)) {
+        return sa;
+    }
+    return strcmp(a, b) < 0;
+}
+
+static void addSuggestion(const char *name, void *ctx) {
+    UNUSED(ctx);
+    bk_insert(&suggestTree, name);
+}
+
+size_t path_suggest(const char *name, const char **results, size_t max) {
+    path_cache_refresh();
+    if (!suggestReady || suggestVersion != pathVersion) {
+        if (suggestReady) {
+            bk_free(&suggestTree);
+        }
+        bk_init(&suggestTree);
+        path_names(addSuggestion, NULL);
+        suggestReady = true;
+        suggestVersion = pathVersion;
+    }
+
+    const char *found[64];
+    int distances[64];
+    size_t count = bk_search(&suggestTree, name, 2, found, distances, 64);
+
+    // an insertion sort is plenty for 64
+    for (size_t i = 1; i < count; i++) {
+        for (size_t j = i; j > 0; j--) {
+            if (!suggestBefore(name, found[j], distances[j], found[j - 1], distances[j - 1])) {
+                break;
+            }
+            const char *w = found[j];
+            found[j] = found[j - 1];
+            found[j - 1] = w;
+            int d = distances[j];
+            distances[j] = distances[j - 1];
+            distances[j - 1] = d;
+        }
+    }
+    size_t n = count < max ? count : max;
+    memcpy(results, found, n * sizeof(char *));
+    return n;
+}
+
+/*
+Command completion -----------------------------------------
+*/
+
+static void collectMatch(const char *key, size_t len, int value, void *ctx) {
+    UNUSED(key);
+    UNUSED(len);
+    UNUSED(ctx);
+    if (pathNames[value].dirs == 0) {
+        return; // removed since it was added
+    }
+    if (completionCount == completionCapacity) {
+        completionCapacity = completionCapacity ? completionCapacity * 2 : 64;
+        completionMatches = realloc(completionMatches, completionCapacity * sizeof(char *));
+    }
+    completionMatches[completionCount++] = pathNames[value].name;
+}
+
+static char *commandGenerator(const char *text, int state) {
+    if (state == 0) {
+        path_cache_refresh();
+        completionCount = 0;
+        completionNext = 0;
+        trie_walk(&pathTrie, text, strlen(text), collectMatch, NULL);
+    }
+    if (completionNext >= completionCount) {
+        return NULL;
+    }
+    return strdup(completionMatches[completionNext++]);
+}
+
+// Function to complete argv[0] from PATH and the other words from the
+// directory cache, only directories for cd
+static char **completeCommand(const char *text, int start, int end) {
+    UNUSED(end);
+    int i = start;
+    while (i > 0 && (rl_line_buffer[i - 1] == ' ' || rl_line_buffer[i - 1] == '\t')) {
+        i--;
+    }
+    if (i == 0 && strchr(text, '/') == NULL) {
+        return rl_completion_matches(text, commandGenerator);
+    }
+
+    size_t skip = strspn(rl_line_buffer, " \t");
+    bool cd = strncmp(rl_line_buffer + skip, "cd", 2) == 0 &&
+              (rl_line_buffer[skip + 2] == ' ' || rl_line_buffer[skip + 2] == '\t');
+    rl_attempted_completion_over = 1; // readline's own would read the directory again
+    rl_filename_completion_desired = 1;
+    return rl_completion_matches(text, cd ? dir_dir_generator : dir_file_generator);
+}
+
+void path_install_completion() {
+    rl_attempted_completion_function = completeCommand;
+}
+
+/*
+PATH cache end-----------------------------------------
+*/
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+Line reading -----------------------------------------
+The read builtin takes one line, or up to another delimiter, and must not
+take anything after it, since a command run next reads from the same place.
+A regular file is read in large blocks and the file offset is put back just
+past the delimiter. The block is kept, so the next line from the same file
+comes out of memory with no read at all, only the lseek. A pipe cannot be
+put back, so tee is used to look at what is waiting without taking it and
+then exactly the line is read, a tee and two reads for a line instead of a
+read for each byte. Anything else, like a terminal, is read a byte at a time.
+*/
+
+#define READ_BLOCK (64 * 1024)
+#define READ_PEEK 256
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Out;
+
+// the last block of a regular file, kept for the next line
+static struct {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    off_t offset; // file offset of data[0]
+    char *data;
+    size_t len;
+    size_t cap;
+} block;
+
+static int peekPipe[2] = {-1, -1};
+
+static void outReserve(Out *o, size_t n) {
+    if (o->len + n + 1 > o->cap) {
+        o->cap = (o->len + n + 1) * 2;
+        o->buf = realloc(o->buf, o->cap);
+        if (o->buf == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void outAppend(Out *o, const char *s, size_t n) {
+    outReserve(o, n);
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+    o->buf[o->len] = '\0';
+}
+
+// Function to read a regular file from off, with what is left of the last block
+static int readFile(int fd, const struct stat *st, char delim, Out *line) {
+    off_t off = lseek(fd, 0, SEEK_CUR);
+    if (off < 0) {
+        return -1;
+    }
+    bool same = block.valid && block.dev == st->st_dev && block.ino == st->st_ino &&
+                block.size == st->st_size && block.mtime.tv_sec == st->st_mtim.tv_sec &&
+                block.mtime.tv_nsec == st->st_mtim.tv_nsec;
+    if (!same || off < block.offset || off > block.offset + (off_t)block.len) {
+        block.valid = true; // a different file, or moved by someone else
+        block.dev = st->st_dev;
+        block.ino = st->st_ino;
+        block.size = st->st_size;
+        block.mtime = st->st_mtim;
+        block.offset = off;
+        block.len = 0;
+    }
+
+    size_t at = (size_t)(off - block.offset);
+    size_t scanned = at;
+    while (true) {
+        char *found = memchr(block.data + scanned, delim, block.len - scanned);
+        if (found != NULL) {
+            outAppend(line, block.data + at, found - (block.data + at));
+            lseek(fd, block.offset + (found - block.data) + 1, SEEK_SET);
+            return 1;
+        }
+        if (at > 0) {
+            memmove(block.data, block.data + at, block.len - at); // keep only the line so far
+            block.offset += at;
+            block.len -= at;
+            at = 0;
+        }
+        scanned = block.len;
+        if (block.len + READ_BLOCK > block.cap) {
+            block.cap = block.len + READ_BLOCK;
+            block.data = realloc(block.data, block.cap);
+            if (block.data == NULL) {
+                perror("Reallocating failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t n = pread(fd, block.data + block.len, READ_BLOCK, block.offset + block.len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            block.valid = false;
+            return -1;
+        }
+        if (n == 0) {
+            outAppend(line, block.data, block.len); // the last line has no delimiter
+            lseek(fd, block.offset + block.len, SEEK_SET);
+            return 0;
+        }
+        block.len += n;
+    }
+}
+
+// Function to read exactly n bytes, false at the end of the input
+static bool readExactly(int fd, char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t got = read(fd, buf, n);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        buf += got;
+        n -= got;
+    }
+    return true;
+}
+
+// Function to read a byte at a time, nothing past the delimiter is taken
+static int readBytes(int fd, char delim, Out *line) {
+    char c;
+    while (true) {
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (c == delim) {
+            return 1;
+        }
+        outAppend(line, &c, 1);
+    }
+}
+
+// Function to read a pipe, looking at what is in it with tee before taking it
+static int readPipe(int fd, char delim, Out *line) {
+    if (peekPipe[0] < 0 && pipe2(peekPipe, O_CLOEXEC) < 0) {
+        return readBytes(fd, delim, line);
+    }
+    size_t want = READ_PEEK; // most lines are short, a long one doubles it
+    while (true) {
+        ssize_t n = tee(fd, peekPipe[1], want, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return readBytes(fd, delim, line);
+        }
+        if (n == 0) {
+            return 0;
+        }
+        // the peeked copy ends up where the line goes, it is read over below
+        size_t start = line->len;
+        outReserve(line, (size_t)n);
+        if (!readExactly(peekPipe[0], line->buf + start, (size_t)n)) {
+            return -1;
+        }
+        char *found = memchr(line->buf + start, delim, (size_t)n);
+        size_t take = found != NULL ? (size_t)(found - (line->buf + start)) + 1 : (size_t)n;
+        if (!readExactly(fd, line->buf + start, take)) {
+            return -1;
+        }
+        line->len = start + take - (found != NULL);
+        line->buf[line->len] = '\0';
+        if (found != NULL) {
+            return 1;
+        }
+        want = want < READ_BLOCK ? want * 2 : want;
+    }
+}
+
+int read_line(int fd, char delim, char **line, size_t *len) {
+    Out o = {NULL, 0, 0};
+    outAppend(&o, "", 0);
+    struct stat st;
+    int result;
+    if (fstat(fd, &st) < 0) {
+        result = -1;
+    } else if (S_ISREG(st.st_mode)) {
+        result = readFile(fd, &st, delim, &o);
+    } else if (S_ISFIFO(st.st_mode)) {
+        result = readPipe(fd, delim, &o);
+    } else {
+        result = readBytes(fd, delim, &o);
+    }
+    *line = o.buf;
+    *len = o.len;
+    return result;
+}
+
+void read_cache_free() {
+    free(block.data);
+    memset(&block, 0, sizeof(block));
+    if (peekPipe[0] >= 0) {
+        close(peekPipe[0]);
+        close(peekPipe[1]);
+        peekPipe[0] = peekPipe[1] = -1;
+    }
+}
+
+/*
+Line reading end-----------------------------------------
+*/
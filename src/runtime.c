@@ -0,0 +1,295 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "lab.h"
+
+/*
+Runtime history -----------------------------------------
+Wall time per normalized command is kept in a small log file. Every update
+appends one fixed size record with O_APPEND so several shells can share the
+file, and the last record for a key wins when it is loaded. The file is
+rewritten without the stale records when it gets more than twice as big as
+the table. Appends and the rewrite take flock on the file, so the magic is
+written once and records appended during a rewrite are not lost.
+*/
+
+#define RUNTIME_MAGIC 0x3154524cu // "LRT1"
+#define RUNTIME_MAX_WEIGHT 8 // running mean of the first 8, then an EWMA
+
+// one record on disk and in the table, 16 bytes
+typedef struct {
+    uint64_t key; // runtime_key hash, 0 marks an empty slot
+    float seconds; // average wall time
+    uint32_t count; // times it has been measured
+} RuntimeRecord;
+
+static RuntimeRecord *table = NULL;
+static size_t tableCapacity = 0; // power of two
+static size_t tableUsed = 0;
+static bool loaded = false;
+static char *runtimePath = NULL;
+
+// FNV-1a, keys only need to be stable across runs
+static uint64_t hashBytes(uint64_t h, const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// a subcommand is a plain word like "commit" or "build" or a number like
+// the 0.5 in "sleep 0.5", not a file name
+static bool isSubcommand(const char *arg) {
+    size_t n = strlen(arg);
+    if (n == 0 || n > 32 || arg[0] == '-') {
+        return false;
+    }
+    bool numeric = strspn(arg, "0123456789.") == n;
+    for (size_t i = 0; i < n && !numeric; i++) {
+        if (!isalnum((unsigned char)arg[i]) && arg[i] != '-' && arg[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t runtime_key(char **args) {
+    if (args == NULL || args[0] == NULL) {
+        return 0;
+    }
+
+    // basename of argv[0] so /usr/bin/make and make share their history
+    const char *name = strrchr(args[0], '/');
+    name = name ? name + 1 : args[0];
+    uint64_t h = hashBytes(0xcbf29ce484222325ull, name, strlen(name));
+
+    for (int i = 1; args[i] != NULL; i++) {
+        if (args[i][0] == '-') {
+            continue; // options do not change what kind of command it is
+        }
+        if (isSubcommand(args[i])) {
+            h = hashBytes(h, " ", 1);
+            h = hashBytes(h, args[i], strlen(args[i]));
+        }
+        break;
+    }
+    return h ? h : 1;
+}
+
+static const char *getRuntimePath() {
+    if (runtimePath == NULL) {
+        const char *env = getenv("LAB_RUNTIME_FILE");
+        const char *home = getenv("HOME");
+        if (env != NULL) {
+            runtimePath = strdup(env);
+        } else if (home != NULL) {
+            size_t n = strlen(home) + sizeof("/.lab_runtimes");
+            runtimePath = malloc(n);
+            snprintf(runtimePath, n, "%s/.lab_runtimes", home);
+        }
+    }
+    return runtimePath;
+}
+
+static RuntimeRecord *findSlot(uint64_t key) {
+    size_t mask = tableCapacity - 1;
+    size_t i = key & mask;
+    while (table[i].key != 0 && table[i].key != key) {
+        i = (i + 1) & mask; // linear probing
+    }
+    return &table[i];
+}
+
+static void tableInsert(const RuntimeRecord *rec) {
+    if ((tableUsed + 1) * 4 > tableCapacity * 3) {
+        size_t oldCapacity = tableCapacity;
+        RuntimeRecord *old = table;
+        tableCapacity = oldCapacity ? oldCapacity * 2 : 256;
+        table = calloc(tableCapacity, sizeof(RuntimeRecord));
+        tableUsed = 0;
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].key != 0) {
+                *findSlot(old[i].key) = old[i];
+                tableUsed++;
+            }
+        }
+        free(old);
+    }
+
+    RuntimeRecord *slot = findSlot(rec->key);
+    if (slot->key == 0) {
+        tableUsed++;
+    }
+    *slot = *rec;
+}
+
+// Function to read the records after the magic into the table, returns how
+// many there were
+static size_t readRecords(FILE *f) {
+    uint32_t magic = 0;
+    size_t records = 0;
+    if (fread(&magic, sizeof(magic), 1, f) == 1 && magic == RUNTIME_MAGIC) {
+        RuntimeRecord buf[256];
+        size_t got;
+        while ((got = fread(buf, sizeof(RuntimeRecord), 256, f)) > 0) {
+            for (size_t i = 0; i < got; i++) {
+                if (buf[i].key != 0) {
+                    tableInsert(&buf[i]); // later records replace older ones
+                }
+            }
+            records += got;
+        }
+    }
+    return records;
+}
+
+// Function to rewrite the file with one record per key. It holds the lock
+// appends take and reads the file again first, so a record another shell
+// added since the load is in the new file.
+static void compactFile(const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return;
+    }
+    if (flock(fileno(in), LOCK_EX) != 0) {
+        fclose(in);
+        return;
+    }
+    readRecords(in);
+
+    size_t n = strlen(path) + 5;
+    char *tmp = malloc(n);
+    snprintf(tmp, n, "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "wb");
+    if (f != NULL) {
+        uint32_t magic = RUNTIME_MAGIC;
+        bool ok = fwrite(&magic, sizeof(magic), 1, f) == 1;
+        for (size_t i = 0; ok && i < tableCapacity; i++) {
+            if (table[i].key != 0) {
+                ok = fwrite(&table[i], sizeof(RuntimeRecord), 1, f) == 1;
+            }
+        }
+        if (fclose(f) == 0 && ok) {
+            rename(tmp, path);
+        } else {
+            unlink(tmp);
+        }
+    }
+    free(tmp);
+    fclose(in); // drops the lock
+}
+
+static void loadTable() {
+    loaded = true;
+    const char *path = getRuntimePath();
+    if (path == NULL) {
+        return;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return;
+    }
+    size_t records = readRecords(f);
+    fclose(f);
+
+    if (records > 64 && records > tableUsed * 2) {
+        compactFile(path);
+    }
+}
+
+// Function to open the file for an append and lock it. A file that was
+// replaced by a rewrite while waiting for the lock is opened again.
+static int openLocked(const char *path) {
+    for (int tries = 0; tries < 4; tries++) {
+        int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+        if (fd < 0) {
+            return -1;
+        }
+        struct stat st;
+        struct stat now;
+        if (flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0 && stat(path, &now) == 0 &&
+            st.st_ino == now.st_ino && st.st_dev == now.st_dev) {
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+void runtime_record(uint64_t key, double seconds) {
+    if (key == 0 || seconds < 0) {
+        return;
+    }
+    if (!loaded) {
+        loadTable();
+    }
+
+    RuntimeRecord rec = {key, (float)seconds, 1};
+    if (tableCapacity > 0) {
+        RuntimeRecord *old = findSlot(key);
+        if (old->key == key) {
+            uint32_t weight = old->count < RUNTIME_MAX_WEIGHT ? old->count + 1 : RUNTIME_MAX_WEIGHT;
+            rec.seconds = old->seconds + (float)(seconds - old->seconds) / weight;
+            rec.count = old->count + 1;
+        }
+    }
+    tableInsert(&rec);
+
+    const char *path = getRuntimePath();
+    if (path == NULL) {
+        return;
+    }
+    int fd = openLocked(path);
+    if (fd < 0) {
+        return;
+    }
+
+    // under the lock only one shell can find the file empty and add the magic
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        uint32_t magic = RUNTIME_MAGIC;
+        if (write(fd, &magic, sizeof(magic)) != sizeof(magic)) {
+            close(fd);
+            return;
+        }
+    }
+    if (write(fd, &rec, sizeof(rec)) != sizeof(rec)) {
+        perror("runtime history");
+    }
+    close(fd); // drops the lock
+}
+
+double runtime_estimate(uint64_t key) {
+    if (!loaded) {
+        loadTable();
+    }
+    if (key == 0 || tableCapacity == 0) {
+        return -1;
+    }
+
+    RuntimeRecord *slot = findSlot(key);
+    return slot->key == key ? slot->seconds : -1;
+}
+
+void runtime_free() {
+    free(table);
+    free(runtimePath);
+    table = NULL;
+    runtimePath = NULL;
+    tableCapacity = 0;
+    tableUsed = 0;
+    loaded = false;
+}
+
+/*
+Runtime history end-----------------------------------------
+*/
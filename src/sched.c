@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "lab.h"
+
+/*
+Job scheduling -----------------------------------------
+The decisions behind the background job queue, kept apart from the job
+table, the fork and the signals so they can be checked on their own: what
+a reaped child adds to the session totals, how many queued jobs may start,
+whether a job's dependencies let it run and when pressure stops or resumes
+jobs. lab.c gathers the state, asks here, and then acts on the answer.
+*/
+
+void sched_add_usage(struct rusage *total, const struct rusage *usage) {
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = usage->ru_maxrss; // peak, not a sum
+    }
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+int sched_format_usage(char *buf, size_t size, const struct rusage *usage, double wall) {
+    int n = wall >= 0 ? snprintf(buf, size, "wall %.3fs  ", wall) : 0;
+    if (n < 0 || (size_t)n >= size) {
+        return n;
+    }
+    int rest = snprintf(buf + n, size - n, "user %.3fs  sys %.3fs  maxrss %ldkB  csw %ld/%ld",
+                        usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+                        usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6, usage->ru_maxrss,
+                        usage->ru_nvcsw, usage->ru_nivcsw);
+    return rest < 0 ? rest : n + rest;
+}
+
+int sched_slots(int limit, int running, int stopped, bool high) {
+    if (high || limit <= 0) {
+        return 0; // nothing new starts while pressure is over the limit
+    }
+    int left = limit - running - stopped; // a stopped job keeps its slot
+    return left > 0 ? left : 0;
+}
+
+char sched_deps(const int *after, int afterCount, const char *outcomes, int outcomeCount) {
+    char result = JOB_SUCCEEDED;
+    for (int i = 0; i < afterCount; i++) {
+        char outcome = after[i] < outcomeCount ? outcomes[after[i]] : JOB_UNKNOWN;
+        if (outcome == JOB_FAILED) {
+            return JOB_FAILED; // one failure is enough, no need to wait for the rest
+        }
+        if (outcome == JOB_UNKNOWN) {
+            result = JOB_UNKNOWN;
+        }
+    }
+    return result;
+}
+
+bool sched_pressure_high(double cpu, double mem, double cpuLimit, double memLimit) {
+    // a missing PSI file reads as -1 and never trips a limit
+    return (cpuLimit > 0 && cpu >= cpuLimit) || (memLimit > 0 && mem >= memLimit);
+}
+
+bool sched_should_throttle(bool high, bool stopJobs, int running) {
+    return high && stopJobs && running > 1; // one job always keeps running
+}
+
+bool sched_should_resume(bool high, int stopped) {
+    return !high && stopped > 0;
+}
+
+int sched_victim(const int *nice, int count) {
+    int pick = -1;
+    for (int i = 0; i < count; i++) {
+        if (pick < 0 || nice[i] >= nice[pick]) {
+            pick = i; // >= so the newest wins a tie
+        }
+    }
+    return pick;
+}
+
+/*
+Job scheduling end-----------------------------------------
+*/
@@ -0,0 +1,1455 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+Scripts -----------------------------------------
+A line, or a file given to source, is compiled once into a small program
+and then run by a dispatch loop. The compiler is a recursive descent parser
+over the tokens of the text that emits ops as it goes: simple commands keep
+their words as cmd_parse would split them, and if, while, until, for, case,
+&&, || and ! become jumps between them. A loop body is never tokenized
+again, each pass only expands the words of its commands, and builtins run
+in the shell. A for loop over a brace range like {1..1000000} takes its
+values from the brace generator one at a time instead of building the list.
+
+A function definition compiles its body into a program of its own, which
+the definition puts in a hash table by name when it runs. A call looks the
+name up before the builtins and PATH and runs the body right here, so a
+wrapper around git costs a lookup rather than starting another shell. The
+arguments of each call are copied into one growing arena and the frame
+only keeps offsets into it, so a call is a push of a few numbers and a
+return drops them all at once.
+
+The only redirection is < file, after a simple command or a compound one
+like while read line; do ...; done < file. It puts a redirect op before the
+command and a pop after it. Every compound command starts with a jump to
+the next op that becomes the redirect when one follows it. A break, return
+or continue that jumps out of the ops between the two pops the redirect on
+the way, so stdin is put back whichever way the command is left.
+*/
+
+#define OP_RUN 0 // run commands[arg]
+#define OP_ARITH 1 // (( commands[arg] ))
+#define OP_JUMP 2
+#define OP_JUMP_FALSE 3 // jump if the status is not 0
+#define OP_JUMP_TRUE 4
+#define OP_NOT 5
+#define OP_TRUE 6
+#define OP_FOR_INIT 7 // expand the list of commands[arg], the variable is its first word
+#define OP_FOR_NEXT 8 // set the variable to the next value or pop the loop and jump
+#define OP_FOR_POP 9 // for break
+#define OP_CASE 10 // expand the word commands[arg] to match against
+#define OP_CASE_TEST 11 // jump unless one of the patterns in commands[arg] matches
+#define OP_CASE_POP 12
+#define OP_DEFINE 13 // put the function commands[arg] in the table
+#define OP_REDIRECT 14 // stdin from the file commands[arg] until the pop at target
+#define OP_REDIRECT_POP 15
+
+#define FUNC_MAX_DEPTH 1000
+
+#define TOK_WORD 0
+#define TOK_NEWLINE 1
+#define TOK_SEMI 2
+#define TOK_DSEMI 3
+#define TOK_AND 4
+#define TOK_OR 5
+#define TOK_AMP 6
+#define TOK_PIPE 7
+#define TOK_LPAREN 8
+#define TOK_RPAREN 9
+#define TOK_ARITH 10 // (( expr )), the token is the expression
+#define TOK_END 11
+
+#define CONSTRUCT_LOOP 0
+#define CONSTRUCT_FOR 1
+#define CONSTRUCT_CASE 2
+
+typedef struct {
+    uint8_t code;
+    uint32_t arg;
+    uint32_t target;
+} Op;
+
+typedef struct {
+    char **words; // as cmd_parse splits them, expanded each time they run
+    char *text; // for the job table
+    bool background;
+    struct glob_matcher *matchers; // case patterns compiled once, NULL if they need expanding
+    struct script *body; // of a function definition
+} Command;
+
+struct script {
+    Op *ops;
+    size_t opCount;
+    size_t opCapacity;
+    Command *commands;
+    size_t commandCount;
+    size_t commandCapacity;
+    int refs; // a function body is shared by the table and the calls running it
+};
+
+typedef struct {
+    uint64_t hash; // 0 marks an empty slot
+    char *name;
+    struct script *body;
+} Function;
+
+// the arguments of one call, $1 is at argOffsets[first]
+typedef struct {
+    size_t first;
+    size_t count;
+    size_t arenaMark; // where its strings start
+} Frame;
+
+typedef struct {
+    int type;
+    const char *start;
+    size_t len;
+} Token;
+
+// a loop or case being compiled, for break and continue
+typedef struct {
+    int kind;
+    size_t continueTarget;
+    size_t *breaks; // jumps to patch with the end of the loop
+    size_t breakCount;
+} Construct;
+
+typedef struct {
+    const char *p;
+    Token tok;
+    struct script *s;
+    Construct *constructs;
+    size_t constructCount;
+    bool failed;
+    bool incomplete; // failed at the end of the text, more lines may finish it
+} Parser;
+
+// stdin while a < file is in effect, start and end are the redirect op
+// and its pop
+typedef struct {
+    int saved;
+    size_t start;
+    size_t end;
+} Redirect;
+
+// a running for loop
+typedef struct {
+    const char *name;
+    char **values; // one block from sh_expand
+    size_t next;
+    struct brace_gen braces;
+    bool lazy; // values come from braces
+} Loop;
+
+static struct shell defaultShell; // when there is no interactive shell, like in the tests
+static struct shell *currentShell = &defaultShell;
+static volatile sig_atomic_t interrupted = 0;
+static int depth = 0;
+static bool returning = false; // return ran, the function stops
+static int sourcing = 0;
+
+static Function *functions = NULL;
+static size_t functionCapacity = 0; // power of two
+static size_t functionUsed = 0;
+
+static Frame *frames = NULL;
+static size_t frameCount = 0;
+static size_t frameCapacity = 0;
+static char *arena = NULL;
+static size_t arenaLen = 0;
+static size_t arenaCap = 0;
+static size_t *argOffsets = NULL; // into the arena, so it can move
+static size_t argCount = 0;
+static size_t argCapacity = 0;
+static char *joined = NULL; // $* and $@ outside of a word list
+static Redirect *redirects = NULL;
+static size_t redirectCount = 0;
+static size_t redirectCapacity = 0;
+
+static Function *findFunction(const char *name);
+
+static void *growArray(void *items, size_t *capacity, size_t size) {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    items = realloc(items, *capacity * size);
+    if (items == NULL) {
+        perror("Reallocating failed");
+        exit(EXIT_FAILURE);
+    }
+    return items;
+}
+
+static size_t emit(Parser *ps, uint8_t code, uint32_t arg) {
+    struct script *s = ps->s;
+    if (s->opCount == s->opCapacity) {
+        s->ops = growArray(s->ops, &s->opCapacity, sizeof(Op));
+    }
+    s->ops[s->opCount] = (Op){code, arg, 0};
+    return s->opCount++;
+}
+
+static void patch(Parser *ps, size_t op, size_t target) {
+    ps->s->ops[op].target = (uint32_t)target;
+}
+
+static uint32_t addCommand(Parser *ps, char **words, const char *text, size_t textLen) {
+    struct script *s = ps->s;
+    if (s->commandCount == s->commandCapacity) {
+        s->commands = growArray(s->commands, &s->commandCapacity, sizeof(Command));
+    }
+    s->commands[s->commandCount] = (Command){words, strndup(text, textLen), false, NULL, NULL};
+    return (uint32_t)s->commandCount++;
+}
+
+/*
+Tokens -----------------------------------------
+*/
+
+// Function to check that the quotes and $( ) of a word are closed
+static bool wordClosed(const char *start, const char *end) {
+    for (const char *p = start; p < end;) {
+        const char *next = cmd_skip(p);
+        if (*next == '\0' && next - p > 0) {
+            char open = *p;
+            char last = next[-1];
+            size_t len = next - p;
+            if ((open == '\'' || open == '"' || open == '`') && (len < 2 || last != open)) {
+                return false;
+            }
+            if (open == '$' && (p[1] == '(' || p[1] == '{') && (len < 3 || last != (p[1] == '(' ? ')' : '}'))) {
+                return false;
+            }
+        }
+        p = next;
+    }
+    return true;
+}
+
+static void nextToken(Parser *ps) {
+    const char *p = ps->p;
+    while (true) {
+        p += strspn(p, " \t");
+        if (p[0] == '\\' && p[1] == '\n') {
+            p += 2; // the line goes on
+        } else if (*p == '#') {
+            p += strcspn(p, "\n");
+        } else {
+            break;
+        }
+    }
+    Token *t = &ps->tok;
+    t->start = p;
+    t->len = 1;
+    switch (*p) {
+    case '\0':
+        t->type = TOK_END;
+        t->len = 0;
+        break;
+    case '\n':
+        t->type = TOK_NEWLINE;
+        break;
+    case ';':
+        t->type = p[1] == ';' ? TOK_DSEMI : TOK_SEMI;
+        break;
+    case '&':
+        t->type = p[1] == '&' ? TOK_AND : TOK_AMP;
+        break;
+    case '|':
+        t->type = p[1] == '|' ? TOK_OR : TOK_PIPE;
+        break;
+    case ')':
+        t->type = TOK_RPAREN;
+        break;
+    case '(':
+        t->type = TOK_LPAREN;
+        if (p[1] == '(') {
+            const char *close = p + 2;
+            for (int open = 1; *close != '\0' && open > 0;) {
+                open += *close == '(' ? 1 : *close == ')' ? -1 : 0;
+                close = open > 0 ? cmd_skip(close) : close;
+            }
+            if (*close == ')' && close[1] == ')') {
+                t->type = TOK_ARITH;
+                t->start = p + 2;
+                t->len = close - (p + 2);
+                ps->p = close + 2;
+                return;
+            }
+            if (*close == '\0') {
+                ps->incomplete = true;
+            }
+        }
+        break;
+    default:
+        t->type = TOK_WORD;
+        t->len = cmd_word_end(p, " \t\n;&|()") - p;
+        if (!wordClosed(p, p + t->len)) {
+            ps->incomplete = true;
+            ps->failed = true;
+        }
+        break;
+    }
+    if (t->type == TOK_DSEMI || t->type == TOK_AND || t->type == TOK_OR) {
+        t->len = 2;
+    }
+    ps->p = t->start + t->len;
+}
+
+static bool isWord(Parser *ps, const char *word) {
+    return ps->tok.type == TOK_WORD && ps->tok.len == strlen(word) && strncmp(ps->tok.start, word, ps->tok.len) == 0;
+}
+
+// Function to check for a keyword that ends a list, or the end of the text
+static bool atListEnd(Parser *ps) {
+    static const char *ends[] = {"then", "elif", "else", "fi", "do", "done", "esac", "}"};
+    int type = ps->tok.type;
+    if (type == TOK_END || type == TOK_RPAREN || type == TOK_DSEMI) {
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(ends) / sizeof(ends[0]); i++) {
+        if (isWord(ps, ends[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void syntaxError(Parser *ps) {
+    if (ps->failed) {
+        return;
+    }
+    ps->failed = true;
+    if (ps->tok.type == TOK_END) {
+        ps->incomplete = true; // an if or a loop is still open
+        return;
+    }
+    const char *text = ps->tok.type == TOK_NEWLINE ? "newline" : NULL;
+    fprintf(stderr, "syntax error near unexpected token `%.*s'\n", text ? (int)strlen(text) : (int)ps->tok.len,
+            text ? text : ps->tok.start);
+}
+
+static void expect(Parser *ps, const char *keyword) {
+    if (isWord(ps, keyword)) {
+        nextToken(ps);
+    } else {
+        syntaxError(ps);
+    }
+}
+
+static void skipNewlines(Parser *ps) {
+    while (ps->tok.type == TOK_NEWLINE) {
+        nextToken(ps);
+    }
+}
+
+/*
+Compiler -----------------------------------------
+*/
+
+static void parseList(Parser *ps);
+
+static void pushConstruct(Parser *ps, int kind, size_t continueTarget) {
+    ps->constructs = realloc(ps->constructs, (ps->constructCount + 1) * sizeof(Construct));
+    if (ps->constructs == NULL) {
+        perror("Reallocating failed");
+        exit(EXIT_FAILURE);
+    }
+    ps->constructs[ps->constructCount++] = (Construct){kind, continueTarget, NULL, 0};
+}
+
+// Function to end a loop, its breaks go to target
+static void popConstruct(Parser *ps, size_t target) {
+    Construct *c = &ps->constructs[--ps->constructCount];
+    for (size_t i = 0; i < c->breakCount; i++) {
+        patch(ps, c->breaks[i], target);
+    }
+    free(c->breaks);
+}
+
+static void addBreak(Construct *c, size_t op) {
+    c->breaks = realloc(c->breaks, (c->breakCount + 1) * sizeof(size_t));
+    if (c->breaks == NULL) {
+        perror("Reallocating failed");
+        exit(EXIT_FAILURE);
+    }
+    c->breaks[c->breakCount++] = op;
+}
+
+// Function for break n and continue n, the for loops and cases left on the
+// way out are popped before the jump
+static void compileJump(Parser *ps, char **words, bool isBreak) {
+    size_t loops = 0;
+    for (size_t i = 0; i < ps->constructCount; i++) {
+        loops += ps->constructs[i].kind != CONSTRUCT_CASE;
+    }
+    if (loops == 0) {
+        fprintf(stderr, "%s: only meaningful in a `for', `while', or `until' loop\n", words[0]);
+        emit(ps, OP_TRUE, 0);
+        return;
+    }
+    long levels = words[1] != NULL ? strtol(words[1], NULL, 10) : 1;
+    if (levels < 1) {
+        fprintf(stderr, "%s: %s: loop count out of range\n", words[0], words[1]);
+        levels = 1;
+    }
+    if ((size_t)levels > loops) {
+        levels = (long)loops; // break 5 in two loops leaves both
+    }
+    for (size_t i = ps->constructCount; i > 0; i--) {
+        Construct *c = &ps->constructs[i - 1];
+        if (c->kind != CONSTRUCT_CASE && --levels == 0) {
+            if (isBreak) {
+                addBreak(c, emit(ps, OP_JUMP, 0));
+            } else {
+                patch(ps, emit(ps, OP_JUMP, 0), c->continueTarget);
+            }
+            return;
+        }
+        if (c->kind != CONSTRUCT_LOOP) {
+            emit(ps, c->kind == CONSTRUCT_CASE ? OP_CASE_POP : OP_FOR_POP, 0);
+        }
+    }
+}
+
+static char **collectWords(Parser *ps, const char **end) {
+    size_t count = 0, capacity = 8;
+    char **words = malloc(capacity * sizeof(char *));
+    while (ps->tok.type == TOK_WORD && !ps->failed) {
+        if (count + 1 >= capacity) {
+            words = growArray(words, &capacity, sizeof(char *));
+        }
+        words[count++] = strndup(ps->tok.start, ps->tok.len);
+        *end = ps->tok.start + ps->tok.len;
+        nextToken(ps);
+    }
+    words[count] = NULL;
+    return words;
+}
+
+// Function to check for a < file word, <<, a here document, is not one
+static bool isRedirect(const char *word, size_t len) {
+    return len > 0 && word[0] == '<' && (len == 1 || word[1] != '<');
+}
+
+// Function to take < file or <file out of the words of a simple command,
+// the file word or NULL if there is none. The last one wins.
+static char *takeRedirect(Parser *ps, char **words) {
+    char *file = NULL;
+    size_t out = 0;
+    for (size_t i = 0; words[i] != NULL; i++) {
+        char *word = words[i];
+        if (!isRedirect(word, strlen(word))) {
+            words[out++] = word;
+            continue;
+        }
+        free(file);
+        file = NULL;
+        if (word[1] != '\0') {
+            file = strdup(word + 1);
+        } else if (words[i + 1] != NULL) {
+            file = words[++i];
+        } else if (!ps->failed) {
+            fprintf(stderr, "syntax error near unexpected token `newline'\n");
+            ps->failed = true;
+        }
+        free(word);
+    }
+    words[out] = NULL;
+    return file;
+}
+
+// Function to put a redirect at the op first, a no-op jump until now, and
+// its pop at the end
+static void emitRedirect(Parser *ps, size_t first, char *file) {
+    char **words = calloc(2, sizeof(char *));
+    words[0] = file;
+    uint32_t arg = addCommand(ps, words, file, strlen(file));
+    ps->s->ops[first].code = OP_REDIRECT;
+    ps->s->ops[first].arg = arg;
+    patch(ps, first, emit(ps, OP_REDIRECT_POP, 0));
+}
+
+// Function for < file after a compound command
+static void parseRedirect(Parser *ps, size_t first) {
+    if (ps->tok.type != TOK_WORD || !isRedirect(ps->tok.start, ps->tok.len) || ps->failed) {
+        return;
+    }
+    const char *file = ps->tok.start + 1;
+    size_t len = ps->tok.len - 1;
+    if (len == 0) {
+        nextToken(ps);
+        if (ps->tok.type != TOK_WORD) {
+            syntaxError(ps);
+            return;
+        }
+        file = ps->tok.start;
+        len = ps->tok.len;
+    }
+    emitRedirect(ps, first, strndup(file, len));
+    nextToken(ps);
+}
+
+static void parseSimple(Parser *ps) {
+    const char *start = ps->tok.start, *end = start;
+    bool isBreak = isWord(ps, "break");
+    bool isContinue = isWord(ps, "continue");
+    char **words = collectWords(ps, &end);
+    char *file = takeRedirect(ps, words);
+    if (ps->tok.type == TOK_LPAREN) {
+        syntaxError(ps);
+    }
+    if (ps->failed || (file != NULL && words[0] == NULL)) {
+        if (!ps->failed) {
+            syntaxError(ps); // < file with no command
+        }
+        free(file);
+        cmd_free(words);
+        return;
+    }
+    if (isBreak || isContinue) {
+        compileJump(ps, words, isBreak);
+        free(file);
+        cmd_free(words);
+        return;
+    }
+    char **aliased = alias_expand(words); // once, when it is compiled
+    if (aliased != NULL) {
+        cmd_free(words);
+        words = aliased;
+    }
+    size_t first = file != NULL ? emit(ps, OP_JUMP, 0) : 0;
+    emit(ps, OP_RUN, addCommand(ps, words, start, end - start));
+    if (file != NULL) {
+        emitRedirect(ps, first, file);
+    }
+}
+
+static void parseIf(Parser *ps) {
+    size_t *ends = NULL;
+    size_t endCount = 0;
+    nextToken(ps);
+    parseList(ps);
+    expect(ps, "then");
+    size_t test = emit(ps, OP_JUMP_FALSE, 0);
+    parseList(ps);
+    bool otherwise = false;
+    while (!ps->failed && (isWord(ps, "elif") || isWord(ps, "else"))) {
+        ends = realloc(ends, (endCount + 1) * sizeof(size_t));
+        ends[endCount++] = emit(ps, OP_JUMP, 0);
+        patch(ps, test, ps->s->opCount);
+        if (isWord(ps, "else")) {
+            nextToken(ps);
+            parseList(ps);
+            otherwise = true;
+            break;
+        }
+        nextToken(ps);
+        parseList(ps);
+        expect(ps, "then");
+        test = emit(ps, OP_JUMP_FALSE, 0);
+        parseList(ps);
+    }
+    if (!otherwise) {
+        // no branch ran, the status is 0
+        ends = realloc(ends, (endCount + 1) * sizeof(size_t));
+        ends[endCount++] = emit(ps, OP_JUMP, 0);
+        patch(ps, test, ps->s->opCount);
+        emit(ps, OP_TRUE, 0);
+    }
+    expect(ps, "fi");
+    for (size_t i = 0; i < endCount; i++) {
+        patch(ps, ends[i], ps->s->opCount);
+    }
+    free(ends);
+}
+
+static void parseWhile(Parser *ps) {
+    bool until = isWord(ps, "until");
+    nextToken(ps);
+    size_t top = ps->s->opCount;
+    parseList(ps);
+    expect(ps, "do");
+    size_t test = emit(ps, until ? OP_JUMP_TRUE : OP_JUMP_FALSE, 0);
+    pushConstruct(ps, CONSTRUCT_LOOP, top);
+    parseList(ps);
+    expect(ps, "done");
+    patch(ps, emit(ps, OP_JUMP, 0), top);
+    patch(ps, test, ps->s->opCount);
+    popConstruct(ps, ps->s->opCount);
+    emit(ps, OP_TRUE, 0);
+}
+
+static void parseFor(Parser *ps) {
+    nextToken(ps);
+    if (ps->tok.type != TOK_WORD || var_name_length(ps->tok.start) != ps->tok.len) {
+        syntaxError(ps);
+        return;
+    }
+    const char *start = ps->tok.start, *end = start;
+    char *name = strndup(ps->tok.start, ps->tok.len);
+    nextToken(ps);
+    skipNewlines(ps);
+    char **words;
+    if (isWord(ps, "in")) {
+        nextToken(ps);
+        words = collectWords(ps, &end);
+    } else {
+        words = calloc(3, sizeof(char *)); // no list is the arguments
+        words[0] = strdup("\"$@\"");
+    }
+    size_t count = 0;
+    while (words[count] != NULL) {
+        count++;
+    }
+    memmove(words + 1, words, (count + 1) * sizeof(char *)); // collectWords left room for one more
+    words[0] = name;
+    uint32_t list = addCommand(ps, words, start, end - start);
+    if (ps->tok.type == TOK_SEMI) {
+        nextToken(ps);
+    }
+    skipNewlines(ps);
+    expect(ps, "do");
+    emit(ps, OP_FOR_INIT, list);
+    size_t next = emit(ps, OP_FOR_NEXT, list);
+    pushConstruct(ps, CONSTRUCT_FOR, next);
+    parseList(ps);
+    expect(ps, "done");
+    patch(ps, emit(ps, OP_JUMP, 0), next);
+    popConstruct(ps, emit(ps, OP_FOR_POP, 0));
+    patch(ps, next, ps->s->opCount);
+}
+
+// Function to compile the patterns of a case item once if they have nothing to expand
+static void compilePatterns(Command *c) {
+    size_t count = 0;
+    for (; c->words[count] != NULL; count++) {
+        if (strpbrk(c->words[count], "$`") != NULL) {
+            return;
+        }
+    }
+    c->matchers = calloc(count, sizeof(struct glob_matcher));
+    for (size_t i = 0; i < count; i++) {
+        char *pattern = sh_expand_word(c->words[i], true);
+        glob_compile(&c->matchers[i], pattern, strlen(pattern));
+        free(pattern);
+    }
+}
+
+static void parseCase(Parser *ps) {
+    nextToken(ps);
+    if (ps->tok.type != TOK_WORD) {
+        syntaxError(ps);
+        return;
+    }
+    char **subject = calloc(2, sizeof(char *));
+    subject[0] = strndup(ps->tok.start, ps->tok.len);
+    emit(ps, OP_CASE, addCommand(ps, subject, ps->tok.start, ps->tok.len));
+    nextToken(ps);
+    skipNewlines(ps);
+    expect(ps, "in");
+    skipNewlines(ps);
+    pushConstruct(ps, CONSTRUCT_CASE, 0);
+    while (!ps->failed && !isWord(ps, "esac")) {
+        if (ps->tok.type == TOK_LPAREN) {
+            nextToken(ps);
+        }
+        // a|b) as the words a and b
+        size_t count = 0;
+        char **patterns = calloc(2, sizeof(char *));
+        const char *start = ps->tok.start, *end = start;
+        while (ps->tok.type == TOK_WORD) {
+            patterns = realloc(patterns, (count + 2) * sizeof(char *));
+            patterns[count++] = strndup(ps->tok.start, ps->tok.len);
+            patterns[count] = NULL;
+            end = ps->tok.start + ps->tok.len;
+            nextToken(ps);
+            if (ps->tok.type != TOK_PIPE) {
+                break;
+            }
+            nextToken(ps);
+        }
+        if (count == 0 || ps->tok.type != TOK_RPAREN) {
+            cmd_free(patterns);
+            syntaxError(ps);
+            break;
+        }
+        nextToken(ps);
+        uint32_t item = addCommand(ps, patterns, start, end - start);
+        compilePatterns(&ps->s->commands[item]);
+        size_t test = emit(ps, OP_CASE_TEST, item);
+        parseList(ps);
+        addBreak(&ps->constructs[ps->constructCount - 1], emit(ps, OP_JUMP, 0)); // to the end of the case
+        patch(ps, test, ps->s->opCount);
+        if (ps->tok.type == TOK_DSEMI) {
+            nextToken(ps);
+            skipNewlines(ps);
+        } else if (!isWord(ps, "esac")) {
+            syntaxError(ps);
+        }
+    }
+    if (ps->tok.type == TOK_END) {
+        syntaxError(ps);
+    }
+    popConstruct(ps, emit(ps, OP_CASE_POP, 0));
+    expect(ps, "esac");
+}
+
+// Function to check for name() or function name
+static bool atFunction(Parser *ps) {
+    if (isWord(ps, "function")) {
+        return true;
+    }
+    const char *p = ps->p + strspn(ps->p, " \t");
+    if (ps->tok.type != TOK_WORD || *p != '(') {
+        return false;
+    }
+    p += 1 + strspn(p + 1, " \t");
+    return *p == ')';
+}
+
+static void parseCommand(Parser *ps);
+
+// Function to compile the body of a function into a program of its own, the
+// definition runs when the op is reached
+static void parseFunction(Parser *ps) {
+    bool keyword = isWord(ps, "function");
+    if (keyword) {
+        nextToken(ps);
+    }
+    const char *start = ps->tok.start;
+    size_t len = ps->tok.len;
+    bool plain = ps->tok.type == TOK_WORD;
+    for (size_t i = 0; plain && i < len; i++) {
+        plain = strchr("$`'\"\\=", start[i]) == NULL; // a name, not something to expand
+    }
+    if (!plain) {
+        syntaxError(ps);
+        return;
+    }
+    nextToken(ps);
+    if (ps->tok.type == TOK_LPAREN) {
+        nextToken(ps);
+        if (ps->tok.type != TOK_RPAREN) {
+            syntaxError(ps);
+            return;
+        }
+        nextToken(ps);
+    } else if (!keyword) {
+        syntaxError(ps);
+        return;
+    }
+    skipNewlines(ps);
+    static const char *compound[] = {"{", "if", "while", "until", "for", "case"};
+    bool isCompound = ps->tok.type == TOK_ARITH;
+    for (size_t i = 0; i < sizeof(compound) / sizeof(compound[0]); i++) {
+        isCompound = isCompound || isWord(ps, compound[i]);
+    }
+    if (!isCompound) {
+        syntaxError(ps);
+        return;
+    }
+
+    // break and continue in the body do not reach the loops around it
+    struct script *outer = ps->s;
+    Construct *constructs = ps->constructs;
+    size_t constructCount = ps->constructCount;
+    ps->s = calloc(1, sizeof(struct script));
+    ps->s->refs = 1;
+    ps->constructs = NULL;
+    ps->constructCount = 0;
+    parseCommand(ps);
+    while (ps->constructCount > 0) {
+        popConstruct(ps, 0);
+    }
+    free(ps->constructs);
+    struct script *body = ps->s;
+    ps->s = outer;
+    ps->constructs = constructs;
+    ps->constructCount = constructCount;
+    if (ps->failed) {
+        script_free(body);
+        return;
+    }
+
+    char **words = calloc(2, sizeof(char *));
+    words[0] = strndup(start, len);
+    uint32_t definition = addCommand(ps, words, start, len);
+    ps->s->commands[definition].body = body;
+    emit(ps, OP_DEFINE, definition);
+}
+
+static void parseCommand(Parser *ps) {
+    if (atFunction(ps)) {
+        parseFunction(ps);
+        return;
+    }
+    if (ps->tok.type == TOK_WORD && !isWord(ps, "if") && !isWord(ps, "while") && !isWord(ps, "until") &&
+        !isWord(ps, "for") && !isWord(ps, "case") && !isWord(ps, "{")) {
+        parseSimple(ps); // it takes its own < file
+        return;
+    }
+    if (ps->tok.type == TOK_ARITH) {
+        char **words = calloc(2, sizeof(char *));
+        words[0] = strndup(ps->tok.start, ps->tok.len);
+        emit(ps, OP_ARITH, addCommand(ps, words, ps->tok.start, ps->tok.len));
+        nextToken(ps);
+        return;
+    }
+
+    size_t first = emit(ps, OP_JUMP, 0); // to the next op, or the redirect of < file after it
+    patch(ps, first, first + 1);
+    if (isWord(ps, "if")) {
+        parseIf(ps);
+    } else if (isWord(ps, "while") || isWord(ps, "until")) {
+        parseWhile(ps);
+    } else if (isWord(ps, "for")) {
+        parseFor(ps);
+    } else if (isWord(ps, "case")) {
+        parseCase(ps);
+    } else if (isWord(ps, "{")) {
+        nextToken(ps);
+        parseList(ps);
+        expect(ps, "}");
+    } else {
+        syntaxError(ps);
+    }
+    parseRedirect(ps, first);
+}
+
+static void parsePipeline(Parser *ps) {
+    bool negate = isWord(ps, "!");
+    if (negate) {
+        nextToken(ps);
+    }
+    parseCommand(ps);
+    if (ps->tok.type == TOK_PIPE && !ps->failed) {
+        fprintf(stderr, "pipes are not supported\n");
+        ps->failed = true;
+    }
+    if (negate) {
+        emit(ps, OP_NOT, 0);
+    }
+}
+
+static void parseAndOr(Parser *ps) {
+    parsePipeline(ps);
+    while (!ps->failed && (ps->tok.type == TOK_AND || ps->tok.type == TOK_OR)) {
+        bool and = ps->tok.type == TOK_AND;
+        nextToken(ps);
+        skipNewlines(ps);
+        size_t skip = emit(ps, and ? OP_JUMP_FALSE : OP_JUMP_TRUE, 0);
+        parsePipeline(ps);
+        patch(ps, skip, ps->s->opCount);
+    }
+}
+
+// Function to compile commands separated by ; & and newlines up to a keyword
+// that ends them
+static void parseList(Parser *ps) {
+    skipNewlines(ps);
+    while (!ps->failed && !atListEnd(ps)) {
+        size_t first = ps->s->opCount;
+        parseAndOr(ps);
+        if (ps->tok.type == TOK_AMP) {
+            Op *op = &ps->s->ops[first];
+            if (ps->s->opCount == first + 1 && op->code == OP_RUN) {
+                Command *c = &ps->s->commands[op->arg];
+                c->background = true;
+                c->text = realloc(c->text, strlen(c->text) + 3);
+                strcat(c->text, " &");
+            } else if (!ps->failed) {
+                fprintf(stderr, "only a simple command can run in the background\n");
+            }
+        }
+        if (ps->tok.type == TOK_SEMI || ps->tok.type == TOK_AMP || ps->tok.type == TOK_NEWLINE) {
+            nextToken(ps);
+            skipNewlines(ps);
+        } else if (!atListEnd(ps)) {
+            syntaxError(ps);
+        }
+    }
+}
+
+struct script *script_compile(const char *text, bool *incomplete) {
+    Parser ps = {text, {0, NULL, 0}, calloc(1, sizeof(struct script)), NULL, 0, false, false};
+    ps.s->refs = 1;
+    nextToken(&ps);
+    parseList(&ps);
+    if (!ps.failed && ps.tok.type != TOK_END) {
+        syntaxError(&ps);
+    }
+    while (ps.constructCount > 0) {
+        popConstruct(&ps, 0);
+    }
+    free(ps.constructs);
+    *incomplete = ps.failed && ps.incomplete;
+    if (ps.failed) {
+        script_free(ps.s);
+        return NULL;
+    }
+    return ps.s;
+}
+
+void script_free(struct script *s) {
+    if (s == NULL || --s->refs > 0) {
+        return;
+    }
+    for (size_t i = 0; i < s->commandCount; i++) {
+        Command *c = &s->commands[i];
+        script_free(c->body);
+        for (size_t j = 0; c->matchers != NULL && c->words[j] != NULL; j++) {
+            glob_matcher_free(&c->matchers[j]);
+        }
+        free(c->matchers);
+        cmd_free(c->words);
+        free(c->text);
+    }
+    free(s->commands);
+    free(s->ops);
+    free(s);
+}
+
+char **script_simple(struct script *s) {
+    if (s->opCount != 1 || s->ops[0].code != OP_RUN || s->commands[s->ops[0].arg].background) {
+        return NULL;
+    }
+    char **words = s->commands[s->ops[0].arg].words;
+    return findFunction(words[0]) == NULL ? words : NULL;
+}
+
+/*
+Functions -----------------------------------------
+*/
+
+// FNV-1a
+static uint64_t hashName(const char *name) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char *p = name; *p; p++) {
+        h ^= (unsigned char)*p;
+        h *= 0x100000001b3ull;
+    }
+    return h ? h : 1;
+}
+
+static Function *findSlot(const char *name, uint64_t hash) {
+    size_t mask = functionCapacity - 1;
+    size_t i = hash & mask;
+    while (functions[i].hash != 0 && (functions[i].hash != hash || strcmp(functions[i].name, name) != 0)) {
+        i = (i + 1) & mask; // linear probing
+    }
+    return &functions[i];
+}
+
+static Function *findFunction(const char *name) {
+    if (functionUsed == 0) {
+        return NULL;
+    }
+    Function *f = findSlot(name, hashName(name));
+    return f->hash != 0 ? f : NULL;
+}
+
+static void growTable() {
+    size_t oldCapacity = functionCapacity;
+    Function *old = functions;
+    functionCapacity = oldCapacity ? oldCapacity * 2 : 64;
+    functions = calloc(functionCapacity, sizeof(Function));
+    if (functions == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].hash != 0) {
+            *findSlot(old[i].name, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+}
+
+static void defineFunction(const char *name, struct script *body) {
+    if ((functionUsed + 1) * 4 > functionCapacity * 3) {
+        growTable();
+    }
+    uint64_t hash = hashName(name);
+    Function *f = findSlot(name, hash);
+    body->refs++;
+    if (f->hash != 0) {
+        script_free(f->body); // a call still running it keeps its own reference
+    } else {
+        f->hash = hash;
+        f->name = strdup(name);
+        functionUsed++;
+    }
+    f->body = body;
+}
+
+// Function to copy the arguments of a call to the end of the arena
+static void pushFrame(char **argv) {
+    if (frameCount == frameCapacity) {
+        frames = growArray(frames, &frameCapacity, sizeof(Frame));
+    }
+    Frame *frame = &frames[frameCount++];
+    *frame = (Frame){argCount, 0, arenaLen};
+    for (char **a = argv + 1; *a != NULL; a++) {
+        size_t len = strlen(*a) + 1;
+        if (arenaLen + len > arenaCap) {
+            arenaCap = (arenaLen + len) * 2;
+            arena = realloc(arena, arenaCap);
+            if (arena == NULL) {
+                perror("Reallocating failed");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (argCount == argCapacity) {
+            argOffsets = growArray(argOffsets, &argCapacity, sizeof(size_t));
+        }
+        memcpy(arena + arenaLen, *a, len);
+        argOffsets[argCount++] = arenaLen;
+        arenaLen += len;
+        frame->count++;
+    }
+}
+
+static void popFrame() {
+    Frame *frame = &frames[--frameCount];
+    argCount = frame->first;
+    arenaLen = frame->arenaMark;
+}
+
+static int callFunction(struct shell *sh, Function *f, char **argv) {
+    if (frameCount >= FUNC_MAX_DEPTH) {
+        fprintf(stderr, "%s: maximum function nesting level exceeded (%d)\n", argv[0], FUNC_MAX_DEPTH);
+        return 1;
+    }
+    struct script *body = f->body;
+    body->refs++; // it may define itself again while it runs
+    pushFrame(argv);
+    int status = script_run(sh, body);
+    returning = false;
+    popFrame();
+    script_free(body);
+    return status;
+}
+
+const char *script_arg(size_t n) {
+    if (n == 0) {
+        return program_invocation_name;
+    }
+    if (frameCount == 0 || n > frames[frameCount - 1].count) {
+        return NULL;
+    }
+    return arena + argOffsets[frames[frameCount - 1].first + n - 1];
+}
+
+size_t script_arg_count() {
+    return frameCount > 0 ? frames[frameCount - 1].count : 0;
+}
+
+size_t script_each_arg(void (*fn)(const char *value, void *ctx), void *ctx) {
+    size_t count = script_arg_count();
+    for (size_t i = 1; fn != NULL && i <= count; i++) {
+        fn(script_arg(i), ctx);
+    }
+    return count;
+}
+
+const char *script_param(const char *name, size_t len) {
+    if (name[0] >= '0' && name[0] <= '9') {
+        size_t n = 0;
+        for (size_t i = 0; i < len && n < SIZE_MAX / 10; i++) {
+            n = n * 10 + (size_t)(name[i] - '0');
+        }
+        return script_arg(n);
+    }
+    free(joined);
+    joined = NULL;
+    size_t count = script_arg_count();
+    if (name[0] == '#') {
+        if (asprintf(&joined, "%zu", count) < 0) {
+            joined = NULL;
+        }
+        return joined;
+    }
+    // $* and $@ outside a word list are the arguments joined with spaces
+    size_t size = 1;
+    for (size_t i = 1; i <= count; i++) {
+        size += strlen(script_arg(i)) + 1;
+    }
+    joined = malloc(size);
+    if (joined == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    joined[0] = '\0';
+    for (size_t i = 1; i <= count; i++) {
+        strcat(joined, script_arg(i));
+        strcat(joined, i < count ? " " : "");
+    }
+    return joined;
+}
+
+int script_shift(size_t n) {
+    if (frameCount == 0 || n > frames[frameCount - 1].count) {
+        return 1;
+    }
+    frames[frameCount - 1].first += n;
+    frames[frameCount - 1].count -= n;
+    return 0;
+}
+
+void script_functions_free() {
+    for (size_t i = 0; i < functionCapacity; i++) {
+        if (functions[i].hash != 0) {
+            free(functions[i].name);
+            script_free(functions[i].body);
+        }
+    }
+    free(functions);
+    functions = NULL;
+    functionCapacity = 0;
+    functionUsed = 0;
+    free(frames);
+    frames = NULL;
+    frameCount = frameCapacity = 0;
+    free(arena);
+    arena = NULL;
+    arenaLen = arenaCap = 0;
+    free(argOffsets);
+    argOffsets = NULL;
+    argCount = argCapacity = 0;
+    free(joined);
+    joined = NULL;
+    free(redirects);
+    redirects = NULL;
+    redirectCount = redirectCapacity = 0;
+}
+
+/*
+Running -----------------------------------------
+*/
+
+static void onInterrupt(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+static void setStatus(struct shell *sh, int status) {
+    char text[16];
+    snprintf(text, sizeof(text), "%d", status);
+    sh->status = status;
+    var_set("?", text);
+}
+
+// Function to open the file of a < file on stdin, false if it cannot be read
+static bool pushRedirect(Command *c, size_t start, size_t end) {
+    char *path = sh_expand_word(c->words[0], false);
+    if (path == NULL) {
+        return false;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        free(path);
+        return false;
+    }
+    free(path);
+    if (redirectCount == redirectCapacity) {
+        redirects = growArray(redirects, &redirectCapacity, sizeof(Redirect));
+    }
+    fflush(stdout);
+    int saved = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10); // -1 if stdin was closed
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+    redirects[redirectCount++] = (Redirect){saved, start, end};
+    return true;
+}
+
+static void popRedirect() {
+    Redirect *r = &redirects[--redirectCount];
+    if (r->saved >= 0) {
+        dup2(r->saved, STDIN_FILENO);
+        close(r->saved);
+    } else {
+        close(STDIN_FILENO);
+    }
+}
+
+static int runSimple(struct shell *sh, Command *c) {
+    cmd_substitute_status(); // only the substitutions of this command count
+    int assigned = sh_assign(c->words);
+    if (assigned >= 0) {
+        int status = cmd_substitute_status(); // x=$(false) sets $? like bash
+        return assigned != 0 ? assigned : status;
+    }
+    char **args = sh_expand(c->words);
+    if (args == NULL) {
+        return 1;
+    }
+    int status = 0;
+    char **argv = args;
+    bool bypass = strcmp(argv[0] ? argv[0] : "", "command") == 0 && argv[1] != NULL; // command git skips a git function
+    argv += bypass;
+    Function *f = argv[0] != NULL && !bypass ? findFunction(argv[0]) : NULL;
+    if (f != NULL) {
+        status = callFunction(sh, f, argv);
+    } else if (argv[0] != NULL && strcmp(argv[0], "return") == 0) {
+        if (frameCount == 0 && sourcing == 0) {
+            fprintf(stderr, "return: can only `return' from a function or sourced script\n");
+            status = 2;
+        } else {
+            status = argv[1] != NULL ? atoi(argv[1]) & 255 : sh->status;
+            returning = true;
+        }
+    } else if (argv[0] != NULL) {
+        if (do_builtin(sh, argv)) {
+            status = sh->status;
+        } else {
+            status = runCommand(sh, argv, c->background, c->text);
+            if (status == 128 + SIGINT) {
+                interrupted = 1; // ^C stops the loop as well as the command
+            }
+        }
+    }
+    free(args);
+    return status;
+}
+
+// Function to start a for loop, a plain brace range is not expanded up front
+static void startLoop(Loop *loop, Command *c) {
+    memset(loop, 0, sizeof(*loop));
+    loop->name = c->words[0];
+    char **list = c->words + 1;
+    if (list[0] != NULL && list[1] == NULL && strpbrk(list[0], "$`'\"\\*?[") == NULL &&
+        brace_init(&loop->braces, list[0])) {
+        loop->lazy = true;
+        return;
+    }
+    brace_free(&loop->braces); // safe when brace_init was not called
+    loop->values = sh_expand(list);
+}
+
+static const char *nextValue(Loop *loop) {
+    if (loop->lazy) {
+        size_t len;
+        return brace_next(&loop->braces, &len);
+    }
+    return loop->values != NULL ? loop->values[loop->next] != NULL ? loop->values[loop->next++] : NULL : NULL;
+}
+
+static void endLoop(Loop *loop) {
+    if (loop->lazy) {
+        brace_free(&loop->braces);
+    }
+    free(loop->values);
+}
+
+static bool caseMatches(Command *c, const char *subject) {
+    size_t len = strlen(subject);
+    for (size_t i = 0; c->words[i] != NULL; i++) {
+        if (c->matchers != NULL) {
+            if (glob_match(&c->matchers[i], subject, len)) {
+                return true;
+            }
+            continue;
+        }
+        char *pattern = sh_expand_word(c->words[i], true);
+        if (pattern == NULL) {
+            continue;
+        }
+        struct glob_matcher m;
+        glob_compile(&m, pattern, strlen(pattern));
+        bool match = glob_match(&m, subject, len);
+        glob_matcher_free(&m);
+        free(pattern);
+        if (match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int script_run(struct shell *sh, struct script *s) {
+    if (sh != NULL) {
+        currentShell = sh;
+    }
+    sh = currentShell;
+
+    // ^C at the shell itself, in a loop of builtins, stops the script
+    struct sigaction old;
+    if (depth++ == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = onInterrupt;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, &old);
+        interrupted = 0;
+    }
+
+    Loop *loops = NULL;
+    size_t loopCount = 0, loopCapacity = 0;
+    char **subjects = NULL;
+    size_t subjectCount = 0, subjectCapacity = 0;
+    int status = sh->status;
+    size_t redirectBase = redirectCount; // the ones from the caller stay
+    for (size_t pc = 0; pc < s->opCount && !interrupted && !returning;) {
+        const Op *op = &s->ops[pc++];
+        Command *c = &s->commands[op->arg];
+        switch (op->code) {
+        case OP_RUN:
+            status = runSimple(sh, c);
+            setStatus(sh, status);
+            break;
+        case OP_ARITH: {
+            int64_t value;
+            status = arith_eval(c->words[0], &value) < 0 ? 2 : value == 0;
+            setStatus(sh, status);
+            break;
+        }
+        case OP_JUMP:
+            pc = op->target;
+            break;
+        case OP_JUMP_FALSE:
+            pc = status != 0 ? op->target : pc;
+            break;
+        case OP_JUMP_TRUE:
+            pc = status == 0 ? op->target : pc;
+            break;
+        case OP_NOT:
+            status = status == 0;
+            setStatus(sh, status);
+            break;
+        case OP_TRUE:
+            status = 0;
+            setStatus(sh, status);
+            break;
+        case OP_FOR_INIT:
+            if (loopCount == loopCapacity) {
+                loops = growArray(loops, &loopCapacity, sizeof(Loop));
+            }
+            startLoop(&loops[loopCount++], c);
+            break;
+        case OP_FOR_NEXT: {
+            Loop *loop = &loops[loopCount - 1];
+            const char *value = nextValue(loop);
+            if (value == NULL) {
+                endLoop(loop);
+                loopCount--;
+                pc = op->target;
+            } else {
+                var_set(loop->name, value);
+            }
+            break;
+        }
+        case OP_FOR_POP:
+            endLoop(&loops[--loopCount]);
+            break;
+        case OP_CASE:
+            if (subjectCount == subjectCapacity) {
+                subjects = growArray(subjects, &subjectCapacity, sizeof(char *));
+            }
+            subjects[subjectCount] = sh_expand_word(c->words[0], false);
+            if (subjects[subjectCount] == NULL) {
+                subjects[subjectCount] = strdup("");
+            }
+            subjectCount++;
+            status = 0;
+            setStatus(sh, status);
+            break;
+        case OP_CASE_TEST:
+            pc = caseMatches(c, subjects[subjectCount - 1]) ? pc : op->target;
+            break;
+        case OP_CASE_POP:
+            free(subjects[--subjectCount]);
+            break;
+        case OP_DEFINE:
+            defineFunction(c->words[0], c->body);
+            status = 0;
+            setStatus(sh, status);
+            break;
+        case OP_REDIRECT:
+            if (!pushRedirect(c, pc - 1, op->target)) {
+                status = 1;
+                setStatus(sh, status);
+                pc = op->target + 1; // the command does not run
+            }
+            break;
+        case OP_REDIRECT_POP:
+            popRedirect();
+            break;
+        }
+        // a break or continue that left the command of a < file
+        while (redirectCount > redirectBase &&
+               (pc < redirects[redirectCount - 1].start || pc > redirects[redirectCount - 1].end)) {
+            popRedirect();
+        }
+    }
+
+    if (interrupted) {
+        status = 128 + SIGINT;
+        setStatus(sh, status);
+    }
+    while (redirectCount > redirectBase) {
+        popRedirect(); // return, or ^C
+    }
+    while (loopCount > 0) {
+        endLoop(&loops[--loopCount]);
+    }
+    free(loops);
+    while (subjectCount > 0) {
+        free(subjects[--subjectCount]);
+    }
+    free(subjects);
+    if (--depth == 0) {
+        sigaction(SIGINT, &old, NULL);
+    }
+    return status;
+}
+
+int script_eval(struct shell *sh, const char *text) {
+    bool incomplete;
+    struct script *s = script_compile(text, &incomplete);
+    if (s == NULL) {
+        if (incomplete) {
+            fprintf(stderr, "syntax error: unexpected end of file\n");
+        }
+        setStatus(sh != NULL ? sh : currentShell, 2);
+        return 2;
+    }
+    int status = script_run(sh, s);
+    script_free(s);
+    return status;
+}
+
+int script_source(struct shell *sh, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    char chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        fwrite(chunk, 1, n, out);
+    }
+    fclose(f);
+    fclose(out);
+    sourcing++;
+    int status = script_eval(sh, text);
+    sourcing--;
+    returning = false;
+    free(text);
+    return status;
+}
+
+/*
+Scripts end-----------------------------------------
+*/
@@ -0,0 +1,389 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+Command substitution -----------------------------------------
+$(cmd) and `cmd` are replaced by what cmd prints, without the trailing
+newlines. $name, ${...} and $((expr)) are expanded in the same pass. The
+words of cmd go through the same expansion as a command line, so an inner
+$(...) runs first.
+echo and pwd run right here into a memory stream, with no fork. Anything
+else is forked with its output on a pipe, other builtins like alias or jobs
+run in the forked child and only external commands are exec'd. The pipe that is made bigger with
+F_SETPIPE_SZ, so a command with a lot of output is not stopped every 64KB
+waiting for the shell to read, and it is read into a buffer that doubles.
+A loop or a list like $(a && b) is compiled and run in a forked shell.
+*/
+
+#define SUBST_PIPE_SIZE (1024 * 1024)
+#define SUBST_READ_CHUNK (64 * 1024)
+
+static int substStatus = 0; // exit status of the last substitution
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} Out;
+
+static void outReserve(Out *o, size_t n) {
+    if (o->len + n + 1 > o->cap) {
+        o->cap = (o->len + n + 1) * 2;
+        o->buf = realloc(o->buf, o->cap);
+        if (o->buf == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void outAppend(Out *o, const char *s, size_t n) {
+    outReserve(o, n);
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+    o->buf[o->len] = '\0';
+}
+
+// Function to wait for a substitution's child and keep its exit status
+static void waitCapture(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return;
+        }
+    }
+    substStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Function to fork cmd with its output on a pipe and read all of it into o
+static void captureForked(char **args, Out *o) {
+    char path[PATH_MAX];
+    const char *resolved = path_lookup(args[0], path, sizeof(path));
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return;
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, SUBST_PIPE_SIZE); // past /proc/sys/fs/pipe-max-size it stays as it was
+
+    fflush(stdout); // not to print it twice
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        if (strcmp(args[0], "exit") == 0) {
+            _exit(args[1] != NULL ? atoi(args[1]) & 255 : 0); // leaves the subshell, not the shell
+        }
+        struct shell sub = {0};
+        if (do_builtin(&sub, args)) {
+            fflush(stdout);
+            _exit(sub.status);
+        }
+        if (resolved != NULL) {
+            execv(resolved, args);
+        }
+        execvp(args[0], args);
+        int err = errno;
+        fprintf(stderr, "%s: %s\n", args[0], err == ENOENT ? "command not found" : strerror(err));
+        _exit(err == ENOENT ? 127 : 126);
+    }
+
+    close(fds[1]);
+    while (true) {
+        outReserve(o, SUBST_READ_CHUNK);
+        ssize_t n = read(fds[0], o->buf + o->len, o->cap - o->len - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        o->len += n;
+    }
+    close(fds[0]);
+    waitCapture(pid);
+}
+
+// Function to fork a whole script, like a loop, with its output on a pipe
+static void captureScript(struct script *s, Out *o) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return;
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, SUBST_PIPE_SIZE);
+
+    fflush(stdout); // not to print it twice
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        signal(SIGINT, SIG_DFL);
+        int status = script_run(NULL, s);
+        fflush(stdout);
+        _exit(status);
+    }
+
+    close(fds[1]);
+    while (true) {
+        outReserve(o, SUBST_READ_CHUNK);
+        ssize_t n = read(fds[0], o->buf + o->len, o->cap - o->len - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        o->len += n;
+    }
+    close(fds[0]);
+    waitCapture(pid);
+}
+
+// Function to run a command and add what it prints to o
+static int capture(const char *command, Out *o) {
+    bool incomplete;
+    struct script *s = script_compile(command, &incomplete);
+    if (s == NULL) {
+        return -1;
+    }
+    size_t start = o->len;
+    char **words = script_simple(s);
+    if (words == NULL) {
+        captureScript(s, o); // $(for i in 1 2; do echo $i; done)
+        script_free(s);
+    } else {
+        char **args = sh_expand(words); // $(a $(b)) runs b first
+        script_free(s);
+        if (args == NULL) {
+            return -1;
+        }
+        if (args[0] != NULL) {
+            char *text = NULL;
+            size_t size = 0;
+            FILE *out = open_memstream(&text, &size);
+            if (builtin_print(args, out)) {
+                fclose(out);
+                outAppend(o, text, size);
+                substStatus = 0;
+            } else {
+                fclose(out);
+                captureForked(args, o);
+            }
+            free(text);
+        }
+        free(args);
+    }
+
+    while (o->len > start && o->buf[o->len - 1] == '\n') {
+        o->len--;
+    }
+    outReserve(o, 0);
+    o->buf[o->len] = '\0';
+    return 0;
+}
+
+// Function to find the ) that closes the $( before p, NULL if there is none
+static const char *closingParen(const char *p) {
+    int depth = 1;
+    bool quoted = false;
+    for (; *p; p++) {
+        if (*p == '\'') {
+            quoted = !quoted;
+        } else if (quoted) {
+            continue;
+        } else if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Function to find the } that closes the ${ before p, NULL if there is none
+static const char *closingBrace(const char *p) {
+    int depth = 1;
+    for (; *p; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Function to add the value of $name or ${...} at p to o and set next past
+// it, 0 if p is not one
+static int expandVariable(const char *p, Out *o, const char **next) {
+    if (p[1] == '{') {
+        const char *end = closingBrace(p + 2);
+        if (end == NULL) {
+            fprintf(stderr, "%s: bad substitution\n", p);
+            return -1;
+        }
+        size_t len = end - (p + 2);
+        const char *value;
+        char *expanded = NULL;
+        if (len > 0 && var_param_length(p + 2) == len) {
+            value = var_lookup(p + 2, len); // plain ${name}, ${10} or ${#}
+        } else if (param_expand(p + 2, len, &expanded) < 0) {
+            return -1;
+        } else {
+            value = expanded;
+        }
+        if (value != NULL) {
+            outAppend(o, value, strlen(value));
+        }
+        free(expanded);
+        *next = end + 1;
+        return 1;
+    }
+    // $10 is $1 and then a 0
+    size_t len = (p[1] >= '0' && p[1] <= '9') ? 1 : var_param_length(p + 1);
+    if (len == 0) {
+        return 0;
+    }
+    const char *value = var_lookup(p + 1, len);
+    if (value != NULL) {
+        outAppend(o, value, strlen(value));
+    }
+    *next = p + 1 + len;
+    return 1;
+}
+
+// Function to add the value of the expression in text to o
+static int expandArithmetic(const char *text, size_t len, Out *o) {
+    char *expr = strndup(text, len);
+    char *inner = NULL;
+    if (strchr(expr, '`') != NULL || strstr(expr, "$(") != NULL) {
+        if (cmd_substitute(expr, &inner) < 0) { // $(( $(wc -l < f) + 1 ))
+            free(expr);
+            return -1;
+        }
+    }
+    int64_t value;
+    int result = arith_eval(inner ? inner : expr, &value);
+    free(inner);
+    free(expr);
+    if (result == 0) {
+        char number[24];
+        int n = snprintf(number, sizeof(number), "%lld", (long long)value);
+        outAppend(o, number, (size_t)n);
+    }
+    return result;
+}
+
+int cmd_substitute(const char *line, char **result) {
+    *result = NULL;
+    if (strchr(line, '`') == NULL && strchr(line, '$') == NULL) {
+        return 0; // the usual case, nothing to do
+    }
+
+    Out o = {NULL, 0, 0};
+    bool changed = false;
+    bool quoted = false;
+    for (const char *p = line; *p; p++) {
+        if (*p == '\'') {
+            quoted = !quoted; // no substitution inside single quotes
+        }
+        if (*p == '\\' && p[1] != '\0') {
+            outAppend(&o, p, 2); // left for quote removal later
+            p++;
+            continue;
+        }
+        bool dollar = p[0] == '$' && p[1] == '(';
+        const char *next;
+        int variable = !quoted && p[0] == '$' && !dollar ? expandVariable(p, &o, &next) : 0;
+        if (variable < 0) {
+            free(o.buf);
+            return -1;
+        }
+        if (variable > 0) {
+            changed = true;
+            p = next - 1;
+            continue;
+        }
+        if (quoted || (!dollar && *p != '`')) {
+            outAppend(&o, p, 1);
+            continue;
+        }
+
+        const char *start = dollar ? p + 2 : p + 1;
+        const char *end = dollar ? closingParen(start) : strchr(start, '`');
+        if (end == NULL) {
+            fprintf(stderr, "%s: unexpected end of line looking for %s\n", p, dollar ? ")" : "`");
+            free(o.buf);
+            return -1;
+        }
+        if (dollar && start[0] == '(' && end > start + 1 && end[-1] == ')') {
+            if (expandArithmetic(start + 1, end - 1 - (start + 1), &o) < 0) {
+                free(o.buf);
+                return -1;
+            }
+            changed = true;
+            p = end;
+            continue;
+        }
+
+        char *command = strndup(start, end - start);
+        int captured = capture(command, &o);
+        free(command);
+        if (captured < 0) {
+            free(o.buf);
+            return -1;
+        }
+        changed = true;
+        p = end;
+    }
+
+    if (!changed) {
+        free(o.buf);
+        return 0;
+    }
+    if (o.buf == NULL) {
+        o.buf = strdup(""); // the whole line was a command that printed nothing
+    }
+    *result = o.buf;
+    return 1;
+}
+
+int cmd_substitute_status() {
+    int status = substStatus;
+    substStatus = 0;
+    return status;
+}
+
+/*
+Command substitution end-----------------------------------------
+*/
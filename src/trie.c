@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+Trie -----------------------------------------
+A byte trie kept in one growable array of nodes, children are a sibling list
+sorted by byte so walks come out in lexicographic order. Each node has a
+value (set on the node a key ends at) and a best value for the whole subtree
+that trie_insert keeps up to date with the caller's comparison. With that a
+lookup of "the best key starting with prefix" is one walk down the prefix.
+*/
+
+static int newNode(struct trie *t, unsigned char ch) {
+    if (t->count == t->capacity) {
+        t->capacity = t->capacity ? t->capacity * 2 : 256;
+        t->nodes = realloc(t->nodes, t->capacity * sizeof(struct trie_node));
+        if (t->nodes == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct trie_node *n = &t->nodes[t->count];
+    n->child = -1;
+    n->sibling = -1;
+    n->value = -1;
+    n->best = -1;
+    n->ch = ch;
+    return (int)t->count++;
+}
+
+void trie_init(struct trie *t) {
+    t->nodes = NULL;
+    t->count = 0;
+    t->capacity = 0;
+    newNode(t, 0); // root, node 0
+}
+
+void trie_free(struct trie *t) {
+    free(t->nodes);
+    t->nodes = NULL;
+    t->count = 0;
+    t->capacity = 0;
+}
+
+// Function to find the child of node for ch, optionally adding it
+static int childOf(struct trie *t, int node, unsigned char ch, bool create) {
+    int prev = -1;
+    int cur = t->nodes[node].child;
+    while (cur >= 0 && t->nodes[cur].ch < ch) {
+        prev = cur;
+        cur = t->nodes[cur].sibling;
+    }
+    if (cur >= 0 && t->nodes[cur].ch == ch) {
+        return cur;
+    }
+    if (!create) {
+        return -1;
+    }
+
+    int added = newNode(t, ch); // may move t->nodes
+    t->nodes[added].sibling = cur;
+    if (prev < 0) {
+        t->nodes[node].child = added;
+    } else {
+        t->nodes[prev].sibling = added;
+    }
+    return added;
+}
+
+int trie_find(const struct trie *t, const char *key, size_t len) {
+    if (t->count == 0) {
+        return -1;
+    }
+    int node = 0;
+    for (size_t i = 0; i < len && node >= 0; i++) {
+        node = childOf((struct trie *)t, node, (unsigned char)key[i], false);
+    }
+    return node;
+}
+
+int trie_insert(struct trie *t, const char *key, size_t len, int value,
+                bool (*better)(int a, int b, void *ctx), void *ctx) {
+    int node = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (better != NULL) {
+            int best = t->nodes[node].best;
+            if (best < 0 || best == value || better(value, best, ctx)) {
+                t->nodes[node].best = value;
+            }
+        }
+        if (i < len) {
+            node = childOf(t, node, (unsigned char)key[i], true);
+        }
+    }
+    t->nodes[node].value = value;
+    return node;
+}
+
+static void walk(const struct trie *t, int node, char *buf, size_t depth, size_t cap,
+                 void (*fn)(const char *key, size_t len, int value, void *ctx), void *ctx) {
+    if (t->nodes[node].value >= 0) {
+        fn(buf, depth, t->nodes[node].value, ctx);
+    }
+    if (depth + 1 >= cap) {
+        return; // key longer than the buffer
+    }
+    for (int c = t->nodes[node].child; c >= 0; c = t->nodes[c].sibling) {
+        buf[depth] = (char)t->nodes[c].ch;
+        buf[depth + 1] = '\0';
+        walk(t, c, buf, depth + 1, cap, fn, ctx);
+    }
+    buf[depth] = '\0';
+}
+
+void trie_walk(const struct trie *t, const char *prefix, size_t len,
+               void (*fn)(const char *key, size_t len, int value, void *ctx), void *ctx) {
+    int node = trie_find(t, prefix, len);
+    if (node < 0) {
+        return;
+    }
+    char buf[4096];
+    if (len >= sizeof(buf)) {
+        return;
+    }
+    memcpy(buf, prefix, len);
+    buf[len] = '\0';
+    walk(t, node, buf, len, sizeof(buf), fn, ctx);
+}
+
+/*
+Trie end-----------------------------------------
+*/
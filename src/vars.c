@@ -0,0 +1,416 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lab.h"
+
+/*
+Shell variables -----------------------------------------
+Variables set with name=value live in an open addressing hash table keyed
+by name. A name that is not in the table is looked up in the environment,
+and setting a name that is in the environment sets it there instead, so
+commands the shell runs see the new value.
+
+An indexed array keeps its values in one vector by index, with NULL for an
+index that was never set. An associative array is its own open addressing
+table of keys and values. Using an array where a plain value is wanted gets
+index 0, or key 0, like bash.
+*/
+
+#define VAR_SCALAR 0
+#define VAR_INDEXED 1
+#define VAR_ASSOC 2
+#define VAR_MAX_INDEX (1 << 24) // items are dense, past this an index is gigabytes of NULLs
+
+typedef struct {
+    uint64_t hash; // 0 marks an empty slot
+    char *key;
+    char *value;
+} Entry;
+
+typedef struct {
+    uint64_t hash; // 0 marks an empty slot
+    char *name;
+    char *value; // VAR_SCALAR
+    uint8_t type;
+    char **items; // VAR_INDEXED
+    size_t count; // one past the highest index set
+    size_t capacity;
+    Entry *entries; // VAR_ASSOC
+    size_t entryCapacity; // power of two
+    size_t entryUsed;
+} Var;
+
+static Var *vars = NULL;
+static size_t varCapacity = 0; // power of two
+static size_t varUsed = 0;
+
+// FNV-1a
+static uint64_t hashName(const char *name, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 0x100000001b3ull;
+    }
+    return h ? h : 1;
+}
+
+static Var *findSlot(const char *name, size_t len, uint64_t hash) {
+    size_t mask = varCapacity - 1;
+    size_t i = hash & mask;
+    while (vars[i].hash != 0 && (vars[i].hash != hash || strncmp(vars[i].name, name, len) != 0 ||
+                                 vars[i].name[len] != '\0')) {
+        i = (i + 1) & mask; // linear probing
+    }
+    return &vars[i];
+}
+
+static void growTable() {
+    size_t oldCapacity = varCapacity;
+    Var *old = vars;
+    varCapacity = oldCapacity ? oldCapacity * 2 : 64;
+    vars = calloc(varCapacity, sizeof(Var));
+    if (vars == NULL) {
+        perror("Malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].hash != 0) {
+            *findSlot(old[i].name, strlen(old[i].name), old[i].hash) = old[i];
+        }
+    }
+    free(old);
+}
+
+static Var *findVar(const char *name, size_t len) {
+    if (varUsed == 0) {
+        return NULL;
+    }
+    Var *v = findSlot(name, len, hashName(name, len));
+    return v->hash != 0 ? v : NULL;
+}
+
+// Function to get the entry for name, adding it as an empty plain variable
+static Var *addVar(const char *name) {
+    size_t len = strlen(name);
+    Var *v = findVar(name, len);
+    if (v != NULL) {
+        return v;
+    }
+    if ((varUsed + 1) * 4 > varCapacity * 3) {
+        growTable();
+    }
+    uint64_t hash = hashName(name, len);
+    v = findSlot(name, len, hash);
+    memset(v, 0, sizeof(*v));
+    v->hash = hash;
+    v->name = strdup(name);
+    v->value = strdup("");
+    varUsed++;
+    return v;
+}
+
+static void freeValues(Var *v) {
+    free(v->value);
+    for (size_t i = 0; i < v->count; i++) {
+        free(v->items[i]);
+    }
+    free(v->items);
+    for (size_t i = 0; i < v->entryCapacity; i++) {
+        if (v->entries[i].hash != 0) {
+            free(v->entries[i].key);
+            free(v->entries[i].value);
+        }
+    }
+    free(v->entries);
+    v->value = NULL;
+    v->items = NULL;
+    v->count = v->capacity = 0;
+    v->entries = NULL;
+    v->entryCapacity = v->entryUsed = 0;
+}
+
+static Entry *findEntry(Var *v, const char *key, uint64_t hash) {
+    size_t mask = v->entryCapacity - 1;
+    size_t i = hash & mask;
+    while (v->entries[i].hash != 0 && (v->entries[i].hash != hash || strcmp(v->entries[i].key, key) != 0)) {
+        i = (i + 1) & mask;
+    }
+    return &v->entries[i];
+}
+
+static const char *getEntry(Var *v, const char *key) {
+    if (v->entryUsed == 0) {
+        return NULL;
+    }
+    Entry *e = findEntry(v, key, hashName(key, strlen(key)));
+    return e->hash != 0 ? e->value : NULL;
+}
+
+static void setEntry(Var *v, const char *key, const char *value) {
+    if ((v->entryUsed + 1) * 4 > v->entryCapacity * 3) {
+        size_t oldCapacity = v->entryCapacity;
+        Entry *old = v->entries;
+        v->entryCapacity = oldCapacity ? oldCapacity * 2 : 16;
+        v->entries = calloc(v->entryCapacity, sizeof(Entry));
+        if (v->entries == NULL) {
+            perror("Malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].hash != 0) {
+                *findEntry(v, old[i].key, old[i].hash) = old[i];
+            }
+        }
+        free(old);
+    }
+    uint64_t hash = hashName(key, strlen(key));
+    Entry *e = findEntry(v, key, hash);
+    if (e->hash == 0) {
+        e->hash = hash;
+        e->key = strdup(key);
+        v->entryUsed++;
+    } else {
+        free(e->value);
+    }
+    e->value = strdup(value);
+}
+
+static void setItem(Var *v, size_t index, const char *value) {
+    if (index >= v->capacity) {
+        size_t capacity = v->capacity ? v->capacity : 8;
+        while (capacity <= index) {
+            capacity *= 2;
+        }
+        v->items = realloc(v->items, capacity * sizeof(char *));
+        if (v->items == NULL) {
+            perror("Reallocating failed");
+            exit(EXIT_FAILURE);
+        }
+        memset(v->items + v->capacity, 0, (capacity - v->capacity) * sizeof(char *));
+        v->capacity = capacity;
+    }
+    free(v->items[index]);
+    v->items[index] = strdup(value);
+    if (index >= v->count) {
+        v->count = index + 1;
+    }
+}
+
+// Function to turn a plain variable into an indexed array with its value at 0
+static void makeIndexed(Var *v) {
+    if (v->type != VAR_SCALAR) {
+        return;
+    }
+    char *value = v->value;
+    v->value = NULL;
+    v->type = VAR_INDEXED;
+    if (value != NULL && *value != '\0') {
+        setItem(v, 0, value);
+    }
+    free(value);
+}
+
+// Function to get the index for a subscript, a negative one counts from the end
+static bool itemIndex(Var *v, const char *key, size_t *index) {
+    int64_t i;
+    if (arith_eval(key, &i) < 0) {
+        return false;
+    }
+    if (i < 0) {
+        i += (int64_t)v->count;
+    }
+    if (i < 0) {
+        fprintf(stderr, "%s[%s]: bad array subscript\n", v->name, key);
+        return false;
+    }
+    *index = (size_t)i;
+    return true;
+}
+
+const char *var_lookup(const char *name, size_t len) {
+    if (len > 0 && ((name[0] >= '0' && name[0] <= '9') || name[0] == '#' || name[0] == '@' || name[0] == '*')) {
+        return script_param(name, len); // $1, $# and the like belong to the function call
+    }
+    Var *v = findVar(name, len);
+    if (v != NULL) {
+        if (v->type == VAR_INDEXED) {
+            return v->count > 0 ? v->items[0] : NULL;
+        }
+        return v->type == VAR_ASSOC ? getEntry(v, "0") : v->value;
+    }
+    char key[256];
+    if (len >= sizeof(key)) {
+        return NULL;
+    }
+    memcpy(key, name, len);
+    key[len] = '\0';
+    return getenv(key);
+}
+
+const char *var_get(const char *name) {
+    return var_lookup(name, strlen(name));
+}
+
+void var_set(const char *name, const char *value) {
+    Var *v = findVar(name, strlen(name));
+    if (v == NULL && getenv(name) != NULL) {
+        setenv(name, value, 1); // exported, the children see it
+        return;
+    }
+    if (v == NULL) {
+        v = addVar(name);
+    }
+    if (v->type == VAR_INDEXED) {
+        setItem(v, 0, value);
+    } else if (v->type == VAR_ASSOC) {
+        setEntry(v, "0", value);
+    } else if (strlen(value) <= strlen(v->value)) {
+        strcpy(v->value, value); // a counter going up mostly fits where it was
+    } else {
+        free(v->value);
+        v->value = strdup(value);
+    }
+}
+
+void var_declare(const char *name, bool assoc) {
+    Var *v = addVar(name);
+    if (assoc && v->type != VAR_ASSOC) {
+        freeValues(v);
+        v->type = VAR_ASSOC;
+    } else if (!assoc) {
+        makeIndexed(v);
+    }
+}
+
+void var_clear_array(const char *name) {
+    Var *v = addVar(name);
+    uint8_t type = v->type == VAR_ASSOC ? VAR_ASSOC : VAR_INDEXED;
+    freeValues(v);
+    v->type = type;
+}
+
+bool var_set_element(const char *name, const char *key, const char *value) {
+    Var *v = addVar(name);
+    if (v->type == VAR_ASSOC) {
+        setEntry(v, key, value);
+        return true;
+    }
+    makeIndexed(v);
+    size_t index;
+    if (!itemIndex(v, key, &index)) {
+        return false;
+    }
+    if (index >= VAR_MAX_INDEX) {
+        fprintf(stderr, "%s[%s]: bad array subscript\n", v->name, key);
+        return false;
+    }
+    setItem(v, index, value);
+    return true;
+}
+
+void var_append(const char *name, const char *value) {
+    Var *v = addVar(name);
+    makeIndexed(v);
+    setItem(v, v->count, value);
+}
+
+const char *var_get_element(const char *name, const char *key) {
+    Var *v = findVar(name, strlen(name));
+    if (v == NULL || v->type == VAR_SCALAR) {
+        int64_t i;
+        bool zero = arith_eval(key, &i) == 0 && i == 0;
+        return zero ? var_get(name) : NULL; // a plain variable is an array of one
+    }
+    if (v->type == VAR_ASSOC) {
+        return getEntry(v, key);
+    }
+    size_t index;
+    return itemIndex(v, key, &index) && index < v->count ? v->items[index] : NULL;
+}
+
+size_t var_each(const char *name, void (*fn)(const char *value, void *ctx), void *ctx) {
+    Var *v = findVar(name, strlen(name));
+    if (v == NULL || v->type == VAR_SCALAR) {
+        const char *value = var_get(name);
+        if (value != NULL && fn != NULL) {
+            fn(value, ctx);
+        }
+        return value != NULL;
+    }
+    size_t n = 0;
+    if (v->type == VAR_INDEXED) {
+        for (size_t i = 0; i < v->count; i++) {
+            if (v->items[i] != NULL) {
+                if (fn != NULL) {
+                    fn(v->items[i], ctx);
+                }
+                n++;
+            }
+        }
+        return n;
+    }
+    for (size_t i = 0; i < v->entryCapacity; i++) {
+        if (v->entries[i].hash != 0) {
+            if (fn != NULL) {
+                fn(v->entries[i].value, ctx);
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
+bool var_is_assoc(const char *name) {
+    Var *v = findVar(name, strlen(name));
+    return v != NULL && v->type == VAR_ASSOC;
+}
+
+bool var_assignment(const char *word) {
+    size_t len = var_name_length(word);
+    if (len > 0 && word[len] == '[') {
+        const char *close = strchr(word + len, ']');
+        return close != NULL && (close[1] == '=' || (close[1] == '+' && close[2] == '='));
+    }
+    return len > 0 && (word[len] == '=' || (word[len] == '+' && word[len + 1] == '='));
+}
+
+size_t var_name_length(const char *s) {
+    size_t len = 0;
+    if (s[0] >= '0' && s[0] <= '9') {
+        return 0;
+    }
+    while (s[len] == '_' || (s[len] >= 'a' && s[len] <= 'z') || (s[len] >= 'A' && s[len] <= 'Z') ||
+           (s[len] >= '0' && s[len] <= '9')) {
+        len++;
+    }
+    return len;
+}
+
+size_t var_param_length(const char *s) {
+    if (s[0] >= '0' && s[0] <= '9') {
+        size_t len = 0;
+        while (s[len] >= '0' && s[len] <= '9') {
+            len++;
+        }
+        return len;
+    }
+    return s[0] != '\0' && strchr("?#@*", s[0]) != NULL ? 1 : var_name_length(s);
+}
+
+void var_free() {
+    for (size_t i = 0; i < varCapacity; i++) {
+        if (vars[i].hash != 0) {
+            freeValues(&vars[i]);
+            free(vars[i].name);
+        }
+    }
+    free(vars);
+    vars = NULL;
+    varCapacity = 0;
+    varUsed = 0;
+}
+
+/*
+Shell variables end-----------------------------------------
+*/
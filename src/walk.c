@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lab.h"
+
+/*
+Directory walker -----------------------------------------
+Walks a tree on a pool of threads. Every directory is a task holding an open
+fd. A worker pushes the subdirectories it finds onto the bottom of its own
+deque and takes its next task from there, so it goes depth first through
+directories it just read. An idle worker steals from the top of another
+worker's deque, which is where the biggest untouched subtrees are.
+
+The caller's visit function decides, for each entry of a directory, whether
+to emit it and whether to go into it. Each directory's decisions are sorted
+by name, with a subdirectory sorting as name/, and kept in a tree. Reading
+that tree depth first at the end gives the paths in sorted order whatever
+order the threads ran in.
+*/
+
+#define WALK_MAX_THREADS 16
+#define WALK_MAX_OPEN 512 // directory fds held by queued tasks, past this they are opened by path
+#define WALK_READ_BUFFER (64 * 1024)
+
+typedef struct {
+    uint32_t name; // offset in the directory's name buffer
+    uint32_t len;
+    uint64_t states; // passed to visit for the subdirectory, 0 to emit
+    bool slash;
+    bool follow;
+    struct walk_dir *child;
+} WalkItem;
+
+struct walk_dir {
+    char *path; // ends in / unless it is the starting directory ""
+    size_t pathLen;
+    char *names;
+    size_t size;
+    size_t capacity;
+    WalkItem *items;
+    size_t count;
+    size_t itemCapacity;
+};
+
+typedef struct {
+    int fd; // -1 when it has to be opened by path
+    uint64_t states;
+    struct walk_dir *dir;
+} WalkTask;
+
+typedef struct {
+    pthread_mutex_t lock;
+    WalkTask *tasks; // [head, tail) are queued
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} Deque;
+
+typedef struct {
+    Deque deques[WALK_MAX_THREADS];
+    int threads;
+    atomic_long pending; // tasks queued or running
+    atomic_int openFds;
+    walk_visit_fn visit;
+    void *ctx;
+} Walk;
+
+typedef struct {
+    Walk *walk;
+    int id;
+} Worker;
+
+static void pushTask(Deque *d, WalkTask task) {
+    pthread_mutex_lock(&d->lock);
+    if (d->head == d->tail) {
+        d->head = d->tail = 0;
+    }
+    if (d->tail == d->capacity) {
+        d->capacity = d->capacity ? d->capacity * 2 : 64;
+        d->tasks = realloc(d->tasks, d->capacity * sizeof(WalkTask));
+    }
+    d->tasks[d->tail++] = task;
+    pthread_mutex_unlock(&d->lock);
+}
+
+// Function to take a task, from the bottom of our own deque or the top of another's
+static bool takeTask(Deque *d, bool steal, WalkTask *task) {
+    pthread_mutex_lock(&d->lock);
+    bool found = d->head < d->tail;
+    if (found) {
+        *task = steal ? d->tasks[d->head++] : d->tasks[--d->tail];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static struct walk_dir *newDir(const char *parent, size_t parentLen, const char *name, size_t len) {
+    struct walk_dir *dir = calloc(1, sizeof(struct walk_dir));
+    dir->pathLen = parentLen + len + (len ? 1 : 0);
+    dir->path = malloc(dir->pathLen + 1);
+    memcpy(dir->path, parent, parentLen);
+    memcpy(dir->path + parentLen, name, len);
+    if (len) {
+        dir->path[dir->pathLen - 1] = '/';
+    }
+    dir->path[dir->pathLen] = '\0';
+    return dir;
+}
+
+static void addItem(struct walk_dir *dir, const char *name, size_t len, uint64_t states, bool slash,
+                    bool follow) {
+    if (dir->size + len + 1 > dir->capacity) {
+        dir->capacity = (dir->size + len + 1) * 2;
+        dir->names = realloc(dir->names, dir->capacity);
+    }
+    if (dir->count == dir->itemCapacity) {
+        dir->itemCapacity = dir->itemCapacity ? dir->itemCapacity * 2 : 64;
+        dir->items = realloc(dir->items, dir->itemCapacity * sizeof(WalkItem));
+    }
+    WalkItem *item = &dir->items[dir->count++];
+    item->name = (uint32_t)dir->size;
+    item->len = (uint32_t)len;
+    item->states = states;
+    item->slash = slash || states != 0;
+    item->follow = follow;
+    item->child = NULL;
+    memcpy(dir->names + dir->size, name, len);
+    dir->names[dir->size + len] = '\0';
+    dir->size += len + 1;
+}
+
+void walk_emit(struct walk_dir *dir, const char *name, size_t len, bool slash) {
+    addItem(dir, name, len, 0, slash, false);
+}
+
+void walk_descend(struct walk_dir *dir, const char *name, size_t len, uint64_t states, bool follow) {
+    addItem(dir, name, len, states, true, follow);
+}
+
+const char *walk_path(const struct walk_dir *dir) {
+    return dir->path;
+}
+
+// a subdirectory, or a name emitted with a /, sorts as if it had a / on the end
+static int compareItems(const void *a, const void *b, void *names) {
+    const WalkItem *x = a, *y = b;
+    const unsigned char *xs = (unsigned char *)names + x->name;
+    const unsigned char *ys = (unsigned char *)names + y->name;
+    for (size_t i = 0;; i++) {
+        int xc = i < x->len ? xs[i] : (i == x->len && x->slash ? '/' : 0);
+        int yc = i < y->len ? ys[i] : (i == y->len && y->slash ? '/' : 0);
+        if (xc != yc) {
+            return xc - yc;
+        }
+        if (xc == 0) {
+            return (x->states != 0) - (y->states != 0); // a/ itself before what is in it
+        }
+    }
+}
+
+static void runTask(Walk *w, int self, WalkTask *task) {
+    struct walk_dir *dir = task->dir;
+    int fd = task->fd;
+    if (fd < 0) {
+        fd = open(dir->pathLen ? dir->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } else {
+        atomic_fetch_sub(&w->openFds, 1);
+    }
+    if (fd < 0) {
+        return;
+    }
+
+    w->visit(dir, fd, task->states, w->ctx);
+    qsort_r(dir->items, dir->count, sizeof(WalkItem), compareItems, dir->names);
+
+    // queue the subdirectories last first, so the first comes off the bottom next
+    for (size_t i = dir->count; i > 0; i--) {
+        WalkItem *item = &dir->items[i - 1];
+        if (item->states == 0) {
+            continue;
+        }
+        const char *name = dir->names + item->name;
+        int child = -1;
+        if (atomic_load(&w->openFds) < WALK_MAX_OPEN) {
+            child = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (item->follow ? 0 : O_NOFOLLOW));
+            if (child < 0) {
+                continue; // not a directory after all
+            }
+            atomic_fetch_add(&w->openFds, 1);
+        }
+        item->child = newDir(dir->path, dir->pathLen, name, item->len);
+        WalkTask next = {child, item->states, item->child};
+        atomic_fetch_add(&w->pending, 1);
+        pushTask(&w->deques[self], next);
+    }
+    close(fd);
+}
+
+static void *workerLoop(void *arg) {
+    Worker *worker = arg;
+    Walk *w = worker->walk;
+    unsigned int seed = (unsigned int)worker->id * 2654435761u;
+    WalkTask task;
+    while (true) {
+        bool found = takeTask(&w->deques[worker->id], false, &task);
+        for (int tries = 0; !found && tries < w->threads; tries++) {
+            int victim = (int)(rand_r(&seed) % w->threads);
+            found = victim != worker->id && takeTask(&w->deques[victim], true, &task);
+        }
+        if (found) {
+            runTask(w, worker->id, &task);
+            atomic_fetch_sub(&w->pending, 1);
+        } else if (atomic_load(&w->pending) == 0) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// Function to read the tree back depth first and free it
+static void collect(struct walk_dir *dir, struct glob_result *out) {
+    for (size_t i = 0; i < dir->count; i++) {
+        WalkItem *item = &dir->items[i];
+        if (item->states == 0) {
+            glob_result_add(out, dir->path, dir->pathLen, dir->names + item->name, item->len, item->slash);
+        } else if (item->child != NULL) {
+            collect(item->child, out);
+        }
+    }
+    free(dir->path);
+    free(dir->names);
+    free(dir->items);
+    free(dir);
+}
+
+int walk_threads() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > WALK_MAX_THREADS ? WALK_MAX_THREADS : (int)n;
+}
+
+size_t walk_run(const char *start, uint64_t states, int threads, walk_visit_fn visit, void *ctx,
+                struct glob_result *out) {
+    int fd = open(start[0] ? start : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    Walk *w = calloc(1, sizeof(Walk));
+    w->threads = threads < 1 ? 1 : threads > WALK_MAX_THREADS ? WALK_MAX_THREADS : threads;
+    w->visit = visit;
+    w->ctx = ctx;
+    for (int i = 0; i < w->threads; i++) {
+        pthread_mutex_init(&w->deques[i].lock, NULL);
+    }
+
+    // the start is given as it should prefix the results, "" or ending in /
+    struct walk_dir *root = newDir("", 0, "", 0);
+    free(root->path);
+    root->path = strdup(start);
+    root->pathLen = strlen(start);
+    atomic_store(&w->pending, 1);
+    atomic_store(&w->openFds, 1);
+    pushTask(&w->deques[0], (WalkTask){fd, states, root});
+
+    Worker workers[WALK_MAX_THREADS];
+    pthread_t ids[WALK_MAX_THREADS];
+    int started = 1;
+    for (int i = 0; i < w->threads; i++) {
+        workers[i].walk = w;
+        workers[i].id = i;
+    }
+    for (int i = 1; i < w->threads; i++) {
+        if (pthread_create(&ids[i], NULL, workerLoop, &workers[i]) != 0) {
+            break; // fewer threads is still a walk
+        }
+        started++;
+    }
+    workerLoop(&workers[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+
+    size_t before = out->count;
+    collect(root, out);
+    for (int i = 0; i < w->threads; i++) {
+        free(w->deques[i].tasks);
+        pthread_mutex_destroy(&w->deques[i].lock);
+    }
+    free(w);
+    return out->count - before;
+}
+
+int walk_type(int fd, const char *name, unsigned char type, bool follow) {
+    if (type != DT_UNKNOWN && !(type == DT_LNK && follow)) {
+        return type;
+    }
+    // the file system did not say, or it is a link to look through
+    struct statx st;
+    if (statx(fd, name, follow ? 0 : AT_SYMLINK_NOFOLLOW, STATX_TYPE, &st) < 0) {
+        return DT_UNKNOWN;
+    }
+    return IFTODT(st.stx_mode);
+}
+
+void walk_read(int fd, void (*fn)(const char *name, unsigned char type, void *arg), void *arg) {
+    char *buf = malloc(WALK_READ_BUFFER);
+    ssize_t n;
+    while ((n = getdents64(fd, buf, WALK_READ_BUFFER)) > 0) {
+        for (ssize_t at = 0; at < n;) {
+            struct dirent64 *entry = (struct dirent64 *)(buf + at);
+            at += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            fn(name, entry->d_type, arg);
+        }
+    }
+    free(buf);
+}
+
+/*
+ffind -----------------------------------------
+*/
+
+typedef struct {
+    struct glob_matcher name;
+    bool hasName;
+    int type; // DT_ value or DT_UNKNOWN for any
+} Find;
+
+typedef struct {
+    Find *find;
+    struct walk_dir *dir;
+    int fd;
+} FindEntry;
+
+static void findEntry(const char *name, unsigned char type, void *arg) {
+    FindEntry *e = arg;
+    Find *f = e->find;
+    size_t len = strlen(name);
+    int known = type;
+    bool matched = !f->hasName || glob_match(&f->name, name, len);
+    if (matched && f->type != DT_UNKNOWN) {
+        known = walk_type(e->fd, name, type, false);
+        matched = known == f->type;
+    }
+    if (matched) {
+        walk_emit(e->dir, name, len, false);
+    }
+    if (known == DT_UNKNOWN) {
+        known = walk_type(e->fd, name, type, false);
+    }
+    if (known == DT_DIR) {
+        walk_descend(e->dir, name, len, 1, false);
+    }
+}
+
+static void findVisit(struct walk_dir *dir, int fd, uint64_t states, void *ctx) {
+    UNUSED(states);
+    FindEntry e = {ctx, dir, fd};
+    walk_read(fd, findEntry, &e);
+}
+
+size_t walk_find(const char *start, const char *pattern, int type, struct glob_result *out) {
+    Find f;
+    f.hasName = pattern != NULL;
+    f.type = type;
+    if (f.hasName) {
+        glob_compile(&f.name, pattern, strlen(pattern));
+    }
+
+    // the start itself, find prints it first
+    size_t before = out->count;
+    struct stat st;
+    if (lstat(start, &st) < 0) {
+        if (f.hasName) {
+            glob_matcher_free(&f.name);
+        }
+        return 0;
+    }
+    const char *base = strrchr(start, '/');
+    base = base && base[1] ? base + 1 : start;
+    if ((!f.hasName || glob_match(&f.name, base, strlen(base))) &&
+        (type == DT_UNKNOWN || (int)IFTODT(st.st_mode) == type)) {
+        glob_result_add(out, start, strlen(start), "", 0, false);
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        size_t len = strlen(start);
+        char *prefix = malloc(len + 2);
+        memcpy(prefix, start, len + 1);
+        if (len == 0 || start[len - 1] != '/') {
+            strcat(prefix, "/");
+        }
+        walk_run(prefix, 1, walk_threads(), findVisit, &f, out);
+        free(prefix);
+    }
+    if (f.hasName) {
+        glob_matcher_free(&f.name);
+    }
+    return out->count - before;
+}
+
+/*
+Directory walker end-----------------------------------------
+*/
@@ -1,4 +1,12 @@
 #include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <readline/history.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
 
@@ -164,6 +172,1202 @@ void test_ch_dir_root(void)
      cmd_free(cmd);
 }
 
+void test_sched_usage(void)
+{
+     // a child that burns some cpu, reaped with wait4 like a background job
+     pid_t pid = fork();
+     if (pid == 0) {
+          volatile unsigned long spin = 0;
+          struct timespec start, now;
+          clock_gettime(CLOCK_MONOTONIC, &start);
+          do {
+               for (int i = 0; i < 100000; i++) {
+                    spin++;
+               }
+               clock_gettime(CLOCK_MONOTONIC, &now);
+          } while ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) < 50000000L);
+          _exit(0);
+     }
+     int status;
+     struct rusage usage;
+     TEST_ASSERT_EQUAL_INT(pid, wait4(pid, &status, 0, &usage));
+     TEST_ASSERT_TRUE(usage.ru_utime.tv_sec > 0 || usage.ru_utime.tv_usec > 0);
+
+     struct rusage total;
+     memset(&total, 0, sizeof(total));
+     sched_add_usage(&total, &usage);
+     sched_add_usage(&total, &usage);
+     long long once = usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec;
+     TEST_ASSERT_EQUAL_INT64(once * 2, total.ru_utime.tv_sec * 1000000LL + total.ru_utime.tv_usec);
+     TEST_ASSERT_EQUAL_INT64(usage.ru_maxrss, total.ru_maxrss); // the peak, not a sum
+     TEST_ASSERT_EQUAL_INT64(usage.ru_nvcsw * 2, total.ru_nvcsw);
+
+     struct rusage fixed;
+     memset(&fixed, 0, sizeof(fixed));
+     fixed.ru_utime.tv_sec = 1;
+     fixed.ru_utime.tv_usec = 250000;
+     fixed.ru_maxrss = 2048;
+     fixed.ru_nvcsw = 3;
+     fixed.ru_nivcsw = 4;
+     char line[160];
+     sched_format_usage(line, sizeof(line), &fixed, 2.5);
+     TEST_ASSERT_EQUAL_STRING("wall 2.500s  user 1.250s  sys 0.000s  maxrss 2048kB  csw 3/4", line);
+     sched_format_usage(line, sizeof(line), &fixed, -1);
+     TEST_ASSERT_EQUAL_STRING("user 1.250s  sys 0.000s  maxrss 2048kB  csw 3/4", line);
+}
+
+void test_sched_slots(void)
+{
+     TEST_ASSERT_EQUAL_INT(4, sched_slots(4, 0, 0, false));
+     TEST_ASSERT_EQUAL_INT(1, sched_slots(4, 2, 1, false)); // stopped jobs keep their slots
+     TEST_ASSERT_EQUAL_INT(0, sched_slots(4, 4, 0, false));
+     TEST_ASSERT_EQUAL_INT(0, sched_slots(2, 5, 0, false)); // limit lowered below what runs
+     TEST_ASSERT_EQUAL_INT(0, sched_slots(4, 0, 0, true)); // pressure holds the queue
+}
+
+void test_sched_deps(void)
+{
+     // 1 <- 2 <- 3, 4 waits on 1 too and 5 waits on nothing
+     int after2[] = {1};
+     int after3[] = {2};
+     int after4[] = {5, 1};
+     char outcomes[8] = {JOB_UNKNOWN};
+
+     TEST_ASSERT_EQUAL_INT(JOB_SUCCEEDED, sched_deps(NULL, 0, outcomes, 8));
+     TEST_ASSERT_EQUAL_INT(JOB_UNKNOWN, sched_deps(after2, 1, outcomes, 8));
+     TEST_ASSERT_EQUAL_INT(JOB_UNKNOWN, sched_deps(after4, 2, outcomes, 8));
+
+     // 1 succeeds, 2 may run, 3 still waits on 2
+     outcomes[1] = JOB_SUCCEEDED;
+     TEST_ASSERT_EQUAL_INT(JOB_SUCCEEDED, sched_deps(after2, 1, outcomes, 8));
+     TEST_ASSERT_EQUAL_INT(JOB_UNKNOWN, sched_deps(after3, 1, outcomes, 8));
+
+     // 2 fails, 3 is skipped and marked failed so anything after it skips too
+     outcomes[2] = JOB_FAILED;
+     TEST_ASSERT_EQUAL_INT(JOB_FAILED, sched_deps(after3, 1, outcomes, 8));
+
+     // a failure wins over a dependency that has not finished
+     outcomes[1] = JOB_FAILED;
+     TEST_ASSERT_EQUAL_INT(JOB_FAILED, sched_deps(after4, 2, outcomes, 8));
+
+     // ids past the table have not finished
+     int late[] = {20};
+     TEST_ASSERT_EQUAL_INT(JOB_UNKNOWN, sched_deps(late, 1, outcomes, 8));
+     TEST_ASSERT_EQUAL_INT(JOB_UNKNOWN, sched_deps(late, 1, NULL, 0));
+}
+
+void test_sched_pressure(void)
+{
+     // a limit of 0 turns its check off, -1 is an unreadable PSI file
+     TEST_ASSERT_FALSE(sched_pressure_high(50, 50, 0, 0));
+     TEST_ASSERT_TRUE(sched_pressure_high(20, 0, 20, 0));
+     TEST_ASSERT_FALSE(sched_pressure_high(19.9, 90, 20, 0));
+     TEST_ASSERT_TRUE(sched_pressure_high(0, 30, 20, 25));
+     TEST_ASSERT_FALSE(sched_pressure_high(-1, -1, 20, 25));
+
+     // the last running job is never stopped, and only with job psi stop on
+     TEST_ASSERT_TRUE(sched_should_throttle(true, true, 2));
+     TEST_ASSERT_FALSE(sched_should_throttle(true, true, 1));
+     TEST_ASSERT_FALSE(sched_should_throttle(true, false, 3));
+     TEST_ASSERT_FALSE(sched_should_throttle(false, true, 3));
+
+     TEST_ASSERT_TRUE(sched_should_resume(false, 1));
+     TEST_ASSERT_FALSE(sched_should_resume(true, 1));
+     TEST_ASSERT_FALSE(sched_should_resume(false, 0));
+
+     // highest nice value is stopped first, the newest one on a tie
+     int nice[] = {0, 10, 5, 10, -5};
+     TEST_ASSERT_EQUAL_INT(3, sched_victim(nice, 5));
+     TEST_ASSERT_EQUAL_INT(1, sched_victim(nice, 3));
+     TEST_ASSERT_EQUAL_INT(0, sched_victim(nice, 1));
+     TEST_ASSERT_EQUAL_INT(-1, sched_victim(nice, 0));
+}
+
+void test_runtime_key_subcommand(void)
+{
+     char **a = cmd_parse("git commit -m x");
+     char **b = cmd_parse("/usr/bin/git -v commit");
+     char **c = cmd_parse("git push");
+     TEST_ASSERT_EQUAL_UINT64(runtime_key(a), runtime_key(b));
+     TEST_ASSERT_NOT_EQUAL(runtime_key(a), runtime_key(c));
+     cmd_free(a);
+     cmd_free(b);
+     cmd_free(c);
+}
+
+void test_runtime_key_file_args(void)
+{
+     char **a = cmd_parse("cat a.txt");
+     char **b = cmd_parse("cat /tmp/b.log");
+     TEST_ASSERT_EQUAL_UINT64(runtime_key(a), runtime_key(b));
+     cmd_free(a);
+     cmd_free(b);
+}
+
+void test_runtime_round_trip(void)
+{
+     char path[] = "/tmp/test-lab-runtimeXXXXXX";
+     int fd = mkstemp(path);
+     close(fd);
+     setenv("LAB_RUNTIME_FILE", path, 1);
+     runtime_free(); // forget any path an earlier test cached
+
+     uint64_t make = 11, ls = 12;
+     TEST_ASSERT_EQUAL_FLOAT(-1, runtime_estimate(make));
+     runtime_record(make, 1.0);
+     runtime_record(make, 3.0);
+     runtime_record(ls, 0.5);
+     TEST_ASSERT_EQUAL_FLOAT(2.0, runtime_estimate(make)); // mean of the first ones
+     TEST_ASSERT_EQUAL_FLOAT(0.5, runtime_estimate(ls));
+
+     // a new shell reads the log back
+     runtime_free();
+     TEST_ASSERT_EQUAL_FLOAT(2.0, runtime_estimate(make));
+     TEST_ASSERT_EQUAL_FLOAT(0.5, runtime_estimate(ls));
+
+     // 100 records for two keys get compacted to one each on the next load
+     for (int i = 0; i < 97; i++) {
+          runtime_record(ls, 0.5);
+     }
+     struct stat st;
+     stat(path, &st);
+     TEST_ASSERT_EQUAL_INT(4 + 100 * 16, st.st_size);
+     runtime_free();
+     TEST_ASSERT_EQUAL_FLOAT(2.0, runtime_estimate(make));
+     stat(path, &st);
+     TEST_ASSERT_EQUAL_INT(4 + 2 * 16, st.st_size);
+     TEST_ASSERT_EQUAL_FLOAT(0.5, runtime_estimate(ls));
+
+     // and the compacted file still loads
+     runtime_free();
+     TEST_ASSERT_EQUAL_FLOAT(2.0, runtime_estimate(make));
+     TEST_ASSERT_EQUAL_FLOAT(0.5, runtime_estimate(ls));
+
+     // a record another shell appends while a compaction waits for the
+     // lock is in the rewritten file
+     for (int i = 0; i < 98; i++) {
+          runtime_record(ls, 0.5);
+     }
+     runtime_free();
+     int lock = open(path, O_WRONLY | O_APPEND);
+     TEST_ASSERT_EQUAL_INT(0, flock(lock, LOCK_EX));
+     pid_t pid = fork();
+     if (pid == 0) {
+          close(lock); // the lock stays with the parent's copy
+          runtime_estimate(make); // loads, then blocks compacting
+          _exit(0);
+     }
+     usleep(100000);
+     struct { uint64_t key; float seconds; uint32_t count; } late = {13, 4.0f, 1};
+     TEST_ASSERT_EQUAL_INT((int)sizeof(late), (int)write(lock, &late, sizeof(late)));
+     close(lock);
+     waitpid(pid, NULL, 0);
+     stat(path, &st);
+     TEST_ASSERT_EQUAL_INT(4 + 3 * 16, st.st_size);
+     TEST_ASSERT_EQUAL_FLOAT(4.0, runtime_estimate(13));
+
+     runtime_free();
+     unsetenv("LAB_RUNTIME_FILE");
+     unlink(path);
+}
+
+// Function to open a fresh history file in /tmp, path needs 32 bytes
+static void open_temp_hist(char *path)
+{
+     strcpy(path, "/tmp/test-lab-histXXXXXX");
+     int fd = mkstemp(path);
+     TEST_ASSERT_TRUE(fd >= 0);
+     close(fd);
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+}
+
+// Function to close the history and remove the file with its index and
+// block file
+static void close_temp_hist(const char *path)
+{
+     hist_close();
+     char other[256];
+     snprintf(other, sizeof(other), "%s.idx", path);
+     unlink(other);
+     snprintf(other, sizeof(other), "%s.blk", path);
+     unlink(other);
+     unlink(path);
+}
+
+void test_hist_append_reopen(void)
+{
+     char path[32];
+     open_temp_hist(path);
+     TEST_ASSERT_EQUAL_INT(0, hist_append("ls -a"));
+     TEST_ASSERT_EQUAL_INT(0, hist_append("make check"));
+     hist_close();
+
+     // a fresh open reads the entries back through the index
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+     TEST_ASSERT_EQUAL_size_t(2, hist_count());
+     size_t len;
+     const char *line = hist_get(1, &len);
+     TEST_ASSERT_EQUAL_size_t(10, len);
+     TEST_ASSERT_EQUAL_STRING_LEN("make check", line, len);
+     TEST_ASSERT_NULL(hist_get(2, &len));
+     close_temp_hist(path);
+}
+
+void test_hist_corrupt_index(void)
+{
+     char path[32];
+     open_temp_hist(path);
+     hist_append("one");
+     hist_append("two");
+     hist_append("three");
+     hist_close();
+
+     // offsets start after the 16 byte index header
+     char idx[256];
+     snprintf(idx, sizeof(idx), "%s.idx", path);
+     int ifd = open(idx, O_RDWR);
+     uint64_t bad[] = {0x7fffffffffffffffull, 1, UINT64_MAX};
+     for (int i = 0; i < 3; i++) {
+          // past the end, out of order and wrapping around, all make it rebuild
+          TEST_ASSERT_EQUAL_INT(8, pwrite(ifd, &bad[i], 8, 16 + 8 * (i == 1 ? 2 : 1)));
+          TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+          TEST_ASSERT_EQUAL_size_t(3, hist_count());
+          size_t len;
+          const char *line = hist_get(1, &len);
+          TEST_ASSERT_NOT_NULL(line);
+          TEST_ASSERT_EQUAL_STRING_LEN("two", line, len);
+          line = hist_get(2, &len);
+          TEST_ASSERT_NOT_NULL(line);
+          TEST_ASSERT_EQUAL_STRING_LEN("three", line, len);
+          hist_close();
+     }
+     close(ifd);
+
+     // a damaged entry header reads as NULL and is left out of readline
+     int dfd = open(path, O_RDWR);
+     uint32_t zero = 0;
+     TEST_ASSERT_EQUAL_INT(4, pwrite(dfd, &zero, 4, 16 + 3)); // entry 1 follows "one"
+     close(dfd);
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+     size_t len;
+     TEST_ASSERT_NULL(hist_get(1, &len));
+     clear_history();
+     hist_load_readline(10);
+     TEST_ASSERT_EQUAL_INT(2, history_length);
+     TEST_ASSERT_EQUAL_STRING("three", history_get(history_base + 1)->line);
+     clear_history();
+
+     close_temp_hist(path);
+}
+
+void test_hist_sync_other_shell(void)
+{
+     char path[32];
+     open_temp_hist(path);
+     TEST_ASSERT_EQUAL_size_t(0, hist_sync());
+
+     // another shell appends to the same file
+     pid_t pid = fork();
+     if (pid == 0) {
+          hist_close();
+          hist_open(path);
+          hist_append("echo from child");
+          hist_close();
+          _exit(0);
+     }
+     waitpid(pid, NULL, 0);
+
+     TEST_ASSERT_EQUAL_size_t(1, hist_sync());
+     size_t len;
+     const char *line = hist_get(0, &len);
+     TEST_ASSERT_EQUAL_STRING_LEN("echo from child", line, len);
+     close_temp_hist(path);
+}
+
+void test_hist_search(void)
+{
+     char path[32];
+     open_temp_hist(path);
+     hist_append("git commit -m wip");
+     hist_append("make check");
+     hist_append("git push origin master");
+     hist_append("git commit --amend");
+
+     size_t ids[8];
+     // substring through the trigram index, newest first
+     TEST_ASSERT_EQUAL_size_t(2, hist_search("commit", false, hist_count(), ids, 8));
+     TEST_ASSERT_EQUAL_size_t(3, ids[0]);
+     TEST_ASSERT_EQUAL_size_t(0, ids[1]);
+     // only older than entry 3
+     TEST_ASSERT_EQUAL_size_t(1, hist_search("commit", false, 3, ids, 8));
+     TEST_ASSERT_EQUAL_size_t(0, hist_search("rebase", false, hist_count(), ids, 8));
+     // fuzzy, characters in order
+     TEST_ASSERT_EQUAL_size_t(1, hist_search("GPOM", true, hist_count(), ids, 8));
+     TEST_ASSERT_EQUAL_size_t(2, ids[0]);
+     close_temp_hist(path);
+}
+
+void test_hist_expand(void)
+{
+     char path[32];
+     open_temp_hist(path);
+     hist_append("git commit -m wip");
+     hist_append("make check");
+     hist_append("git push origin master");
+
+     char *out;
+     TEST_ASSERT_EQUAL_INT(0, hist_expand("ls -l", &out));
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("sudo !!", &out));
+     TEST_ASSERT_EQUAL_STRING("sudo git push origin master", out);
+     free(out);
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("!2", &out));
+     TEST_ASSERT_EQUAL_STRING("make check", out);
+     free(out);
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("!-3", &out));
+     TEST_ASSERT_EQUAL_STRING("git commit -m wip", out);
+     free(out);
+     // newest entry with the prefix
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("!git", &out));
+     TEST_ASSERT_EQUAL_STRING("git push origin master", out);
+     free(out);
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("!ma -j4", &out));
+     TEST_ASSERT_EQUAL_STRING("make check -j4", out);
+     free(out);
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("echo !$", &out));
+     TEST_ASSERT_EQUAL_STRING("echo master", out);
+     free(out);
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("^master^main", &out));
+     TEST_ASSERT_EQUAL_STRING("git push origin main", out);
+     free(out);
+     // no expansion in single quotes or before a space
+     TEST_ASSERT_EQUAL_INT(0, hist_expand("echo '!!' ! x", &out));
+     TEST_ASSERT_EQUAL_INT(-1, hist_expand("!svn", &out));
+     TEST_ASSERT_EQUAL_INT(-1, hist_expand("!99", &out));
+     // a ! before the closing quote is left alone, like in bash
+     TEST_ASSERT_EQUAL_INT(0, hist_expand("echo \"hi!\"", &out));
+
+     // prefixes longer than the trie keys share their first bytes
+     hist_append("/opt/toolchains/gcc-13/bin/gcc -O2 a.c");
+     hist_append("/opt/toolchains/gcc-12/bin/gcc -O2 b.c");
+     hist_append("/opt/toolchains/gcc-12/lib/cc1 x.i");
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("!/opt/toolchains/gcc-13/bin", &out));
+     TEST_ASSERT_EQUAL_STRING("/opt/toolchains/gcc-13/bin/gcc -O2 a.c", out);
+     free(out);
+     TEST_ASSERT_EQUAL_INT(1, hist_expand("!/opt/toolchains/gcc-12/bin", &out));
+     TEST_ASSERT_EQUAL_STRING("/opt/toolchains/gcc-12/bin/gcc -O2 b.c", out);
+     free(out);
+     TEST_ASSERT_EQUAL_INT(-1, hist_expand("!/opt/toolchains/gcc-11/bin", &out));
+     close_temp_hist(path);
+}
+
+static void collect_keys(const char *key, size_t len, int value, void *ctx)
+{
+     UNUSED(value);
+     strncat((char *)ctx, key, len);
+     strcat((char *)ctx, ",");
+}
+
+void test_trie_insert_walk(void)
+{
+     struct trie t;
+     trie_init(&t);
+     trie_insert(&t, "make", 4, 0, NULL, NULL);
+     trie_insert(&t, "man", 3, 1, NULL, NULL);
+     trie_insert(&t, "ls", 2, 2, NULL, NULL);
+
+     int node = trie_find(&t, "man", 3);
+     TEST_ASSERT_TRUE(node > 0);
+     TEST_ASSERT_EQUAL_INT(1, t.nodes[node].value);
+     TEST_ASSERT_EQUAL_INT(-1, trie_find(&t, "mv", 2));
+
+     char keys[64] = "";
+     trie_walk(&t, "ma", 2, collect_keys, keys);
+     TEST_ASSERT_EQUAL_STRING("make,man,", keys);
+     trie_free(&t);
+}
+
+void test_frecency_suggest(void)
+{
+     int64_t now = 1700000000;
+     // used often a month ago
+     for (int i = 0; i < 5; i++) {
+          frecency_add("git stash", 9, now - 30 * 24 * 3600);
+     }
+     // used once just now
+     frecency_add("git status", 10, now);
+
+     TEST_ASSERT_EQUAL_STRING("git status", frecency_suggest("git st", 6));
+     TEST_ASSERT_EQUAL_STRING("git stash", frecency_suggest("git stas", 8));
+     TEST_ASSERT_NULL(frecency_suggest("git status", 10));
+     TEST_ASSERT_NULL(frecency_suggest("ls", 2));
+     frecency_free();
+}
+
+static void make_file(const char *dir, const char *name, mode_t mode)
+{
+     char path[256];
+     snprintf(path, sizeof(path), "%s/%s", dir, name);
+     FILE *f = fopen(path, "w");
+     fclose(f);
+     chmod(path, mode);
+}
+
+void test_path_cache(void)
+{
+     char dir[] = "/tmp/test-lab-pathXXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     make_file(dir, "labtool", 0755);
+     make_file(dir, "notes", 0644);
+     char *oldPath = strdup(getenv("PATH"));
+     setenv("PATH", dir, 1);
+
+     char buf[256], expected[256];
+     snprintf(expected, sizeof(expected), "%s/labtool", dir);
+     TEST_ASSERT_EQUAL_STRING(expected, path_lookup("labtool", buf, sizeof(buf)));
+     TEST_ASSERT_NULL(path_lookup("notes", buf, sizeof(buf)));
+
+     // picked up from inotify, not a new scan
+     make_file(dir, "labother", 0755);
+     TEST_ASSERT_NOT_NULL(path_lookup("labother", buf, sizeof(buf)));
+
+     // relative entries are left to execvp, so is anything after one
+     char relative[64];
+     snprintf(relative, sizeof(relative), "%s::.", dir);
+     setenv("PATH", relative, 1);
+     TEST_ASSERT_NOT_NULL(path_lookup("labother", buf, sizeof(buf)));
+     snprintf(relative, sizeof(relative), ".:%s", dir);
+     setenv("PATH", relative, 1);
+     TEST_ASSERT_NULL(path_lookup("labother", buf, sizeof(buf)));
+     snprintf(relative, sizeof(relative), ":%s", dir);
+     setenv("PATH", relative, 1);
+     TEST_ASSERT_NULL(path_lookup("labother", buf, sizeof(buf)));
+     setenv("PATH", dir, 1);
+     snprintf(buf, sizeof(buf), "%s/labtool", dir);
+     unlink(buf);
+     TEST_ASSERT_NULL(path_lookup("labtool", buf, sizeof(buf)));
+
+     snprintf(buf, sizeof(buf), "%s/labother", dir);
+     unlink(buf);
+     snprintf(buf, sizeof(buf), "%s/notes", dir);
+     unlink(buf);
+     rmdir(dir);
+     setenv("PATH", oldPath, 1);
+     free(oldPath);
+     path_cache_free();
+}
+
+void test_dir_cache(void)
+{
+     char dir[] = "/tmp/test-lab-dirXXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     make_file(dir, "beta.log", 0644);
+     make_file(dir, "alpha.txt", 0644);
+     make_file(dir, "alpha.c", 0644);
+
+     const struct dir_listing *d = dir_list(dir);
+     TEST_ASSERT_NOT_NULL(d);
+     TEST_ASSERT_EQUAL_size_t(3, d->count);
+     size_t first;
+     TEST_ASSERT_EQUAL_size_t(2, dir_prefix(d, "alpha", 5, &first));
+     TEST_ASSERT_EQUAL_STRING("alpha.c", dir_name(d, first));
+     TEST_ASSERT_EQUAL_STRING("alpha.txt", dir_name(d, first + 1));
+     TEST_ASSERT_EQUAL_size_t(0, dir_prefix(d, "gamma", 5, &first));
+     TEST_ASSERT_EQUAL_INT(DT_REG, dir_type(d, 0));
+
+     // same directory unchanged comes from the cache, a new file reads it again
+     TEST_ASSERT_EQUAL_PTR(d, dir_list(dir));
+     struct timespec pause = {0, 10000000};
+     nanosleep(&pause, NULL);
+     make_file(dir, "aardvark", 0644);
+     d = dir_list(dir);
+     TEST_ASSERT_EQUAL_size_t(4, d->count);
+     TEST_ASSERT_EQUAL_STRING("aardvark", dir_name(d, 0));
+
+     const char *names[] = {"aardvark", "alpha.c", "alpha.txt", "beta.log"};
+     char path[256];
+     for (int i = 0; i < 4; i++) {
+          snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+          unlink(path);
+     }
+     rmdir(dir);
+     dir_cache_free();
+}
+
+void test_bk_search(void)
+{
+     const char *words[] = {"git", "gcc", "grep", "make", "cmake", "gzip", "less"};
+     struct bk_tree t;
+     bk_init(&t);
+     for (int i = 0; i < 7; i++) {
+          bk_insert(&t, words[i]);
+     }
+     TEST_ASSERT_EQUAL_INT(2, bk_distance("gti", "git"));
+     TEST_ASSERT_EQUAL_INT(2, bk_distance("mkae", "make"));
+
+     const char *found[8];
+     int distances[8];
+     TEST_ASSERT_EQUAL_size_t(2, bk_search(&t, "mak", 2, found, distances, 8));
+     TEST_ASSERT_EQUAL_size_t(0, bk_search(&t, "python", 2, found, distances, 8));
+     size_t n = bk_search(&t, "grp", 1, found, distances, 8);
+     TEST_ASSERT_EQUAL_size_t(1, n);
+     TEST_ASSERT_EQUAL_STRING("grep", found[0]);
+
+     // with more matches than room the closest ones are kept
+     const char *close[] = {"mke", "cmake", "gmake", "maker", "mk", "mak"};
+     for (int i = 0; i < 6; i++) {
+          bk_insert(&t, close[i]);
+     }
+     n = bk_search(&t, "mak", 2, found, distances, 2);
+     TEST_ASSERT_EQUAL_size_t(2, n);
+     TEST_ASSERT_EQUAL_INT(1, distances[0] + distances[1]); // mak and one of make, mke, mk
+     bk_free(&t);
+}
+
+void test_exec_not_found_status(void)
+{
+     char **args = cmd_parse("no-such-command-here");
+     pid_t pid = forkCommand(args, 1);
+     TEST_ASSERT_TRUE(pid > 0);
+     int status;
+     TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+     TEST_ASSERT_TRUE(WIFEXITED(status));
+     TEST_ASSERT_EQUAL_INT(127, WEXITSTATUS(status));
+     cmd_free(args);
+}
+
+static bool matches(const char *pattern, const char *s)
+{
+     struct glob_matcher m;
+     glob_compile(&m, pattern, strlen(pattern));
+     bool r = glob_match(&m, s, strlen(s));
+     glob_matcher_free(&m);
+     return r;
+}
+
+void test_glob_match(void)
+{
+     TEST_ASSERT_TRUE(matches("*.log", "build.log"));
+     TEST_ASSERT_FALSE(matches("*.log", "build.log.1"));
+     TEST_ASSERT_TRUE(matches("core.*", "core.1234"));
+     TEST_ASSERT_TRUE(matches("a*b*c", "aXXbYYbZc"));
+     TEST_ASSERT_FALSE(matches("a*b*c", "aXXbYY"));
+     TEST_ASSERT_TRUE(matches("f??.o", "f01.o"));
+     TEST_ASSERT_FALSE(matches("f??.o", "f1.o"));
+     TEST_ASSERT_TRUE(matches("[a-c]x[!0-9]", "bxy"));
+     TEST_ASSERT_FALSE(matches("[a-c]x[!0-9]", "bx7"));
+     TEST_ASSERT_TRUE(matches("[[:digit:]]*", "9lives"));
+     TEST_ASSERT_TRUE(matches("\\*", "*"));
+     TEST_ASSERT_FALSE(matches("\\*", "x"));
+     TEST_ASSERT_TRUE(matches("[x", "[x"));
+     TEST_ASSERT_TRUE(glob_has_magic("*.c"));
+     TEST_ASSERT_FALSE(glob_has_magic("\\*.c"));
+     TEST_ASSERT_FALSE(glob_has_magic("plain"));
+}
+
+void test_glob_run(void)
+{
+     char dir[] = "/tmp/test-lab-globXXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char path[256];
+     const char *dirs[] = {"a", "a/b", "a.d", ".hid"};
+     for (int i = 0; i < 4; i++) {
+          snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+          mkdir(path, 0755);
+     }
+     const char *files[] = {"x.o", "a/y.o", "a/b/z.o", "a.d/v.o", ".hid/h.o", "a/b/q.c"};
+     for (int i = 0; i < 6; i++) {
+          make_file(dir, files[i], 0644);
+     }
+
+     char *cwd = getcwd(NULL, 0);
+     TEST_ASSERT_EQUAL_INT(0, chdir(dir));
+     struct glob_result r = {0};
+     // sorted as whole paths, hidden directories skipped
+     TEST_ASSERT_EQUAL_size_t(4, glob_run("**/*.o", &r));
+     TEST_ASSERT_EQUAL_STRING("a.d/v.o", r.arena + r.offsets[0]);
+     TEST_ASSERT_EQUAL_STRING("a/b/z.o", r.arena + r.offsets[1]);
+     TEST_ASSERT_EQUAL_STRING("a/y.o", r.arena + r.offsets[2]);
+     TEST_ASSERT_EQUAL_STRING("x.o", r.arena + r.offsets[3]);
+     glob_result_free(&r);
+     TEST_ASSERT_EQUAL_size_t(2, glob_run("*/", &r));
+     TEST_ASSERT_EQUAL_STRING("a.d/", r.arena + r.offsets[0]);
+     glob_result_free(&r);
+     TEST_ASSERT_EQUAL_size_t(0, glob_run("*.c", &r));
+
+     char **args = cmd_parse("ls a/*/*.? none*");
+     char **argv = sh_expand(args);
+     TEST_ASSERT_EQUAL_STRING("ls", argv[0]);
+     TEST_ASSERT_EQUAL_STRING("a/b/q.c", argv[1]);
+     TEST_ASSERT_EQUAL_STRING("a/b/z.o", argv[2]);
+     TEST_ASSERT_EQUAL_STRING("none*", argv[3]);
+     TEST_ASSERT_NULL(argv[4]);
+     free(argv);
+     cmd_free(args);
+
+     TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+     free(cwd);
+     for (int i = 5; i >= 0; i--) {
+          snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+          unlink(path);
+     }
+     for (int i = 3; i >= 0; i--) {
+          snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+          rmdir(path);
+     }
+     rmdir(dir);
+     dir_cache_free();
+}
+
+void test_walk_find(void)
+{
+     char dir[] = "/tmp/test-lab-findXXXXXX";
+     TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+     char path[256];
+     const char *dirs[] = {"d", "d/e", "f"};
+     for (int i = 0; i < 3; i++) {
+          snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+          mkdir(path, 0755);
+     }
+     const char *files[] = {"a.c", "d/b.c", "d/e/c.h", "f/d.c"};
+     for (int i = 0; i < 4; i++) {
+          make_file(dir, files[i], 0644);
+     }
+
+     // the same order every run, whatever order the threads ran in
+     struct glob_result r = {0};
+     TEST_ASSERT_EQUAL_size_t(3, walk_find(dir, "*.c", DT_UNKNOWN, &r));
+     snprintf(path, sizeof(path), "%s/a.c", dir);
+     TEST_ASSERT_EQUAL_STRING(path, r.arena + r.offsets[0]);
+     snprintf(path, sizeof(path), "%s/d/b.c", dir);
+     TEST_ASSERT_EQUAL_STRING(path, r.arena + r.offsets[1]);
+     snprintf(path, sizeof(path), "%s/f/d.c", dir);
+     TEST_ASSERT_EQUAL_STRING(path, r.arena + r.offsets[2]);
+     glob_result_free(&r);
+
+     // the start is included, directories before what is in them
+     TEST_ASSERT_EQUAL_size_t(4, walk_find(dir, NULL, DT_DIR, &r));
+     TEST_ASSERT_EQUAL_STRING(dir, r.arena + r.offsets[0]);
+     snprintf(path, sizeof(path), "%s/d/e", dir);
+     TEST_ASSERT_EQUAL_STRING(path, r.arena + r.offsets[2]);
+     glob_result_free(&r);
+     TEST_ASSERT_EQUAL_size_t(0, walk_find("/nonexistent-lab", NULL, DT_UNKNOWN, &r));
+
+     for (int i = 3; i >= 0; i--) {
+          snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+          unlink(path);
+     }
+     for (int i = 2; i >= 0; i--) {
+          snprintf(path, sizeof(path), "%s/%s", dir, dirs[i]);
+          rmdir(path);
+     }
+     rmdir(dir);
+}
+
+void test_brace_expand(void)
+{
+     struct brace_gen g;
+     size_t len;
+     TEST_ASSERT_TRUE(brace_init(&g, "x{a,b{1,2},}y"));
+     const char *want[] = {"xay", "xb1y", "xb2y", "xy"};
+     for (int i = 0; i < 4; i++) {
+          TEST_ASSERT_EQUAL_STRING(want[i], brace_next(&g, &len));
+     }
+     TEST_ASSERT_NULL(brace_next(&g, &len));
+     brace_free(&g);
+
+     TEST_ASSERT_TRUE(brace_init(&g, "{08..11..3}{a..b}"));
+     TEST_ASSERT_EQUAL_STRING("08a", brace_next(&g, &len));
+     TEST_ASSERT_EQUAL_STRING("08b", brace_next(&g, &len));
+     TEST_ASSERT_EQUAL_STRING("11a", brace_next(&g, &len));
+     TEST_ASSERT_EQUAL_STRING("11b", brace_next(&g, &len));
+     TEST_ASSERT_NULL(brace_next(&g, &len));
+     brace_free(&g);
+
+     // not brace expressions, kept as they are
+     TEST_ASSERT_FALSE(brace_init(&g, "{a}{a..5}${x}"));
+     TEST_ASSERT_EQUAL_STRING("{a}{a..5}${x}", brace_next(&g, &len));
+     brace_free(&g);
+
+     // a huge range is only made as far as it is used
+     TEST_ASSERT_TRUE(brace_init(&g, "{1..9000000000000000000}"));
+     TEST_ASSERT_EQUAL_STRING("1", brace_next(&g, &len));
+     TEST_ASSERT_EQUAL_STRING("2", brace_next(&g, &len));
+     brace_free(&g);
+     // the range stops at ARG_MAX and says why
+     char **args = cmd_parse("echo {1..9000000000000000000}");
+     int saved = dup(STDERR_FILENO);
+     FILE *err = tmpfile();
+     dup2(fileno(err), STDERR_FILENO);
+     TEST_ASSERT_NULL(sh_expand(args));
+     dup2(saved, STDERR_FILENO);
+     close(saved);
+     char msg[64] = "";
+     rewind(err);
+     TEST_ASSERT_NOT_NULL(fgets(msg, sizeof(msg), err));
+     fclose(err);
+     TEST_ASSERT_EQUAL_STRING("echo: argument list too long\n", msg);
+     cmd_free(args);
+
+     args = cmd_parse("echo a{,}");
+     char **argv = sh_expand(args);
+     TEST_ASSERT_EQUAL_STRING("a", argv[1]);
+     TEST_ASSERT_EQUAL_STRING("a", argv[2]);
+     TEST_ASSERT_NULL(argv[3]);
+     free(argv);
+     cmd_free(args);
+}
+
+void test_alias_expand(void)
+{
+     alias_set("ll", "ls -l");
+     alias_set("ls", "ls --color");
+     alias_set("sudo", "sudo ");
+     alias_set("a", "b x");
+     alias_set("b", "a y");
+     char **words = cmd_parse("ll /tmp");
+     char **expanded = alias_expand(words);
+     // ls inside ls is not expanded again
+     TEST_ASSERT_EQUAL_STRING("ls", expanded[0]);
+     TEST_ASSERT_EQUAL_STRING("--color", expanded[1]);
+     TEST_ASSERT_EQUAL_STRING("-l", expanded[2]);
+     TEST_ASSERT_EQUAL_STRING("/tmp", expanded[3]);
+     TEST_ASSERT_NULL(expanded[4]);
+     cmd_free(expanded);
+     cmd_free(words);
+
+     // a value ending in a space expands the next word too
+     words = cmd_parse("sudo ll ll");
+     expanded = alias_expand(words);
+     TEST_ASSERT_EQUAL_STRING("sudo", expanded[0]);
+     TEST_ASSERT_EQUAL_STRING("ls", expanded[1]);
+     TEST_ASSERT_EQUAL_STRING("ll", expanded[4]);
+     cmd_free(expanded);
+     cmd_free(words);
+
+     // aliases that use each other stop
+     words = cmd_parse("a");
+     expanded = alias_expand(words);
+     TEST_ASSERT_EQUAL_STRING("a", expanded[0]);
+     TEST_ASSERT_EQUAL_STRING("y", expanded[1]);
+     TEST_ASSERT_EQUAL_STRING("x", expanded[2]);
+     cmd_free(expanded);
+     cmd_free(words);
+
+     words = cmd_parse("make ll");
+     TEST_ASSERT_NULL(alias_expand(words));
+     cmd_free(words);
+
+     // enough of them to grow the table, then remove most
+     char name[16];
+     for (int i = 0; i < 300; i++) {
+          snprintf(name, sizeof(name), "g%d", i);
+          alias_set(name, "git");
+     }
+     for (int i = 0; i < 300; i += 2) {
+          snprintf(name, sizeof(name), "g%d", i);
+          TEST_ASSERT_TRUE(alias_unset(name));
+     }
+     for (int i = 0; i < 300; i++) {
+          snprintf(name, sizeof(name), "g%d", i);
+          TEST_ASSERT_EQUAL(i % 2 == 1, alias_get(name) != NULL);
+     }
+     TEST_ASSERT_FALSE(alias_unset("g0"));
+     TEST_ASSERT_EQUAL_STRING("ls -l", alias_get("ll"));
+     alias_free();
+     TEST_ASSERT_NULL(alias_get("ll"));
+}
+
+void test_cmd_substitute(void)
+{
+     char *result;
+     TEST_ASSERT_EQUAL_INT(0, cmd_substitute("echo plain", &result));
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("x$(echo a b)y `echo c` $(echo $(echo in))", &result));
+     TEST_ASSERT_EQUAL_STRING("xa by c in", result);
+     free(result);
+
+     // forked, more than a default pipe buffer of output
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("n $(seq 1 100000)", &result));
+     TEST_ASSERT_EQUAL_size_t(588896, strlen(result));
+     TEST_ASSERT_EQUAL_STRING("\n99999\n100000", result + strlen(result) - 13);
+     free(result);
+
+     TEST_ASSERT_EQUAL_INT(0, cmd_substitute("echo '$(pwd)' '$HOME' $ 5$", &result));
+     TEST_ASSERT_EQUAL_INT(-1, cmd_substitute("echo $(echo", &result));
+     TEST_ASSERT_NULL(result);
+
+     // other builtins run in the child, and the status is kept for $?
+     alias_set("lab_ll", "ls -l");
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("$(alias lab_ll)", &result));
+     TEST_ASSERT_EQUAL_STRING("alias lab_ll='ls -l'", result);
+     free(result);
+     alias_free();
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("$(false)", &result));
+     free(result);
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute_status());
+     TEST_ASSERT_EQUAL_INT(0, cmd_substitute_status());
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("$(exit 3)", &result));
+     free(result);
+     TEST_ASSERT_EQUAL_INT(3, cmd_substitute_status());
+}
+
+void test_arith_eval(void)
+{
+     int64_t v;
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("1 + 2 * 3 - -4 ** 2 % 7", &v));
+     TEST_ASSERT_EQUAL_INT64(1 + 2 * 3 - (16 % 7), v);
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("(0x10 | 8#17) << 2 ^ ~0, 2#101 + 36#z + 64#_", &v));
+     TEST_ASSERT_EQUAL_INT64(5 + 35 + 63, v);
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("9223372036854775807 + 1 == -9223372036854775807 - 1", &v));
+     TEST_ASSERT_EQUAL_INT64(1, v);
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("-9223372036854775807 - 1 / -1", &v));
+     TEST_ASSERT_EQUAL_INT64(-9223372036854775807LL + 1, v);
+
+     // assignments, counters and short circuits
+     var_set("lab_i", "5");
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("lab_i++ + ++lab_i", &v));
+     TEST_ASSERT_EQUAL_INT64(5 + 7, v);
+     TEST_ASSERT_EQUAL_STRING("7", var_get("lab_i"));
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("lab_j = lab_i > 3 ? lab_i *= 2 : 0, $lab_j + ${lab_i}", &v));
+     TEST_ASSERT_EQUAL_INT64(28, v);
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("0 && lab_k++ || lab_missing", &v));
+     TEST_ASSERT_EQUAL_INT64(0, v);
+     TEST_ASSERT_NULL(var_get("lab_k"));
+     for (int i = 0; i < 1000; i++) {
+          TEST_ASSERT_EQUAL_INT(0, arith_eval("lab_n += 2", &v)); // compiled once
+     }
+     TEST_ASSERT_EQUAL_STRING("2000", var_get("lab_n"));
+
+     // a value that is an expression is evaluated, but not forever
+     var_set("lab_e", "lab_i + 1");
+     TEST_ASSERT_EQUAL_INT(0, arith_eval("lab_e * 2", &v));
+     TEST_ASSERT_EQUAL_INT64(30, v);
+     var_set("lab_loop", "lab_loop");
+     TEST_ASSERT_EQUAL_INT(-1, arith_eval("lab_loop", &v));
+
+     TEST_ASSERT_EQUAL_INT(-1, arith_eval("1 / (lab_i - 14)", &v));
+     TEST_ASSERT_EQUAL_INT(-1, arith_eval("2 +", &v));
+     TEST_ASSERT_EQUAL_INT(-1, arith_eval("08", &v));
+
+     char *result;
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("echo $((lab_i + $(echo 1))) ${lab_n}x $lab_none.", &result));
+     TEST_ASSERT_EQUAL_STRING("echo 15 2000x .", result);
+     free(result);
+     var_free();
+     arith_cache_free();
+}
+
+void test_param_expand(void)
+{
+     var_set("lab_p", "/usr/local/lib/libfoo.so.1.2");
+     var_set("lab_s", "hello world hello");
+     var_set("lab_e", "");
+     const char *cases[][2] = {
+          {"${lab_p##*/}", "libfoo.so.1.2"},
+          {"${lab_p%/*}", "/usr/local/lib"},
+          {"${lab_p%%.*}", "/usr/local/lib/libfoo"},
+          {"${lab_p#*/}", "usr/local/lib/libfoo.so.1.2"},
+          {"${#lab_p}", "28"},
+          {"${lab_p:5:3}", "loc"},
+          {"${lab_p: -3}", "1.2"},
+          {"${lab_p:2:-3}", "sr/local/lib/libfoo.so."},
+          {"${lab_s/hello/bye}", "bye world hello"},
+          {"${lab_s//hello/bye}", "bye world bye"},
+          {"${lab_s//[lo]/_}", "he___ w_r_d he___"},
+          {"${lab_s/%l*o/Y}", "heY"},
+          {"${lab_s/#world/X}", "hello world hello"},
+          {"${lab_e:-def} ${lab_e-def}.", "def ."},
+          {"${lab_none:+alt}${lab_e+alt}", "alt"},
+          {"${lab_p/lib*/$lab_e}", "/usr/local/"},
+          {"${lab_new:=set} $lab_new", "set set"},
+     };
+     for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+          char *result;
+          TEST_ASSERT_EQUAL_INT(1, cmd_substitute(cases[i][0], &result));
+          TEST_ASSERT_EQUAL_STRING(cases[i][1], result);
+          free(result);
+     }
+     char *result;
+     TEST_ASSERT_EQUAL_INT(-1, cmd_substitute("${lab_none:?unset}", &result));
+     TEST_ASSERT_EQUAL_INT(-1, cmd_substitute("${lab_p", &result));
+     TEST_ASSERT_EQUAL_INT(-1, cmd_substitute("${lab_p!x}", &result));
+     var_free();
+     param_cache_free();
+}
+
+void test_arrays(void)
+{
+     char **words = cmd_parse("lab_a=(x 'y z' [5]=w) lab_m[two words]=v");
+     TEST_ASSERT_EQUAL_STRING("lab_a=(x 'y z' [5]=w)", words[0]);
+     TEST_ASSERT_EQUAL_STRING("lab_m[two words]=v", words[1]);
+     var_declare("lab_m", true);
+     TEST_ASSERT_EQUAL_INT(0, sh_assign(words));
+     cmd_free(words);
+     TEST_ASSERT_EQUAL_size_t(3, var_each("lab_a", NULL, NULL));
+     TEST_ASSERT_EQUAL_STRING("w", var_get_element("lab_a", "-1"));
+     TEST_ASSERT_NULL(var_get_element("lab_a", "3"));
+     TEST_ASSERT_EQUAL_STRING("v", var_get_element("lab_m", "two words"));
+
+     // "${a[@]}" is a word for each element, an empty array is no word
+     words = cmd_parse("echo \"${lab_a[@]}\" ${lab_a[@]} \"${lab_a[*]}\" \"${lab_e[@]}\" '$x' \\$x");
+     var_clear_array("lab_e");
+     char **argv = sh_expand(words);
+     cmd_free(words);
+     const char *expected[] = {"echo", "x", "y z", "w", "x", "y", "z", "w", "x y z w", "$x", "$x", NULL};
+     for (int i = 0; expected[i] != NULL; i++) {
+          TEST_ASSERT_EQUAL_STRING(expected[i], argv[i]);
+     }
+     TEST_ASSERT_NULL(argv[11]);
+     free(argv);
+
+     // "${a[*]}" puts IFS[0] between elements, spaces inside them stay
+     words = cmd_parse("echo \"${lab_a[*]}\"");
+     var_set("IFS", ",");
+     argv = sh_expand(words);
+     TEST_ASSERT_EQUAL_STRING("x,y z,w", argv[1]);
+     free(argv);
+     var_set("IFS", "");
+     argv = sh_expand(words);
+     TEST_ASSERT_EQUAL_STRING("xy zw", argv[1]);
+     free(argv);
+     var_set("IFS", " \t\n");
+     cmd_free(words);
+
+     char *result;
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("${#lab_a[@]} ${lab_a[1]} ${#lab_a[1]} ${lab_m[two words]}", &result));
+     TEST_ASSERT_EQUAL_STRING("3 y z 3 v", result);
+     free(result);
+
+     for (int i = 0; i < 1000; i++) {
+          var_append("lab_big", "x");
+     }
+     TEST_ASSERT_TRUE(var_set_element("lab_big", "500 * 2", "end"));
+     TEST_ASSERT_EQUAL_size_t(1001, var_each("lab_big", NULL, NULL));
+
+     // a huge subscript is an error, not gigabytes of empty slots
+     TEST_ASSERT_FALSE(var_set_element("lab_big", "1000000000", "x"));
+     TEST_ASSERT_EQUAL_size_t(1001, var_each("lab_big", NULL, NULL));
+     words = cmd_parse("lab_big[1<<40]=x");
+     TEST_ASSERT_EQUAL_INT(1, sh_assign(words));
+     cmd_free(words);
+     var_free();
+}
+
+void test_read_line(void)
+{
+     char path[] = "/tmp/lab-read-XXXXXX";
+     int fd = mkstemp(path);
+     const char *text = "one\ntwo,three\n\nlast";
+     TEST_ASSERT_EQUAL_INT((int)strlen(text), (int)write(fd, text, strlen(text)));
+     lseek(fd, 0, SEEK_SET);
+
+     // a file is read in a block and the offset put back after each line
+     char *line;
+     size_t len;
+     TEST_ASSERT_EQUAL_INT(1, read_line(fd, '\n', &line, &len));
+     TEST_ASSERT_EQUAL_STRING("one", line);
+     TEST_ASSERT_EQUAL_INT(4, (int)lseek(fd, 0, SEEK_CUR));
+     free(line);
+     TEST_ASSERT_EQUAL_INT(1, read_line(fd, ',', &line, &len));
+     TEST_ASSERT_EQUAL_STRING("two", line);
+     free(line);
+     lseek(fd, 12, SEEK_SET); // moved by someone else
+     TEST_ASSERT_EQUAL_INT(1, read_line(fd, '\n', &line, &len));
+     TEST_ASSERT_EQUAL_STRING("e", line);
+     free(line);
+     TEST_ASSERT_EQUAL_INT(1, read_line(fd, '\n', &line, &len));
+     TEST_ASSERT_EQUAL_size_t(0, len);
+     free(line);
+     TEST_ASSERT_EQUAL_INT(0, read_line(fd, '\n', &line, &len));
+     TEST_ASSERT_EQUAL_STRING("last", line);
+     free(line);
+     close(fd);
+     unlink(path);
+
+     // a pipe keeps everything after the line for the next reader
+     int fds[2];
+     TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+     TEST_ASSERT_EQUAL_INT((int)strlen(text), (int)write(fds[1], text, strlen(text)));
+     close(fds[1]);
+     TEST_ASSERT_EQUAL_INT(1, read_line(fds[0], '\n', &line, &len));
+     TEST_ASSERT_EQUAL_STRING("one", line);
+     free(line);
+     char rest[32] = {0};
+     TEST_ASSERT_EQUAL_INT((int)strlen(text) - 4, (int)read(fds[0], rest, sizeof(rest)));
+     TEST_ASSERT_EQUAL_STRING(text + 4, rest);
+     close(fds[0]);
+     read_cache_free();
+}
+
+void test_read_redirect(void)
+{
+     char path[] = "/tmp/lab-read-XXXXXX";
+     int fd = mkstemp(path);
+     const char *text = "one\ntwo words\nthree\n";
+     TEST_ASSERT_EQUAL_INT((int)strlen(text), (int)write(fd, text, strlen(text)));
+     close(fd);
+     struct stat before, after;
+     fstat(STDIN_FILENO, &before);
+     var_set("lab_f", path);
+
+     // while read ...; done < file, stdin is put back after it
+     TEST_ASSERT_EQUAL_INT(0, script_eval(NULL, "s=; while read -r l; do s=$s[$l]; done < $lab_f"));
+     TEST_ASSERT_EQUAL_STRING("[one][two words][three]", var_get("s"));
+     TEST_ASSERT_EQUAL_INT(0, script_eval(NULL, "read -r a b <$lab_f"));
+     TEST_ASSERT_EQUAL_STRING("one", var_get("a"));
+     TEST_ASSERT_EQUAL_STRING("", var_get("b"));
+     // break 2 out of the redirected loop puts stdin back too
+     script_eval(NULL, "s=; for i in 1 2; do while read -r l; do s=$s$i$l; break 2; done < $lab_f; done");
+     TEST_ASSERT_EQUAL_STRING("1one", var_get("s"));
+     TEST_ASSERT_EQUAL_INT(1, script_eval(NULL, "read -r l < /nonexistent/lab"));
+     fstat(STDIN_FILENO, &after);
+     TEST_ASSERT_EQUAL_UINT64(before.st_ino, after.st_ino);
+
+     // names are checked before anything is read
+     TEST_ASSERT_EQUAL_INT(1, script_eval(NULL, "read -r 'a b' < $lab_f"));
+     TEST_ASSERT_EQUAL_INT(1, script_eval(NULL, "read 1x < $lab_f"));
+     TEST_ASSERT_NULL(script_compile("read <", &(bool){false}));
+     unlink(path);
+     var_free();
+     read_cache_free();
+}
+
+void test_script(void)
+{
+     // loops, case and && run builtins with no fork
+     TEST_ASSERT_EQUAL_INT(0, script_eval(NULL, "n=0\nfor i in {1..100}; do\n  (( n += i ))\ndone"));
+     TEST_ASSERT_EQUAL_STRING("5050", var_get("n"));
+     script_eval(NULL, "s=; for x in a b c d; do case $x in a) continue;; c|d) s=$s$x; break;; esac; s=$s$x; done");
+     TEST_ASSERT_EQUAL_STRING("bc", var_get("s"));
+     script_eval(NULL, "i=0; while [ $i -lt 3 ]; do i=$((i+1)); done; until false; do break; done");
+     TEST_ASSERT_EQUAL_STRING("3", var_get("i"));
+     TEST_ASSERT_EQUAL_INT(1, script_eval(NULL, "if false; then r=a; elif ! true; then r=b; else r=c; fi; false"));
+     TEST_ASSERT_EQUAL_STRING("c", var_get("r"));
+     TEST_ASSERT_EQUAL_STRING("1", var_get("?"));
+     script_eval(NULL, "false || r=or; true && r=$r$?");
+     TEST_ASSERT_EQUAL_STRING("or0", var_get("r"));
+     script_eval(NULL, "for i in 1 2; do for j in 1 2; do r=$i$j; break 2; done; done");
+     TEST_ASSERT_EQUAL_STRING("11", var_get("r"));
+
+     // an open loop or quote wants more lines, a stray keyword is an error
+     bool incomplete;
+     TEST_ASSERT_NULL(script_compile("for i in 1 2; do", &incomplete));
+     TEST_ASSERT_TRUE(incomplete);
+     TEST_ASSERT_NULL(script_compile("echo \"abc", &incomplete));
+     TEST_ASSERT_TRUE(incomplete);
+     TEST_ASSERT_NULL(script_compile("echo a; fi", &incomplete));
+     TEST_ASSERT_FALSE(incomplete);
+     struct script *s = script_compile("echo one two", &incomplete);
+     TEST_ASSERT_EQUAL_STRING("two", script_simple(s)[2]);
+     script_free(s);
+
+     char *result;
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("$(for i in 1 2 3; do echo $i; done)", &result));
+     TEST_ASSERT_EQUAL_STRING("1\n2\n3", result);
+     free(result);
+     var_free();
+}
+
+void test_functions(void)
+{
+     // the body is compiled once, calls run it here with their own $1 and $#
+     TEST_ASSERT_EQUAL_INT(0, script_eval(NULL, "add() { sum=$(( $1 + $2 )); n=$#; }; add 2 40 x"));
+     TEST_ASSERT_EQUAL_STRING("42", var_get("sum"));
+     TEST_ASSERT_EQUAL_STRING("3", var_get("n"));
+     TEST_ASSERT_NULL(var_get("1")); // gone after the call
+
+     script_eval(NULL, "each() { r=; for a; do r=$r[$a]; done; shift; r=$r${1}; }; each 'a b' c");
+     TEST_ASSERT_EQUAL_STRING("[a b][c]c", var_get("r"));
+     TEST_ASSERT_EQUAL_INT(3, script_eval(NULL, "f() { r=in; return 3; r=after; }; f"));
+     TEST_ASSERT_EQUAL_STRING("in", var_get("r"));
+     script_eval(NULL, "fib() { if [ $1 -lt 2 ]; then r=$1; return; fi; fib $(( $1 - 1 )); "
+                       "local_a=$r; fib $(( $1 - 2 )); r=$(( local_a + r )); }; fib 1; fib 0");
+     TEST_ASSERT_EQUAL_STRING("0", var_get("r"));
+     script_eval(NULL, "outer() { inner() { r=inner$1; }; inner $1$1; }; outer z");
+     TEST_ASSERT_EQUAL_STRING("innerzz", var_get("r"));
+
+     char *result;
+     TEST_ASSERT_EQUAL_INT(1, cmd_substitute("$(outer y; echo $r) $(echo() { builtin=no; }; echo hi; command echo $builtin)", &result));
+     TEST_ASSERT_EQUAL_STRING("inneryy no", result);
+     free(result);
+     script_functions_free();
+     var_free();
+}
+
+void test_lz_roundtrip(void)
+{
+     const char *text = "git commit -m wip; git commit -m wip again; git push origin master; "
+                        "git commit -m wip; aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+     size_t n = strlen(text);
+     uint8_t *packed = malloc(lz_bound(n));
+     size_t packedSize = lz_compress((const uint8_t *)text, n, packed);
+     TEST_ASSERT_TRUE(packedSize < n);
+
+     char *out = malloc(n);
+     TEST_ASSERT_TRUE(lz_decompress(packed, packedSize, (uint8_t *)out, n));
+     TEST_ASSERT_EQUAL_MEMORY(text, out, n);
+     // the wrong size is an error, not a short read
+     TEST_ASSERT_FALSE(lz_decompress(packed, packedSize, (uint8_t *)out, n - 1));
+     free(packed);
+     free(out);
+}
+
+void test_hist_compact_blocks(void)
+{
+     char path[32];
+     open_temp_hist(path);
+     char line[64];
+     for (int i = 0; i < 600; i++) {
+          snprintf(line, sizeof(line), "make -j8 target%d", i);
+          hist_append(line);
+     }
+     TEST_ASSERT_EQUAL_INT(0, hist_compact(true));
+     hist_close();
+
+     // entries in blocks and after them read back the same
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+     TEST_ASSERT_EQUAL_size_t(600, hist_count());
+     size_t len;
+     const char *got = hist_get(300, &len);
+     TEST_ASSERT_EQUAL_STRING_LEN("make -j8 target300", got, len);
+     got = hist_get(599, &len);
+     TEST_ASSERT_EQUAL_STRING_LEN("make -j8 target599", got, len);
+     TEST_ASSERT_TRUE(hist_time(10) > 0);
+     close_temp_hist(path);
+}
+
+// every entry goes into blocks, so compaction ends at the end of the file
+void test_hist_compact_whole_blocks(void)
+{
+     char path[32];
+     open_temp_hist(path);
+     char line[64];
+     for (int i = 0; i < 1024; i++) {
+          snprintf(line, sizeof(line), "echo whole%d", i);
+          hist_append(line);
+     }
+     TEST_ASSERT_EQUAL_INT(0, hist_compact(true));
+     hist_close();
+
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+     TEST_ASSERT_EQUAL_size_t(1024, hist_count());
+     size_t len;
+     const char *got = hist_get(0, &len);
+     TEST_ASSERT_EQUAL_STRING_LEN("echo whole0", got, len);
+     got = hist_get(1023, &len);
+     TEST_ASSERT_EQUAL_STRING_LEN("echo whole1023", got, len);
+
+     // the history file picks up after the archived bytes
+     TEST_ASSERT_EQUAL_INT(0, hist_append("echo after"));
+     hist_close();
+     TEST_ASSERT_EQUAL_INT(0, hist_open(path));
+     TEST_ASSERT_EQUAL_size_t(1025, hist_count());
+     got = hist_get(1024, &len);
+     TEST_ASSERT_EQUAL_STRING_LEN("echo after", got, len);
+     got = hist_get(511, &len);
+     TEST_ASSERT_EQUAL_STRING_LEN("echo whole511", got, len);
+     close_temp_hist(path);
+}
+
 int main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_cmd_parse);
@@ -178,6 +1382,40 @@ int main(void) {
   RUN_TEST(test_get_prompt_custom);
   RUN_TEST(test_ch_dir_home);
   RUN_TEST(test_ch_dir_root);
+  RUN_TEST(test_sched_usage);
+  RUN_TEST(test_sched_slots);
+  RUN_TEST(test_sched_deps);
+  RUN_TEST(test_sched_pressure);
+  RUN_TEST(test_runtime_key_subcommand);
+  RUN_TEST(test_runtime_key_file_args);
+  RUN_TEST(test_runtime_round_trip);
+  RUN_TEST(test_hist_append_reopen);
+  RUN_TEST(test_hist_corrupt_index);
+  RUN_TEST(test_hist_sync_other_shell);
+  RUN_TEST(test_hist_search);
+  RUN_TEST(test_hist_expand);
+  RUN_TEST(test_trie_insert_walk);
+  RUN_TEST(test_frecency_suggest);
+  RUN_TEST(test_path_cache);
+  RUN_TEST(test_dir_cache);
+  RUN_TEST(test_bk_search);
+  RUN_TEST(test_exec_not_found_status);
+  RUN_TEST(test_glob_match);
+  RUN_TEST(test_glob_run);
+  RUN_TEST(test_walk_find);
+  RUN_TEST(test_brace_expand);
+  RUN_TEST(test_alias_expand);
+  RUN_TEST(test_cmd_substitute);
+  RUN_TEST(test_arith_eval);
+  RUN_TEST(test_param_expand);
+  RUN_TEST(test_arrays);
+  RUN_TEST(test_read_line);
+  RUN_TEST(test_read_redirect);
+  RUN_TEST(test_script);
+  RUN_TEST(test_functions);
+  RUN_TEST(test_lz_roundtrip);
+  RUN_TEST(test_hist_compact_blocks);
+  RUN_TEST(test_hist_compact_whole_blocks);
 
   return UNITY_END();
 }
\ No newline at end of file